@@ -0,0 +1,59 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Helpers shared by the benchmarks in this directory. Every benchmark is a
+// standalone program linked against the gnaro sources, built and run by
+// `make bench`.
+
+// Path of the temporary database file used by a benchmark
+static char bench_filename[] = "/tmp/gnaro_bench_XXXXXX";
+
+// Create an empty temporary database file and return its path
+static inline const char *bench_database_file(void) {
+  strcpy(bench_filename, "/tmp/gnaro_bench_XXXXXX");
+  int fd = mkstemp(bench_filename);
+  close(fd);
+  return bench_filename;
+}
+
+// Remove a temporary database file and its write-ahead log
+static inline void bench_remove_database(const char *filename) {
+  char wal_filename[sizeof(bench_filename) + sizeof("-wal")];
+  snprintf(wal_filename, sizeof(wal_filename), "%s-wal", filename);
+  unlink(wal_filename);
+  unlink(filename);
+}
+
+// Get a monotonic timestamp in seconds
+static inline double bench_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Fill keys with a pseudo-random permutation of 1..count, the same one on
+// every run so that results can be compared
+static inline void bench_shuffled_keys(uint32_t *keys, uint32_t count) {
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (uint32_t i = 0; i < count; i++) {
+    keys[i] = i + 1;
+  }
+  for (uint32_t i = count - 1; i > 0; i--) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    uint32_t j = (uint32_t)(state % (i + 1));
+    uint32_t key = keys[i];
+    keys[i] = keys[j];
+    keys[j] = key;
+  }
+}
+
+#endif
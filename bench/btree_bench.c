@@ -0,0 +1,130 @@
+#include "../include/btree.h"
+#include "../include/cursor.h"
+#include "../include/database.h"
+#include "../include/pager.h"
+#include "../include/row.h"
+#include "../lib/log/log.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Insert millions of keys in sorted and in random order, then look them up in
+// random order, and report the shape of the resulting tree. Usage:
+// btree_bench [rows]
+
+enum {
+  BENCH_DEFAULT_ROWS = 2000000,
+  BENCH_CACHE_PAGES = 65536,
+  // Rows inserted per commit, so that the benchmark measures the tree rather
+  // than the log
+  BENCH_COMMIT_ROWS = 1000
+};
+
+// BenchShape counts the nodes of a tree
+typedef struct {
+  uint32_t height;
+  uint32_t internal_nodes;
+  uint32_t leaves;
+  uint64_t internal_keys;
+} BenchShape;
+
+static void bench_shape(Pager *pager, uint32_t page_num, uint32_t depth,
+                        BenchShape *shape) {
+  void *node = pager_get_page(pager, page_num);
+  if (depth > shape->height) {
+    shape->height = depth;
+  }
+  if (btree_node_get_type(node) == BTREE_NODE_TYPE_LEAF) {
+    shape->leaves++;
+    return;
+  }
+  uint32_t num_keys = *btree_node_internal_num_keys(node);
+  shape->internal_nodes++;
+  shape->internal_keys += num_keys;
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint32_t child_page_num = *btree_node_internal_child(node, i);
+    bench_shape(pager, child_page_num, depth + 1, shape);
+    node = pager_get_page(pager, page_num);
+  }
+  pager_unpin_all(pager);
+}
+
+static void bench_run(const char *order, const uint32_t *keys, uint32_t count,
+                      const uint32_t *lookups) {
+  const char *filename = bench_database_file();
+  PagerConfig config = {
+      .cache_pages = BENCH_CACHE_PAGES,
+      .wal = {.max_batch = 1024, .max_delay_ms = 1000},
+  };
+  Database *database = database_open(filename, &config);
+
+  Row row = {.username = "user", .email = "user@example.com"};
+  double start = bench_now();
+  for (uint32_t i = 0; i < count; i++) {
+    row.id = keys[i];
+    Cursor *cursor = cursor_find_key(database, keys[i]);
+    btree_node_leaf_insert(cursor, keys[i], &row);
+    cursor_close(cursor);
+    if ((i + 1) % BENCH_COMMIT_ROWS == 0) {
+      pager_commit(database->pager);
+      pager_unpin_all(database->pager);
+    }
+  }
+  pager_commit(database->pager);
+  pager_unpin_all(database->pager);
+  double insert_seconds = bench_now() - start;
+
+  start = bench_now();
+  for (uint32_t i = 0; i < count; i++) {
+    Cursor *cursor = cursor_find_key(database, lookups[i]);
+    Row row;
+    cursor_row(cursor, &row);
+    if (row.id != lookups[i]) {
+      fprintf(stderr, "key %u not found\n", lookups[i]);
+      exit(EXIT_FAILURE);
+    }
+    cursor_close(cursor);
+    pager_unpin_all(database->pager);
+  }
+  double lookup_seconds = bench_now() - start;
+
+  BenchShape shape = {0};
+  bench_shape(database->pager, database->root_page_num, 1, &shape);
+  printf("%8s %12.0f %12.0f %8u %10u %10u %12.1f\n", order,
+         count / insert_seconds, count / lookup_seconds, shape.height,
+         shape.internal_nodes, shape.leaves,
+         shape.internal_nodes > 0
+             ? (double)(shape.internal_keys + shape.internal_nodes) /
+                   shape.internal_nodes
+             : 0.0);
+  database_close(database);
+  bench_remove_database(filename);
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t count = BENCH_DEFAULT_ROWS;
+  if (argc > 1) {
+    count = (uint32_t)strtoul(argv[1], NULL, 10);
+  }
+  log_set_quiet(true);
+
+  uint32_t *sorted = malloc(count * sizeof(uint32_t));
+  uint32_t *shuffled = malloc(count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < count; i++) {
+    sorted[i] = i + 1;
+  }
+  bench_shuffled_keys(shuffled, count);
+
+  printf("%u rows, %u keys per internal node\n", count,
+         btree_layout(PAGER_DEFAULT_PAGE_SIZE - PAGER_PAGE_TRAILER_SIZE)
+             .internal_max_keys);
+  printf("%8s %12s %12s %8s %10s %10s %12s\n", "order", "inserts/s",
+         "lookups/s", "height", "internal", "leaves", "fanout");
+  bench_run("sorted", sorted, count, shuffled);
+  bench_run("random", shuffled, count, shuffled);
+
+  free(shuffled);
+  free(sorted);
+  return EXIT_SUCCESS;
+}
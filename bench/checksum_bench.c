@@ -0,0 +1,118 @@
+#include "../include/btree.h"
+#include "../include/checksum.h"
+#include "../include/cursor.h"
+#include "../include/database.h"
+#include "../include/pager.h"
+#include "../include/row.h"
+#include "../lib/log/log.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Measure the cost of page checksums: the time to checksum one page of every
+// size with each CRC32C implementation, then the time added to every page
+// read by a scan that misses the buffer pool. Usage: checksum_bench [rows]
+
+enum {
+  BENCH_DEFAULT_ROWS = 100000,
+  BENCH_CHECKSUM_BYTES = 256 * 1024 * 1024,
+  BENCH_SCAN_CACHE_PAGES = 64,
+  BENCH_SCAN_RUNS = 5
+};
+
+// Time the checksum of BENCH_CHECKSUM_BYTES in pages of the given size, in
+// nanoseconds per page
+static double bench_checksum(uint32_t (*checksum)(uint32_t, const void *,
+                                                  size_t),
+                             const void *page, uint32_t page_size) {
+  uint32_t pages = BENCH_CHECKSUM_BYTES / page_size;
+  uint32_t crc = 0;
+  double start = bench_now();
+  for (uint32_t i = 0; i < pages; i++) {
+    crc = checksum(crc, page, page_size);
+  }
+  double seconds = bench_now() - start;
+  // Keep the loop from being optimized away
+  if (crc == 0x12345678) {
+    printf("!");
+  }
+  return seconds * 1e9 / pages;
+}
+
+// Scan every row with a tiny buffer pool so that every leaf is read from the
+// file, returns the best time of several runs and the pages read by one
+static double bench_scan(const char *filename, bool skip_verify,
+                         uint64_t *misses) {
+  PagerConfig config = {.cache_pages = BENCH_SCAN_CACHE_PAGES,
+                        .skip_verify = skip_verify};
+  double best = 0;
+  for (int run = 0; run < BENCH_SCAN_RUNS; run++) {
+    Database *database = database_open(filename, &config);
+    Row row;
+    double start = bench_now();
+    Cursor *cursor = cursor_start(database);
+    while (!cursor->end_of_table) {
+      cursor_row(cursor, &row);
+      cursor_advance(cursor);
+      pager_unpin_all(database->pager);
+    }
+    cursor_close(cursor);
+    double seconds = bench_now() - start;
+    *misses = database->pager->stats.misses;
+    database_close(database);
+    if (run == 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t count = BENCH_DEFAULT_ROWS;
+  if (argc > 1) {
+    count = (uint32_t)strtoul(argv[1], NULL, 10);
+  }
+  log_set_quiet(true);
+
+  printf("CRC32C per page (%s):\n", checksum_crc32c_implementation());
+  printf("%10s %14s %14s\n", "page size", "ns/page", "portable");
+  void *page = malloc(PAGER_MAX_PAGE_SIZE);
+  for (uint32_t i = 0; i < PAGER_MAX_PAGE_SIZE; i++) {
+    ((uint8_t *)page)[i] = (uint8_t)(i * 131 + 7);
+  }
+  for (uint32_t page_size = PAGER_MIN_PAGE_SIZE;
+       page_size <= PAGER_MAX_PAGE_SIZE; page_size *= 2) {
+    printf("%10u %14.1f %14.1f\n", page_size,
+           bench_checksum(checksum_crc32c, page, page_size),
+           bench_checksum(checksum_crc32c_portable, page, page_size));
+  }
+  free(page);
+
+  const char *filename = bench_database_file();
+  PagerConfig config = {.cache_pages = PAGER_DEFAULT_CACHE_PAGES,
+                        .wal = {.max_batch = 1024, .max_delay_ms = 1000}};
+  Database *database = database_open(filename, &config);
+  Row row = {.username = "user", .email = "user@example.com"};
+  for (uint32_t i = 1; i <= count; i++) {
+    row.id = i;
+    Cursor *cursor = cursor_find_key(database, i);
+    btree_node_leaf_insert(cursor, i, &row);
+    cursor_close(cursor);
+    pager_commit(database->pager);
+    pager_unpin_all(database->pager);
+  }
+  database_close(database);
+
+  uint64_t misses;
+  double verified = bench_scan(filename, false, &misses);
+  double skipped = bench_scan(filename, true, &misses);
+  printf("\nScan of %u rows reading %llu pages from the OS page cache:\n",
+         count, (unsigned long long)misses);
+  printf("- verified: %.2f ms\n", verified * 1e3);
+  printf("- not verified: %.2f ms\n", skipped * 1e3);
+  printf("- overhead per page read: %.1f ns\n",
+         (verified - skipped) * 1e9 / (double)misses);
+  bench_remove_database(filename);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+#include "../include/btree.h"
+#include "../include/cursor.h"
+#include "../include/database.h"
+#include "../include/pager.h"
+#include "../include/row.h"
+#include "../include/statement.h"
+#include "../lib/log/log.h"
+#include "bench.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Run point lookups and short scans from a growing number of threads, alone
+// and next to a thread inserting rows, and report how the throughput scales.
+// Threads beyond the cores online share them, so their speedup measures the
+// cost of latching under time slicing rather than scaling: those rows are
+// marked, and the threads go up to at least the number of cores.
+// Usage: concurrency_bench [rows] [max_threads]
+
+enum {
+  BENCH_DEFAULT_ROWS = 1000000,
+  BENCH_DEFAULT_MAX_THREADS = 8,
+  BENCH_CACHE_PAGES = 65536,
+  // Operations run by every reader thread
+  BENCH_LOOKUPS = 200000,
+  BENCH_SCANS = 2000,
+  BENCH_SCAN_ROWS = 100,
+  BENCH_COMMIT_ROWS = 1000
+};
+
+typedef struct {
+  Database *database;
+  uint32_t count;
+  uint64_t seed;
+  uint64_t rows;
+} BenchReader;
+
+typedef struct {
+  Database *database;
+  uint32_t next_key;
+  atomic_bool stop;
+  uint32_t inserted;
+} BenchWriter;
+
+static uint32_t bench_random(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return (uint32_t)*state;
+}
+
+// Every lookup and scan latches the database for reading like a select does
+static void *bench_read(void *argument) {
+  BenchReader *reader = argument;
+  Database *database = reader->database;
+  Row row;
+  for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+    uint32_t key = bench_random(&reader->seed) % reader->count + 1;
+    database_latch(database, DATABASE_LATCH_READ);
+    Cursor *cursor = cursor_seek(database, key);
+    cursor_row(cursor, &row);
+    cursor_close(cursor);
+    database_unlatch(database, DATABASE_LATCH_READ);
+    if (row.id != key) {
+      fprintf(stderr, "key %u not found\n", key);
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (uint32_t i = 0; i < BENCH_SCANS; i++) {
+    uint32_t key = bench_random(&reader->seed) % reader->count + 1;
+    database_latch(database, DATABASE_LATCH_READ);
+    Cursor *cursor = cursor_seek(database, key);
+    for (uint32_t j = 0; j < BENCH_SCAN_ROWS && !cursor->end_of_table; j++) {
+      cursor_row(cursor, &row);
+      reader->rows++;
+      cursor_advance(cursor);
+    }
+    cursor_close(cursor);
+    database_unlatch(database, DATABASE_LATCH_READ);
+  }
+  return NULL;
+}
+
+// Rows are appended past the keys the readers look up, so that they split the
+// leaves and internal nodes on the right edge of the tree
+static void *bench_write(void *argument) {
+  BenchWriter *writer = argument;
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.username, "user");
+  strcpy(statement.row_to_insert.email, "user@example.com");
+  while (!writer->stop) {
+    statement.row_to_insert.id = writer->next_key++;
+    statement_execute(&statement, writer->database);
+    writer->inserted++;
+  }
+  return NULL;
+}
+
+// Returns the operations per second of the readers, the speedup is relative
+// to the given base
+static double bench_run(Database *database, uint32_t count, uint32_t threads,
+                        uint32_t cores, BenchWriter *writer, double base) {
+  pthread_t *thread_ids = malloc(threads * sizeof(pthread_t));
+  BenchReader *readers = malloc(threads * sizeof(BenchReader));
+  pthread_t writer_id;
+  if (writer != NULL) {
+    writer->stop = false;
+    writer->inserted = 0;
+    pthread_create(&writer_id, NULL, bench_write, writer);
+  }
+
+  double start = bench_now();
+  for (uint32_t i = 0; i < threads; i++) {
+    readers[i] = (BenchReader){.database = database,
+                               .count = count,
+                               .seed = 0x9e3779b97f4a7c15ULL + i};
+    pthread_create(&thread_ids[i], NULL, bench_read, &readers[i]);
+  }
+  uint64_t rows = 0;
+  for (uint32_t i = 0; i < threads; i++) {
+    pthread_join(thread_ids[i], NULL);
+    rows += readers[i].rows;
+  }
+  double seconds = bench_now() - start;
+  if (writer != NULL) {
+    writer->stop = true;
+    pthread_join(writer_id, NULL);
+  }
+
+  double throughput = (double)threads * (BENCH_LOOKUPS + BENCH_SCANS) / seconds;
+  // The writer needs a core of its own too
+  uint32_t busy = threads + (writer != NULL ? 1 : 0);
+  printf("%8u %8s %14.0f %14.0f %8.2f %12.0f%s\n", threads,
+         writer != NULL ? "yes" : "no", throughput, rows / seconds,
+         base > 0 ? throughput / base : 1.0,
+         writer != NULL ? writer->inserted / seconds : 0.0,
+         busy > cores ? " *" : "");
+  free(readers);
+  free(thread_ids);
+  return throughput;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t count = BENCH_DEFAULT_ROWS;
+  uint32_t cores = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t max_threads = BENCH_DEFAULT_MAX_THREADS;
+  while (max_threads < cores) {
+    max_threads *= 2;
+  }
+  if (argc > 1) {
+    count = (uint32_t)strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    max_threads = (uint32_t)strtoul(argv[2], NULL, 10);
+  }
+  log_set_quiet(true);
+
+  const char *filename = bench_database_file();
+  PagerConfig config = {
+      .cache_pages = BENCH_CACHE_PAGES,
+      .wal = {.max_batch = 1024, .max_delay_ms = 1000},
+  };
+  Database *database = database_open(filename, &config);
+  Row row = {.username = "user", .email = "user@example.com"};
+  for (uint32_t key = 1; key <= count; key++) {
+    row.id = key;
+    Cursor *cursor = cursor_find_key(database, key);
+    btree_node_leaf_insert(cursor, key, &row);
+    cursor_close(cursor);
+    if (key % BENCH_COMMIT_ROWS == 0) {
+      pager_commit(database->pager);
+      pager_unpin_all(database->pager);
+    }
+  }
+  pager_commit(database->pager);
+  pager_unpin_all(database->pager);
+
+  printf("%u rows, %u cores, %u lookups and %u scans of %u rows per thread\n",
+         count, cores, BENCH_LOOKUPS, BENCH_SCANS, BENCH_SCAN_ROWS);
+  if (cores < 2) {
+    printf("warning: a single core is online, no scaling can be measured\n");
+  }
+  printf("%8s %8s %14s %14s %8s %12s\n", "threads", "writer", "operations/s",
+         "scanned/s", "speedup", "inserts/s");
+  BenchWriter writer = {.database = database, .next_key = count + 1};
+  for (int with_writer = 0; with_writer <= 1; with_writer++) {
+    double base = 0;
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+      double throughput = bench_run(database, count, threads, cores,
+                                    with_writer ? &writer : NULL, base);
+      if (threads == 1) {
+        base = throughput;
+      }
+    }
+  }
+  printf("* more threads than cores\n");
+
+  database_close(database);
+  bench_remove_database(filename);
+  return EXIT_SUCCESS;
+}
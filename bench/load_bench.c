@@ -0,0 +1,118 @@
+#include "../include/btree.h"
+#include "../include/cursor.h"
+#include "../include/database.h"
+#include "../include/load.h"
+#include "../include/pager.h"
+#include "../include/row.h"
+#include "../lib/log/log.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// Build a table from rows in random order, once by inserting them one by one
+// and once with the bulk load at several fill factors, and compare the time
+// taken and the size of the resulting files. Usage: load_bench [rows]
+
+enum {
+  BENCH_DEFAULT_ROWS = 1000000,
+  BENCH_CACHE_PAGES = 65536,
+  // Rows inserted per commit, as in btree_bench
+  BENCH_COMMIT_ROWS = 1000
+};
+
+static char bench_rows_filename[] = "/tmp/gnaro_rows_XXXXXX";
+
+// Write the rows to load to a temporary text file
+static void bench_write_rows(const uint32_t *keys, uint32_t count) {
+  int fd = mkstemp(bench_rows_filename);
+  FILE *file = fdopen(fd, "w");
+  for (uint32_t i = 0; i < count; i++) {
+    fprintf(file, "%u user%u user%u@example.com\n", keys[i], keys[i], keys[i]);
+  }
+  fclose(file);
+}
+
+static void bench_report(const char *method, uint32_t count, double seconds,
+                         Database *database, const char *filename) {
+  uint32_t num_pages = database->pager->num_pages;
+  database_close(database);
+  struct stat st;
+  stat(filename, &st);
+  printf("%16s %12.0f %10u %12.1f\n", method, count / seconds, num_pages,
+         (double)st.st_size / (1024 * 1024));
+  bench_remove_database(filename);
+}
+
+static void bench_inserts(const uint32_t *keys, uint32_t count) {
+  const char *filename = bench_database_file();
+  PagerConfig config = {
+      .cache_pages = BENCH_CACHE_PAGES,
+      .wal = {.max_batch = 1024, .max_delay_ms = 1000},
+  };
+  Database *database = database_open(filename, &config);
+
+  Row row = {0};
+  double start = bench_now();
+  for (uint32_t i = 0; i < count; i++) {
+    row.id = keys[i];
+    snprintf(row.username, sizeof(row.username), "user%u", keys[i]);
+    snprintf(row.email, sizeof(row.email), "user%u@example.com", keys[i]);
+    Cursor *cursor = cursor_find_key(database, keys[i]);
+    btree_node_leaf_insert(cursor, keys[i], &row);
+    cursor_close(cursor);
+    if ((i + 1) % BENCH_COMMIT_ROWS == 0) {
+      pager_commit(database->pager);
+      pager_unpin_all(database->pager);
+    }
+  }
+  pager_commit(database->pager);
+  pager_unpin_all(database->pager);
+  bench_report("inserts", count, bench_now() - start, database, filename);
+}
+
+static void bench_load(uint32_t count, uint32_t fill_factor) {
+  const char *filename = bench_database_file();
+  PagerConfig config = {
+      .cache_pages = BENCH_CACHE_PAGES,
+      .wal = {.max_batch = 1024, .max_delay_ms = 1000},
+  };
+  Database *database = database_open(filename, &config);
+
+  LoadConfig load_config = {.fill_factor = fill_factor};
+  LoadStats stats;
+  double start = bench_now();
+  if (load_file(database, bench_rows_filename, &load_config, &stats) !=
+      LOAD_SUCCESS) {
+    fprintf(stderr, "failed to load %s\n", bench_rows_filename);
+    exit(EXIT_FAILURE);
+  }
+  double seconds = bench_now() - start;
+  char method[32];
+  snprintf(method, sizeof(method), "load %u%%", fill_factor);
+  bench_report(method, count, seconds, database, filename);
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t count = BENCH_DEFAULT_ROWS;
+  if (argc > 1) {
+    count = (uint32_t)strtoul(argv[1], NULL, 10);
+  }
+  log_set_quiet(true);
+
+  uint32_t *keys = malloc(count * sizeof(uint32_t));
+  bench_shuffled_keys(keys, count);
+  bench_write_rows(keys, count);
+
+  printf("%u rows in random order\n", count);
+  printf("%16s %12s %10s %12s\n", "method", "rows/s", "pages", "file MB");
+  bench_inserts(keys, count);
+  bench_load(count, LOAD_MIN_FILL_FACTOR);
+  bench_load(count, LOAD_DEFAULT_FILL_FACTOR);
+  bench_load(count, LOAD_MAX_FILL_FACTOR);
+
+  unlink(bench_rows_filename);
+  free(keys);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include "../include/btree.h"
+#include "../include/cursor.h"
+#include "../include/database.h"
+#include "../include/pager.h"
+#include "../include/row.h"
+#include "../lib/log/log.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// Compare insert and scan throughput of databases created with every
+// supported page size. Usage: page_size_bench [rows]
+
+enum { BENCH_DEFAULT_ROWS = 100000, BENCH_CACHE_BYTES = 64 * 1024 * 1024 };
+
+// Insert the given keys, one commit per row like the REPL does
+static void bench_insert(Database *database, const uint32_t *keys,
+                         uint32_t count) {
+  Row row = {.username = "user", .email = "user@example.com"};
+  for (uint32_t i = 0; i < count; i++) {
+    row.id = keys[i];
+    Cursor *cursor = cursor_find_key(database, keys[i]);
+    btree_node_leaf_insert(cursor, keys[i], &row);
+    cursor_close(cursor);
+    pager_commit(database->pager);
+    pager_unpin_all(database->pager);
+  }
+}
+
+// Read every row in key order and return the number of leaves visited
+static uint32_t bench_scan(Database *database, uint32_t count) {
+  Row row;
+  uint32_t rows = 0;
+  uint32_t leaves = 0;
+  uint32_t page_num = UINT32_MAX;
+  Cursor *cursor = cursor_start(database);
+  while (!cursor->end_of_table) {
+    if (cursor->page_num != page_num) {
+      page_num = cursor->page_num;
+      leaves++;
+    }
+    cursor_row(cursor, &row);
+    rows++;
+    cursor_advance(cursor);
+    pager_unpin_all(database->pager);
+  }
+  cursor_close(cursor);
+  if (rows != count) {
+    fprintf(stderr, "scan returned %u rows instead of %u\n", rows, count);
+    exit(EXIT_FAILURE);
+  }
+  return leaves;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t count = BENCH_DEFAULT_ROWS;
+  if (argc > 1) {
+    count = (uint32_t)strtoul(argv[1], NULL, 10);
+  }
+  log_set_quiet(true);
+
+  uint32_t *keys = malloc(count * sizeof(uint32_t));
+  bench_shuffled_keys(keys, count);
+
+  printf("%u rows inserted in random order\n", count);
+  printf("%10s %14s %14s %10s %12s\n", "page size", "inserts/s", "scan rows/s",
+         "leaves", "file size");
+  for (uint32_t page_size = PAGER_MIN_PAGE_SIZE;
+       page_size <= PAGER_MAX_PAGE_SIZE; page_size *= 2) {
+    const char *filename = bench_database_file();
+    PagerConfig config = {
+        .cache_pages = BENCH_CACHE_BYTES / page_size,
+        .page_size = page_size,
+        .wal = {.max_batch = 1024, .max_delay_ms = 1000},
+    };
+
+    Database *database = database_open(filename, &config);
+    double start = bench_now();
+    bench_insert(database, keys, count);
+    double insert_seconds = bench_now() - start;
+    database_close(database);
+
+    database = database_open(filename, &config);
+    start = bench_now();
+    uint32_t leaves = bench_scan(database, count);
+    double scan_seconds = bench_now() - start;
+    database_close(database);
+
+    struct stat file_stat;
+    stat(filename, &file_stat);
+    printf("%10u %14.0f %14.0f %10u %12lld\n", page_size,
+           count / insert_seconds, count / scan_seconds, leaves,
+           (long long)file_stat.st_size);
+    bench_remove_database(filename);
+  }
+
+  free(keys);
+  return EXIT_SUCCESS;
+}
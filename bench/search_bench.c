@@ -0,0 +1,99 @@
+#include "../include/btree.h"
+#include "../include/row.h"
+#include "../include/search.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Compare the lookups per second of the binary search and of
+// search_lower_bound() inside nodes of every size, for keys in internal node
+// cells (pairs), in leaf slots, and in leaf cells holding their row of fixed
+// size as leaves did before they had slots. Usage: search_bench [lookups]
+
+enum { BENCH_DEFAULT_LOOKUPS = 20000000, BENCH_NODES = 64 };
+
+// Sizes of leaves and of internal nodes in pages of 4 to 64 kilobytes
+static const uint32_t BENCH_NODE_SIZES[] = {4,   13,   27,   54,   108,  217,
+                                            509, 1021, 2045, 4093, 8189};
+
+// Size of a leaf cell holding its key next to a row with fixed-size columns
+static const size_t BENCH_ROW_CELL_SIZE = sizeof(uint32_t) + 4 + 33 + 256;
+
+// Fill BENCH_NODES nodes of count sorted keys spaced stride bytes apart, so
+// that lookups do not always hit the same cache lines
+static uint8_t *bench_nodes(uint32_t count, size_t stride) {
+  uint8_t *nodes = calloc((size_t)BENCH_NODES * count, stride);
+  for (uint32_t node = 0; node < BENCH_NODES; node++) {
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t key = (i + 1) * 16;
+      memcpy(nodes + ((size_t)node * count + i) * stride, &key, sizeof(key));
+    }
+  }
+  return nodes;
+}
+
+static double bench_lookups(uint32_t (*search)(const void *, uint32_t, size_t,
+                                               uint32_t),
+                            const uint8_t *nodes, uint32_t count, size_t stride,
+                            const uint32_t *keys, uint32_t lookups) {
+  uint64_t sum = 0;
+  double start = bench_now();
+  for (uint32_t i = 0; i < lookups; i++) {
+    const uint8_t *node = nodes + (size_t)(i % BENCH_NODES) * count * stride;
+    sum += search(node, count, stride, keys[i] % (count * 16 + 16));
+  }
+  double seconds = bench_now() - start;
+  // Keep the loop from being optimized away
+  if (sum == 1) {
+    printf("!");
+  }
+  return lookups / seconds;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t lookups = BENCH_DEFAULT_LOOKUPS;
+  if (argc > 1) {
+    lookups = (uint32_t)strtoul(argv[1], NULL, 10);
+  }
+
+  uint32_t *keys = malloc(lookups * sizeof(uint32_t));
+  bench_shuffled_keys(keys, lookups);
+
+  printf("Lookups per second (millions), search with %s\n",
+         search_implementation());
+  printf("%6s %16s %16s %16s %16s\n", "keys", "internal bsearch",
+         "internal search", "row cells search", "slots search");
+  uint32_t leaf_space = btree_layout(PAGER_MAX_PAGE_SIZE).leaf_space_for_cells;
+  size_t sizes = sizeof(BENCH_NODE_SIZES) / sizeof(BENCH_NODE_SIZES[0]);
+  for (size_t i = 0; i < sizes; i++) {
+    uint32_t count = BENCH_NODE_SIZES[i];
+    uint8_t *pairs = bench_nodes(count, BTREE_NODE_INTERNAL_CELL_SIZE);
+    printf("%6u %16.1f %16.1f", count,
+           bench_lookups(search_lower_bound_scalar, pairs, count,
+                         BTREE_NODE_INTERNAL_CELL_SIZE, keys, lookups) /
+               1e6,
+           bench_lookups(search_lower_bound, pairs, count,
+                         BTREE_NODE_INTERNAL_CELL_SIZE, keys, lookups) /
+               1e6);
+    free(pairs);
+    // Leaves of fixed-size rows held a few hundred rows at most
+    if (count * BENCH_ROW_CELL_SIZE > leaf_space) {
+      printf(" %16s", "-");
+    } else {
+      uint8_t *cells = bench_nodes(count, BENCH_ROW_CELL_SIZE);
+      printf(" %16.1f", bench_lookups(search_lower_bound, cells, count,
+                                      BENCH_ROW_CELL_SIZE, keys, lookups) /
+                            1e6);
+      free(cells);
+    }
+    uint8_t *slots = bench_nodes(count, BTREE_NODE_LEAF_SLOT_SIZE);
+    printf(" %16.1f\n", bench_lookups(search_lower_bound, slots, count,
+                                      BTREE_NODE_LEAF_SLOT_SIZE, keys, lookups) /
+                            1e6);
+    free(slots);
+  }
+
+  free(keys);
+  return EXIT_SUCCESS;
+}
@@ -14,8 +14,9 @@ typedef enum { BTREE_NODE_TYPE_INTERNAL, BTREE_NODE_TYPE_LEAF } NodeType;
 
 // Common Node Header Layout
 // Nodes need to store metadata in a header at the beginning of the page, e.g.
-// the type of node, whether or not it is the root node, and a pointer to its
-// parent (to allow finding a node’s siblings)
+// the type of node and whether or not it is the root node. The parent pointer
+// is no longer maintained, cursors record the path from the root instead, and
+// its bytes are kept so that the layout of existing files does not change.
 static const uint32_t BTREE_NODE_TYPE_SIZE = sizeof(uint8_t);
 static const uint32_t BTREE_NODE_TYPE_OFFSET = 0;
 static const uint32_t BTREE_NODE_IS_ROOT_SIZE = sizeof(uint8_t);
@@ -28,17 +29,24 @@ static const uint8_t BTREE_NODE_COMMON_HEADER_SIZE =
     BTREE_NODE_PARENT_POINTER_SIZE;
 
 // Leaf Node Header Layout
-// A cell is a key-value pair, where the value is a serialized row. The body of
-// a leaf node consists of a number of cells.
+// A cell is a key-value pair, where the value is a serialized row. Leaves are
+// slotted pages: an array of slots sorted by key follows the header, and the
+// values they point to are stored from the end of the page towards the slots.
+// Searches only read the slots and inserts only shift slots.
 static const uint32_t BTREE_NODE_LEAF_NUM_CELLS_SIZE = sizeof(uint32_t);
 static const uint32_t BTREE_NODE_LEAF_NUM_CELLS_OFFSET =
     BTREE_NODE_COMMON_HEADER_SIZE;
 static const uint32_t BTREE_NODE_LEAF_NEXT_LEAF_SIZE = sizeof(uint32_t);
 static const uint32_t BTREE_NODE_LEAF_NEXT_LEAF_OFFSET =
     BTREE_NODE_LEAF_NUM_CELLS_OFFSET + BTREE_NODE_LEAF_NUM_CELLS_SIZE;
+// Offset of the first byte of the values, the end of the page when the leaf is
+// empty
+static const uint32_t BTREE_NODE_LEAF_VALUES_START_SIZE = sizeof(uint32_t);
+static const uint32_t BTREE_NODE_LEAF_VALUES_START_OFFSET =
+    BTREE_NODE_LEAF_NEXT_LEAF_OFFSET + BTREE_NODE_LEAF_NEXT_LEAF_SIZE;
 static const uint32_t BTREE_NODE_LEAF_HEADER_SIZE =
     BTREE_NODE_COMMON_HEADER_SIZE + BTREE_NODE_LEAF_NUM_CELLS_SIZE +
-    BTREE_NODE_LEAF_NEXT_LEAF_SIZE;
+    BTREE_NODE_LEAF_NEXT_LEAF_SIZE + BTREE_NODE_LEAF_VALUES_START_SIZE;
 
 // Internal Node Header Layout
 static const uint32_t BTREE_NODE_INTERNAL_NUM_KEYS_SIZE = sizeof(uint32_t);
@@ -52,38 +60,84 @@ static const uint32_t BTREE_NODE_INTERNAL_HEADER_SIZE =
     BTREE_NODE_INTERNAL_RIGHT_CHILD_SIZE;
 
 // Leaf Node Body Layout
+// A slot holds the key of a cell, and the offset and size of its value
 static const uint32_t BTREE_NODE_LEAF_KEY_SIZE = sizeof(uint32_t);
 static const uint32_t BTREE_NODE_LEAF_KEY_OFFSET = 0;
-static const uint32_t BTREE_NODE_LEAF_VALUE_SIZE = ROW_SIZE;
-static const uint32_t BTREE_NODE_LEAF_VALUE_OFFSET =
+static const uint32_t BTREE_NODE_LEAF_VALUE_OFFSET_SIZE = sizeof(uint16_t);
+static const uint32_t BTREE_NODE_LEAF_VALUE_OFFSET_OFFSET =
     BTREE_NODE_LEAF_KEY_OFFSET + BTREE_NODE_LEAF_KEY_SIZE;
-static const uint32_t BTREE_NODE_LEAF_CELL_SIZE =
-    BTREE_NODE_LEAF_KEY_SIZE + BTREE_NODE_LEAF_VALUE_SIZE;
-static const uint32_t BTREE_NODE_LEAF_SPACE_FOR_CELLS =
-    PAGER_PAGE_SIZE - BTREE_NODE_LEAF_HEADER_SIZE;
-static const uint32_t BTREE_NODE_LEAF_MAX_CELLS =
-    BTREE_NODE_LEAF_SPACE_FOR_CELLS / BTREE_NODE_LEAF_CELL_SIZE;
+static const uint32_t BTREE_NODE_LEAF_VALUE_SIZE_SIZE = sizeof(uint16_t);
+static const uint32_t BTREE_NODE_LEAF_VALUE_SIZE_OFFSET =
+    BTREE_NODE_LEAF_VALUE_OFFSET_OFFSET + BTREE_NODE_LEAF_VALUE_OFFSET_SIZE;
+static const uint32_t BTREE_NODE_LEAF_SLOT_SIZE =
+    BTREE_NODE_LEAF_KEY_SIZE + BTREE_NODE_LEAF_VALUE_OFFSET_SIZE +
+    BTREE_NODE_LEAF_VALUE_SIZE_SIZE;
+// Set in the size of a slot whose value continues in overflow pages
+static const uint16_t BTREE_NODE_LEAF_VALUE_OVERFLOW = 0x8000;
+
+// Leaf Overflow Value Layout
+// Rows too large for a leaf keep a prefix in the leaf, which holds their id,
+// their username and the start of their email, followed by the size of the
+// row and the first of the overflow pages holding the rest of it
+static const uint32_t BTREE_NODE_LEAF_OVERFLOW_PREFIX_SIZE = 64;
+static const uint32_t BTREE_NODE_LEAF_OVERFLOW_ROW_SIZE_SIZE = sizeof(uint32_t);
+static const uint32_t BTREE_NODE_LEAF_OVERFLOW_ROW_SIZE_OFFSET =
+    BTREE_NODE_LEAF_OVERFLOW_PREFIX_SIZE;
+static const uint32_t BTREE_NODE_LEAF_OVERFLOW_PAGE_SIZE = sizeof(uint32_t);
+static const uint32_t BTREE_NODE_LEAF_OVERFLOW_PAGE_OFFSET =
+    BTREE_NODE_LEAF_OVERFLOW_ROW_SIZE_OFFSET +
+    BTREE_NODE_LEAF_OVERFLOW_ROW_SIZE_SIZE;
+static const uint32_t BTREE_NODE_LEAF_OVERFLOW_VALUE_SIZE =
+    BTREE_NODE_LEAF_OVERFLOW_PAGE_OFFSET + BTREE_NODE_LEAF_OVERFLOW_PAGE_SIZE;
+
+// Overflow Page Layout
+// Overflow pages start with a type that is not a node type, so that they are
+// never mistaken for nodes, and the next page of the chain, 0 for the last one
+static const uint8_t BTREE_OVERFLOW_PAGE_TYPE = 2;
+static const uint32_t BTREE_OVERFLOW_NEXT_SIZE = sizeof(uint32_t);
+static const uint32_t BTREE_OVERFLOW_NEXT_OFFSET = BTREE_NODE_COMMON_HEADER_SIZE;
+static const uint32_t BTREE_OVERFLOW_HEADER_SIZE =
+    BTREE_OVERFLOW_NEXT_OFFSET + BTREE_OVERFLOW_NEXT_SIZE;
 
 // Internal Node Body Layout
-// Each internal node can store 510 keys and 511 children
+// Internal nodes hold as many cells as fit in the page, e.g. 509 keys and 510
+// children in a 4 kilobyte page with a checksum trailer
 static const uint32_t BTREE_NODE_INTERNAL_KEY_SIZE = sizeof(uint32_t);
 static const uint32_t BTREE_NODE_INTERNAL_CHILD_SIZE = sizeof(uint32_t);
 static const uint32_t BTREE_NODE_INTERNAL_CELL_SIZE =
     BTREE_NODE_INTERNAL_CHILD_SIZE + BTREE_NODE_INTERNAL_KEY_SIZE;
-static const uint32_t BTREE_NODE_INTERNAL_MAX_CELLS = 3;
-
-// Leaf Node Split Configuration
-static const uint32_t BTREE_NODE_LEAF_RIGHT_SPLIT_COUNT =
-    (BTREE_NODE_LEAF_MAX_CELLS + 1) / 2;
-static const uint32_t BTREE_NODE_LEAF_LEFT_SPLIT_COUNT =
-    (BTREE_NODE_LEAF_MAX_CELLS + 1) - BTREE_NODE_LEAF_RIGHT_SPLIT_COUNT;
 
 // Internal Node Split Configuration
 static const uint32_t BTREE_NODE_INTERNAL_INVALID_PAGE_NUM = UINT32_MAX;
 
+// BtreeLayout holds the parts of the node layout that depend on the page size
+// of the database, which is only known at runtime
+typedef struct {
+  // Bytes shared by the slots and the values of a leaf
+  uint32_t leaf_space_for_cells;
+  // Largest value stored in a leaf, larger rows go to overflow pages so that
+  // a leaf always holds at least four cells
+  uint32_t leaf_max_value;
+  // Bytes of a row held by each overflow page
+  uint32_t overflow_space;
+  // Keys of a full internal node, which has one more child
+  uint32_t internal_max_keys;
+  // Nodes using less than a third of their space after a delete are merged
+  // with a sibling or take cells from it
+  uint32_t leaf_min_used;
+  uint32_t internal_min_keys;
+} BtreeLayout;
+
+// Compute the node layout for pages with the given usable size, the size of
+// a page without its trailer
+BtreeLayout btree_layout(uint32_t usable_size);
+
 // Get the type of a node
 NodeType btree_node_get_type(void *node);
 
+// Get the type of a node read without its latch
+NodeType btree_node_peek_type(void *node);
+
 // Set the type of a node
 void btree_node_set_type(void *node, NodeType type);
 
@@ -99,39 +153,82 @@ bool btree_node_is_root(void *node);
 // Set whether or not a node is the root node
 void btree_node_set_root(void *node, bool is_root);
 
-// Get a pointer to the parent of a node
-uint32_t *btree_node_parent(void *node);
-
 // Printthe btree to stdout
 void btree_print(Pager *pager, uint32_t page_num, uint32_t indent_level);
 
-// Initialize a leaf node
-void btree_node_leaf_init(void *node);
+// Initialize a leaf node in a page with the given usable size
+void btree_node_leaf_init(void *node, uint32_t usable_size);
 
 // Get a pointer to the key of a cell in a leaf node
 uint32_t *btree_node_leaf_key(void *node, uint32_t cell_num);
 
-// Get a pointer to a cell in a leaf node
-void *btree_node_leaf_cell(void *node, uint32_t cell_num);
+// Get a pointer to the slot of a cell in a leaf node
+void *btree_node_leaf_slot(void *node, uint32_t cell_num);
 
 // Get the number of cells in a leaf node
 uint32_t *btree_node_leaf_num_cells(void *node);
 
+// Get a pointer to the offset of the first value in a leaf node
+uint32_t *btree_node_leaf_values_start(void *node);
+
 // Get a pointer to the value of a cell in a leaf node
 void *btree_node_leaf_value(void *node, uint32_t cell_num);
 
+// Get the size of the value of a cell in a leaf node
+uint32_t btree_node_leaf_value_size(void *node, uint32_t cell_num);
+
+// Get whether the value of a cell in a leaf node continues in overflow pages
+bool btree_node_leaf_value_overflows(void *node, uint32_t cell_num);
+
+// Deserialize the row of a cell in a leaf node, reading its overflow pages if
+// it has some
+void btree_node_leaf_row(Pager *pager, void *node, uint32_t cell_num, Row *row);
+
+// Turn a serialized row into the value of a leaf cell, moving its end to
+// overflow pages if it is too large. Returns the size of the value with the
+// overflow flag, as passed to btree_node_leaf_insert_cell().
+uint32_t btree_node_leaf_spill(Pager *pager, uint8_t *value,
+                               uint32_t row_size);
+
+// Release the overflow pages of a cell in a leaf node, if it has some
+void btree_node_leaf_free_overflow(Pager *pager, void *node,
+                                   uint32_t cell_num);
+
+// Get the number of bytes left between the slots and the values of a leaf
+uint32_t btree_node_leaf_free_space(void *node);
+
+// Get the number of bytes used by the slots and the values of a leaf
+uint32_t btree_node_leaf_used_space(Pager *pager, void *node);
+
+// Insert a cell at the given position of a leaf node with enough free space.
+// The size has BTREE_NODE_LEAF_VALUE_OVERFLOW set for a value that continues
+// in overflow pages.
+void btree_node_leaf_insert_cell(void *node, uint32_t cell_num, uint32_t key,
+                                 const void *value, uint32_t size);
+
+// Remove a cell from a leaf node. The values stored below its value are moved
+// up, so that the free space stays in one block.
+void btree_node_leaf_remove_cell(void *node, uint32_t cell_num);
+
 // Get the page number of the next leaf node
 uint32_t *btree_node_leaf_next(void *node);
 
-// Get a cursor to a leaf node containing the given key
-Cursor *btree_node_leaf_find(Database *database, uint32_t key,
-                             uint32_t page_num);
+// Collect the page numbers of up to max leaves that follow the leaf of a cursor
+// under the same parent, returns how many were found
+uint32_t btree_node_leaf_next_siblings(Cursor *cursor, uint32_t *page_nums,
+                                       uint32_t max);
+
+// Get whether a node can take one more cell, or one more key for an internal
+// node, without being split
+bool btree_node_has_room(void *node, const BtreeLayout *layout);
 
 // Insert a row into a leaf node
 void btree_node_leaf_insert(Cursor *cursor, uint32_t key, Row *value);
 
-// Split a leaf node and inserts a new row
-void btree_node_leaf_split_and_insert(Cursor *cursor, uint32_t key, Row *value);
+// Split a leaf node and inserts a new cell, whose size is given as for
+// btree_node_leaf_insert_cell()
+void btree_node_leaf_split_and_insert(Cursor *cursor, uint32_t key,
+                                      const void *value, uint32_t size);
 
 // Initialize an internal node
 void btree_node_internal_init(void *node);
@@ -151,24 +248,54 @@ uint32_t *btree_node_internal_child(void *node, uint32_t child_num);
 // Get a pointer to the right child of an
 uint32_t *btree_node_internal_right_child(void *node);
 
-// Get a cursor to an internal node containing the given key
-Cursor *btree_node_internal_find(Database *database, uint32_t key,
-                                 uint32_t page_num);
-
 // Get the index of a child in an internal node
 uint32_t btree_node_internal_find_child(void *node, uint32_t key);
 
-// Get a child into an internal node
-void btree_node_internal_insert(Database *database, uint32_t parent_page_num,
+// Get the number of keys of an internal node read without its latch, which
+// another thread may be modifying. It is never more than the node can hold,
+// whatever the page contains.
+uint32_t btree_node_internal_peek_num_keys(void *node,
+                                           const BtreeLayout *layout);
+
+// Get the page number of a child of an internal node read without its latch,
+// the right child when child_num is num_keys, for num_keys returned by
+// btree_node_internal_peek_num_keys(). Nothing is checked: the page number is
+// only valid if the node turns out to be unchanged.
+uint32_t btree_node_internal_peek_child(void *node, uint32_t num_keys,
+                                        uint32_t child_num);
+
+// Get the index of the child to follow for a key in an internal node read
+// without its latch, for num_keys returned by
+// btree_node_internal_peek_num_keys()
+uint32_t btree_node_internal_peek_find_child(void *node, uint32_t num_keys,
+                                             uint32_t key);
+
+// Insert a child into the internal node at the given depth of the path of a
+// cursor, the nodes above it in the path are split too when they are full.
+// The path of the cursor is no longer valid after a split.
+void btree_node_internal_insert(Cursor *cursor, uint32_t depth,
                                 uint32_t child_page_num);
 
-// Split an internal node and inserts a new child
-void btree_node_internal_split_and_insert(Database *database,
-                                          uint32_t parent_page_num,
+// Split the internal node at the given depth of the path of a cursor and
+// insert a new child
+void btree_node_internal_split_and_insert(Cursor *cursor, uint32_t depth,
                                           uint32_t child_page_num);
 
 // Get the key of a child in an internal node
 void btree_node_internal_update_key(void *node, uint32_t old_key,
                                     uint32_t new_key);
 
+// Remove a child and its key from an internal node
+void btree_node_internal_remove_child(void *node, uint32_t child_num);
+
+// Merge the underfull node at the given depth of the path of a cursor, its leaf
+// at the depth of the cursor, with a sibling, or move cells from the sibling
+// into it, then do the same for its parent if it loses a child. A root left
+// with a single child is replaced by that child.
+void btree_node_rebalance(Cursor *cursor, uint32_t depth);
+
+// Delete the rows with keys from min_key to max_key, freeing their overflow
+// pages and the nodes emptied by merges. Returns the number of rows deleted.
+uint32_t btree_delete(Database *database, uint32_t min_key, uint32_t max_key);
+
 #endif
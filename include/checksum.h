@@ -0,0 +1,22 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32C (Castagnoli) checksums used to detect torn and corrupted pages. The
+// CRC instructions of the CPU are used when it has them (SSE 4.2 on x86-64,
+// the CRC extension on ARMv8) and a table-driven implementation otherwise.
+// Both compute the same value, so files can move between machines.
+
+// Extend a CRC32C over size bytes, crc is 0 for the first buffer and the
+// result for the previous one when a checksum covers several buffers
+uint32_t checksum_crc32c(uint32_t crc, const void *data, size_t size);
+
+// Same as checksum_crc32c() but never uses the CRC instructions
+uint32_t checksum_crc32c_portable(uint32_t crc, const void *data, size_t size);
+
+// Get the name of the implementation used by checksum_crc32c()
+const char *checksum_crc32c_implementation(void);
+
+#endif
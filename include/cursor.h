@@ -2,33 +2,82 @@
 #define CURSOR_H
 
 #include "database.h"
+#include "row.h"
 #include <stdbool.h>
 #include <stdint.h>
 
-// Cursor represents a position in a database
+enum {
+  // CURSOR_MAX_DEPTH is the largest number of internal nodes above a leaf,
+  // more than a tree of 2^32 keys needs, a deeper tree is corrupt
+  CURSOR_MAX_DEPTH = 16
+};
+
+// Cursor represents a position in a database. A cursor holds the latch of its
+// leaf until it moves to another leaf or is closed: in shared mode for a scan,
+// in exclusive mode for an insert, which also holds the latches of the nodes
+// above the leaf that a split would modify.
 typedef struct {
   Database *database;
   uint32_t page_num;
   uint32_t cell_num;
+  // Page of the leaf, valid while the cursor holds its latch
+  void *node;
+  PagerLatchMode latch_mode;
   // Indicates a position past the end of the database where a new row would be
-  // inserted
+  // inserted, or that a scan has moved past its last row in either direction
   bool end_of_table;
+  // A scan ends at the first row with a key outside of these bounds
+  uint32_t start_key;
+  uint32_t end_key;
+  // Internal nodes from the root down to the parent of the leaf, and the child
+  // followed in each of them. Splits and merges go up the path and moving to
+  // a sibling leaf updates it. Other threads can change the nodes of a shared
+  // cursor, its path is only a hint for reading ahead.
+  uint32_t depth;
+  uint32_t path[CURSOR_MAX_DEPTH];
+  uint32_t path_child_nums[CURSOR_MAX_DEPTH];
+  // Nodes of the path from this depth down to the leaf are latched by the
+  // cursor, none when it is the depth of the leaf
+  uint32_t latched_depth;
 } Cursor;
 
 // Create a cursor at the beginning of the database
 Cursor *cursor_start(Database *database);
 
 // Find the position of the given key or where it should be inserted if it is
-// not present
+// not present. The cursor latches its leaf exclusively, only one thread at a
+// time modifies the database.
 Cursor *cursor_find_key(Database *database, uint32_t key);
 
+// Create a cursor at the first row whose key is not less than the given key,
+// at the end of the database if there is none
+Cursor *cursor_seek(Database *database, uint32_t key);
+
+// Create a cursor at the last row whose key is not greater than the given key,
+// at the end of the database if there is none
+Cursor *cursor_seek_last(Database *database, uint32_t key);
+
+// Limit a scan to the rows with keys from start_key to end_key, the cursor is
+// at the end of the database if its row is outside of them
+void cursor_set_bounds(Cursor *cursor, uint32_t start_key, uint32_t end_key);
+
 // Move a cursor to the next row
 void cursor_advance(Cursor *cursor);
 
+// Move a cursor to the previous row
+void cursor_retreat(Cursor *cursor);
+
 // Handle memory I/O for a particular row.
 void *cursor_value(Cursor *cursor);
 
-// Free a cursor
+// Get the key of the row at the cursor
+uint32_t cursor_key(Cursor *cursor);
+
+// Deserialize the row at the cursor, including the part of a large row that is
+// stored in overflow pages
+void cursor_row(Cursor *cursor, Row *row);
+
+// Release the latches held by a cursor and free it
 void cursor_close(Cursor *cursor);
 
 #endif
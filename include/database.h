@@ -2,6 +2,7 @@
 #define DATABASE_H
 
 #include "pager.h"
+#include <pthread.h>
 #include <stdint.h>
 
 // DatabaseResult is an enum that represents the result of a database operation.
@@ -18,16 +19,42 @@ typedef enum {
 // - Each page stores as many rows as it can fit
 // - Rows are serialized into a compact representation with each page
 // - Pages are only allocated as needed
-// - Keep a fixed-size array of pointers to pages
+// - Keep a bounded buffer pool of recently used pages
 typedef struct {
   Pager *pager;
   uint32_t root_page_num;
+  // Rightmost leaf, where rows with increasing ids are appended without
+  // searching from the root, 0 until a search has reached it
+  uint32_t rightmost_leaf_page_num;
+  // Held shared by statements that latch the pages they use, and exclusively
+  // by those that modify pages without latching them
+  pthread_rwlock_t tree_latch;
+  // Held by the statement that modifies the database, one at a time
+  pthread_mutex_t writer_latch;
 } Database;
 
+// DatabaseLatchMode is the access a statement needs to the database. Any
+// number of statements read while one inserts rows: the insert latches the
+// pages it modifies, so readers only wait for those. Deletes and loads move
+// rows between nodes without latching them, and have the database to
+// themselves. In memory-mapped mode every statement has the database to
+// itself.
+typedef enum {
+  DATABASE_LATCH_READ,
+  DATABASE_LATCH_WRITE,
+  DATABASE_LATCH_EXCLUSIVE
+} DatabaseLatchMode;
+
 // Opens a connection to a database.
-Database *database_open(const char *filename);
+Database *database_open(const char *filename, const PagerConfig *config);
 
 // Closes a connection to a database.
 DatabaseResult database_close(Database *database);
 
+// Wait until the database can be accessed in the given mode
+void database_latch(Database *database, DatabaseLatchMode mode);
+
+// Release the access taken by database_latch() in the same mode
+void database_unlatch(Database *database, DatabaseLatchMode mode);
+
 #endif
@@ -1,6 +1,7 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
@@ -20,6 +21,9 @@ void input_prompt(char *text);
 // Read a line of input
 int input_read(InputBuffer *input_buffer);
 
+// Check whether more input can be read without blocking
+bool input_pending(void);
+
 // Close and free an InputBuffer
 void input_close_buffer(InputBuffer *input_buffer);
 
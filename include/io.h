@@ -0,0 +1,82 @@
+#ifndef IO_H
+#define IO_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Positional I/O layer used for every page read and write. Offsets are passed
+// explicitly instead of moving the file offset with lseek(), so each transfer
+// is a single system call and the same file descriptor can be shared by
+// concurrent readers. Short transfers and interruptions by signals are retried
+// until the whole buffer has been transferred.
+
+// Read size bytes at offset, returns the number of bytes read which is only
+// less than size at the end of the file, or -1 on error
+ssize_t io_read_at(int fd, void *buffer, size_t size, off_t offset);
+
+// Write size bytes at offset, returns size or -1 on error
+ssize_t io_write_at(int fd, const void *buffer, size_t size, off_t offset);
+
+// Write a vector of buffers at offset, returns the total size or -1 on error.
+// The vector is modified when a write is short.
+ssize_t io_writev_at(int fd, struct iovec *iov, int iovcnt, off_t offset);
+
+// Read a vector of buffers at offset, returns the number of bytes read which
+// is only less than the total size at the end of the file, or -1 on error.
+// The vector is modified when a read is short.
+ssize_t io_readv_at(int fd, struct iovec *iov, int iovcnt, off_t offset);
+
+// IoRequest is one transfer of a batch: a vector of buffers at an offset
+typedef struct {
+  struct iovec *iov;
+  int iovcnt;
+  off_t offset;
+} IoRequest;
+
+// IoRing is an io_uring instance used to keep many transfers in flight with a
+// single system call. The queues are shared with the kernel through memory
+// mappings, the pointers below point into them.
+typedef struct {
+  int ring_fd;
+  uint32_t entries;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  void *sqes;
+  size_t sqes_size;
+  uint32_t *sq_head;
+  uint32_t *sq_tail;
+  uint32_t *sq_mask;
+  uint32_t *sq_array;
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  uint32_t *cq_mask;
+  void *cqes;
+  // Batches of different threads take turns on the ring
+  pthread_mutex_t mutex;
+} IoRing;
+
+// Set up a ring with room for the given number of transfers in flight.
+// Returns NULL if io_uring is not available, in which case batches are
+// transferred synchronously.
+IoRing *io_ring_open(uint32_t entries);
+
+// Tear down a ring
+void io_ring_close(IoRing *ring);
+
+// Read a batch of requests, through the ring if there is one and one request
+// after the other otherwise. Returns the total number of bytes read or -1 on
+// error. The vectors of the requests are modified when a read is short.
+ssize_t io_readv_batch(IoRing *ring, int fd, IoRequest *requests,
+                       uint32_t count);
+
+// Write a batch of requests like io_readv_batch()
+ssize_t io_writev_batch(IoRing *ring, int fd, IoRequest *requests,
+                        uint32_t count);
+
+#endif
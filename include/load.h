@@ -0,0 +1,74 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+#include "database.h"
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  // LOAD_DEFAULT_FILL_FACTOR is the percentage of every node filled by a bulk
+  // load, leaving room for later inserts before the first splits
+  LOAD_DEFAULT_FILL_FACTOR = 90,
+  LOAD_MIN_FILL_FACTOR = 50,
+  LOAD_MAX_FILL_FACTOR = 100,
+  // LOAD_DEFAULT_RUN_SIZE is the memory used to sort rows (64 megabytes),
+  // larger inputs are sorted in runs written to temporary files and merged
+  LOAD_DEFAULT_RUN_SIZE = 64 * 1024 * 1024,
+  // LOAD_WRITE_PAGES is the number of pages built between two writes to the
+  // file, after which the buffer pool can evict them
+  LOAD_WRITE_PAGES = 256,
+  // LOAD_MAX_HEIGHT is the largest number of internal levels built, enough
+  // for every key with half full nodes
+  LOAD_MAX_HEIGHT = 8
+};
+
+// LoadResult is an enum that represents the result of a bulk load.
+typedef enum {
+  LOAD_SUCCESS,
+  LOAD_OPEN_FAIL,
+  LOAD_SYNTAX_ERROR,
+  LOAD_NEGATIVE_ID,
+  LOAD_STRING_TOO_LONG,
+  LOAD_DUPLICATE_KEY,
+  LOAD_NOT_EMPTY,
+} LoadResult;
+
+// LoadConfig holds the tunables of a bulk load
+typedef struct {
+  // Percentage of the space of every node filled, 0 for
+  // LOAD_DEFAULT_FILL_FACTOR
+  uint32_t fill_factor;
+  // Bytes of rows sorted in memory at once, 0 for LOAD_DEFAULT_RUN_SIZE
+  size_t run_size;
+} LoadConfig;
+
+// LoadStats describes a bulk load once it is done, or where it failed
+typedef struct {
+  uint64_t rows;
+  // Sorted runs written to temporary files, 0 if the rows fit in memory
+  uint32_t runs;
+  uint32_t leaves;
+  uint32_t internal_nodes;
+  // Levels of internal nodes above the leaves
+  uint32_t height;
+  // Line of the input that made the load fail
+  uint64_t line;
+  // Key found twice when the load fails with LOAD_DUPLICATE_KEY
+  uint32_t duplicate_key;
+} LoadStats;
+
+// Load the rows of a text file into an empty database. Every line holds a row
+// as "<id> <username> <email>", in any order. The rows are sorted, the leaves
+// are packed to the fill factor and the internal nodes are built bottom-up.
+// The pages are appended to the file in order, straight to their place rather
+// than through the log, and only the nodes still open when a batch of pages
+// is written are written again. The file is synced once and the new root is
+// committed through the log, a crash before that drops the appended pages.
+// Nothing is loaded if the input has an error.
+LoadResult load_file(Database *database, const char *filename,
+                     const LoadConfig *config, LoadStats *stats);
+
+// Print the statistics of a bulk load to stdout
+void load_print_stats(const LoadStats *stats);
+
+#endif
@@ -2,6 +2,12 @@
 #define META_H
 
 #include "database.h"
+#include "load.h"
+
+enum {
+  // META_LOAD_COMMAND_SIZE is the length of the ".load " command.
+  META_LOAD_COMMAND_SIZE = 6
+};
 
 // MetaCommandResult is an enum that represents the result of executing a meta
 // command.
@@ -14,4 +20,8 @@ typedef enum {
 // Execute a meta command (e.g. .exit) and return the result.
 MetaCommandResult meta_execute_command(char *command, Database *database);
 
+// Bulk load a file into the database and report the result.
+LoadResult meta_load(Database *database, const char *filename,
+                     const LoadConfig *config);
+
 #endif
@@ -1,34 +1,433 @@
 #ifndef PAGER_H
 #define PAGER_H
 
+#include "io.h"
+#include "wal.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 enum {
-  // PAGER_MAX_PAGES is the maximum number of pages that can be handled
-  PAGER_MAX_PAGES = 100,
+  // PAGER_DEFAULT_CACHE_PAGES is the default number of frames in the buffer
+  // pool (8 megabytes of 4 kilobyte pages)
+  PAGER_DEFAULT_CACHE_PAGES = 2048,
   // 4 kilobytes, same size as a virtual memory page in most architectures,
   // so that a database page corresponds to a single memory page for the OS.
-  PAGER_PAGE_SIZE = 4096
+  PAGER_DEFAULT_PAGE_SIZE = 4096,
+  // The page size is chosen when the database is created, it is a power of
+  // two between PAGER_MIN_PAGE_SIZE and PAGER_MAX_PAGE_SIZE. Larger pages
+  // mean fewer leaves to visit for scans and larger sequential transfers.
+  PAGER_MIN_PAGE_SIZE = 4096,
+  PAGER_MAX_PAGE_SIZE = 65536,
+  // PAGER_MAX_WRITE_PAGES is the maximum number of adjacent dirty pages
+  // coalesced into a single vectored write
+  PAGER_MAX_WRITE_PAGES = 64,
+  // PAGER_MMAP_GROW_PAGES is the number of pages by which the mapping grows
+  // past the end of the file when new pages are allocated
+  PAGER_MMAP_GROW_PAGES = 256,
+  // PAGER_IO_RING_ENTRIES is the number of transfers kept in flight by the
+  // asynchronous I/O backend
+  PAGER_IO_RING_ENTRIES = 64,
+  // PAGER_READAHEAD_MIN_PAGES is the window read ahead when a scan starts
+  PAGER_READAHEAD_MIN_PAGES = 4,
+  // PAGER_READAHEAD_PAGES is the largest window read ahead by a scan, the
+  // window doubles up to it while the scan stays sequential
+  PAGER_READAHEAD_PAGES = 32,
+  // PAGER_THREAD_SLOTS is the number of slots of a PagerCounter or
+  // PagerReaders, threads beyond it share slots
+  PAGER_THREAD_SLOTS = 16
 };
 
-// Pager is an abstraction that handles disk I/O.
+// PAGER_MMAP_MAX_SIZE is the size of the address space reserved for the
+// mapping in memory-mapped mode (256 gigabytes)
+static const uint64_t PAGER_MMAP_MAX_SIZE = (uint64_t)1 << 38;
+
+// PagerPageFlags are the per-page flags of the memory-mapped mode
+enum {
+  PAGER_PAGE_DIRTY = 1 << 0,
+  PAGER_PAGE_UNCOMMITTED = 1 << 1,
+  // The checksum of the page has been verified since it was mapped
+  PAGER_PAGE_VERIFIED = 1 << 2
+};
+
+// PAGER_INVALID_FRAME is returned when no frame holds a page
+static const uint32_t PAGER_INVALID_FRAME = UINT32_MAX;
+
+// PAGER_NO_PAGE is the page number of a frame that holds no page
+static const uint32_t PAGER_NO_PAGE = UINT32_MAX;
+
+// PAGER_FREE_PAGE_MARKER starts every page on the freelist. Its first byte is
+// not a valid node type, so a free page is never mistaken for a node.
+static const uint32_t PAGER_FREE_PAGE_MARKER = 0x65657266;
+
+// PAGER_HEADER_MAGIC starts the header page of every gnaro database file
+static const char PAGER_HEADER_MAGIC[16] = "gnaro format 1";
+
+enum {
+  // PAGER_HEADER_PAGE_NUM is the page holding the file header
+  PAGER_HEADER_PAGE_NUM = 0,
+  // PAGER_FORMAT_VERSION is the version of the file format, files of older
+  // versions are upgraded when the database is opened. Version 2 introduced
+  // slotted leaves, version 3 compact rows and version 4 overflow pages.
+  PAGER_FORMAT_VERSION = 4
+};
+
+// PagerChecksumType is the scheme used to checksum pages. Files created
+// before checksums existed have none, new files use CRC32C.
+typedef enum { PAGER_CHECKSUM_NONE, PAGER_CHECKSUM_CRC32C } PagerChecksumType;
+
+// PAGER_PAGE_TRAILER_SIZE is the space at the end of every page holding its
+// checksum, when the file has checksums
+static const uint32_t PAGER_PAGE_TRAILER_SIZE = sizeof(uint32_t);
+
+// PagerHeader is stored at the beginning of the first page of the database
+// file and describes the rest of it. A file whose first page does not start
+// with the magic string was written before the header existed, its first page
+// is the root of the B-tree.
+typedef struct {
+  char magic[16];
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t checksum_type;
+  // Page of the B-tree root, 0 until the B-tree is created
+  uint32_t root_page_num;
+  // First page of the freelist, 0 if the freelist is empty. Every free page
+  // holds the number of the next one.
+  uint32_t freelist_head;
+  uint32_t freelist_count;
+  // First page appended by a bulk load in progress, 0 otherwise. The pages of
+  // the load are written without the log and dropped if the file is opened
+  // before the load is done.
+  uint32_t bulk_start_page;
+} PagerHeader;
+
+// PagerConfig holds the tunables of a pager, usually set from the command line
+typedef struct {
+  // Number of pages the buffer pool keeps in memory before evicting
+  uint32_t cache_pages;
+  // Size of the pages of a new database, 0 for PAGER_DEFAULT_PAGE_SIZE. The
+  // page size of an existing database is read from its header.
+  uint32_t page_size;
+  // Map the database file in memory instead of using the buffer pool
+  bool mmap;
+  // Batch page I/O through io_uring when it is available
+  bool async_io;
+  // Trust the pages read from the file and skip verifying their checksums
+  bool skip_verify;
+  // Group commit settings of the write-ahead log
+  WalConfig wal;
+} PagerConfig;
+
+// PagerStats counts buffer pool activity, useful to size the pool
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t writebacks;
+  uint64_t pages_written;
+  uint64_t write_calls;
+  uint64_t prefetches;
+  uint64_t pages_reused;
+  uint64_t pages_verified;
+} PagerStats;
+
+// PagerReadahead tracks the pages a scan is visiting to detect when they
+// follow each other in the file
+typedef struct {
+  // Page expected next if the scan is sequential
+  uint32_t next_page_num;
+  // First page past the pages already read ahead
+  uint32_t end_page_num;
+  uint32_t window;
+} PagerReadahead;
+
+// PagerLatch is the reader-writer latch of a page and its version. The version
+// is odd while a thread holds the latch exclusively and grows with every
+// change made under it, so that a thread reading the page without the latch
+// can tell whether it changed in the meantime.
+typedef struct {
+  pthread_rwlock_t lock;
+  atomic_uint version;
+} PagerLatch;
+
+// PagerFrame is a slot in the buffer pool holding one cached page. Frames are
+// allocated one by one and never move or get freed before the pager, so that
+// threads can find a page and read it without the mutex: the fields they read
+// are atomic, and the page number of a frame only changes while its latch is
+// held exclusively, which changes the version.
+typedef struct PagerFrame {
+  void *page;
+  _Atomic uint32_t page_num;
+  // Next frame in the same hash bucket
+  _Atomic(struct PagerFrame *) next;
+  // Position of the frame in the frames of the pager
+  uint32_t index;
+  // Epoch of the last access, frames used in the current epoch are pinned
+  uint64_t epoch;
+  // Number of latches and pins held on the page, a frame in use is never
+  // evicted whatever its epoch
+  atomic_uint pin_count;
+  PagerLatch latch;
+  // Reference bit for the CLOCK eviction policy
+  atomic_bool referenced;
+  // Set by every path that modifies the page, only dirty pages are written
+  bool dirty;
+  // Modified since the last commit, cleared once the page is in the log
+  bool uncommitted;
+  // The page is being read from the file or written back to it without the
+  // mutex. The thread doing the I/O holds the latch exclusively and a pin,
+  // other threads wait for the latch before using the page.
+  bool io_in_progress;
+} PagerFrame;
+
+// PagerMap is the state of the memory-mapped mode. The database file is mapped
+// privately at a fixed address: reads are served from the OS page cache
+// without copies, and writes go to private copies of the pages which the
+// pager writes to the file itself, so that the log still comes first.
+// Pages past the end of the file are backed by anonymous memory until they
+// are written.
+typedef struct {
+  void *base;
+  // Pages that fit in the reserved address space
+  uint32_t max_pages;
+  uint32_t mapped_pages;
+  // Pages of the file that are mapped, the rest of the mapping is anonymous
+  uint32_t file_pages;
+  // PagerPageFlags of every mapped page
+  uint8_t *page_flags;
+  uint32_t *dirty_pages;
+  uint32_t num_dirty_pages;
+  uint32_t *uncommitted_pages;
+  uint32_t num_uncommitted_pages;
+} PagerMap;
+
+// PagerPageTable is the hash table locating the frame of a page. A table
+// replaced by a larger one may still be read by a thread looking up a page
+// without the mutex, so it is only freed with the pager.
+typedef struct PagerPageTable {
+  // The table this one replaced
+  struct PagerPageTable *previous;
+  // A power of two
+  uint32_t num_buckets;
+  _Atomic(PagerFrame *) buckets[];
+} PagerPageTable;
+
+// PagerCounter counts events of threads that do not hold the mutex. Every
+// thread adds to a slot on a cache line of its own, so that threads do not
+// write to the same line, and the slots are summed when the counter is read.
+typedef struct {
+  struct {
+    _Alignas(64) atomic_uint_fast64_t value;
+  } slots[PAGER_THREAD_SLOTS];
+} PagerCounter;
+
+// PagerReaders tracks the threads reading pages that they have not pinned. A
+// thread takes a slot, on a cache line of its own, for as long as it reads:
+// the count of the slot is odd in the meantime. A frame given to another page
+// is only overwritten once the threads that were reading have stopped, and
+// threads that start later find the frame latched.
+typedef struct {
+  struct {
+    _Alignas(64) atomic_uint_fast64_t count;
+  } slots[PAGER_THREAD_SLOTS];
+} PagerReaders;
+
+// Pager is an abstraction that handles disk I/O. Pages are cached in a buffer
+// pool with a fixed budget of frames, located through a hash table keyed by
+// page number and evicted with the CLOCK algorithm.
+//
+// Pages returned by pager_get_page() stay pinned until pager_unpin_all() is
+// called, so that pointers held by the B-tree while it works on several pages
+// are never invalidated. If every frame is pinned the pool temporarily grows
+// beyond its budget and shrinks back when the pages are unpinned.
+//
+// Changes are made durable by pager_commit(), which appends the modified
+// pages to a write-ahead log. Uncommitted pages are never evicted, so the
+// database file only ever receives committed pages.
+//
+// Several threads can use the pager: the buffer pool is protected by a mutex,
+// and pages are shared between threads through pager_latch_page(), which pins
+// a page and takes its latch, or pager_read_page(), which finds a page to be
+// read without its latch and validated with its version. A page already in
+// the pool is found, pinned and unpinned without the mutex. Pinning by epoch
+// belongs to the single thread that modifies the database. The memory-mapped
+// mode has no frames to latch and is used by a single thread.
 typedef struct {
   int file_descriptor;
-  uint32_t file_length;
+  Wal *wal;
+  uint32_t page_size;
+  // Bytes of a page available to its user, the rest is the page trailer
+  uint32_t usable_size;
+  // Verify the checksum of every page read from the file
+  bool verify_checksums;
+  uint64_t file_length;
   uint32_t num_pages;
-  void *pages[PAGER_MAX_PAGES];
+  // Frames in use come first, followed by the frames left over when the pool
+  // shrank back to its budget, which are reused when it grows again
+  PagerFrame **frames;
+  uint32_t num_frames;
+  uint32_t num_allocated_frames;
+  uint32_t max_frames;
+  uint32_t frames_capacity;
+  _Atomic(PagerPageTable *) table;
+  uint32_t clock_hand;
+  uint64_t epoch;
+  PagerStats stats;
+  // Pages found without the mutex, counted apart from the other hits
+  PagerCounter lookup_hits;
+  PagerReaders readers;
+  // Set in memory-mapped mode, which replaces the buffer pool
+  PagerMap *map;
+  // Set when asynchronous I/O is enabled and available
+  IoRing *ring;
+  PagerReadahead readahead;
+  // Held by every function of the pager, it is recursive since they call each
+  // other. It is never held while waiting for a page latch, nor while a page
+  // is read from the file or written back to it to free a frame.
+  pthread_mutex_t mutex;
+  // Copy of the file header, its version is 0 if the file has none yet
+  PagerHeader header;
 } Pager;
 
 // Open the database file and keeps track of its size
-Pager *pager_open(const char *filename);
+Pager *pager_open(const char *filename, const PagerConfig *config);
+
+// Get whether pages of the given size are supported
+bool pager_page_size_valid(uint32_t page_size);
+
+// Flush every cached page, close the database file and free the pager
+int pager_close(Pager *pager);
+
+// Close the database file and free the pager as a crash would, without
+// committing or writing anything
+void pager_abandon(Pager *pager);
 
 // GET a pointer to the page with the given page number
 void *pager_get_page(Pager *pager, uint32_t page_num);
 
-// Write the page with the given page number to disk
+// Read the given pages ahead of their use: into the buffer pool without
+// pinning them with asynchronous I/O, and into the OS page cache otherwise
+void pager_prefetch(Pager *pager, const uint32_t *page_nums, uint32_t count);
+
+// Tell the pager that a scan has moved to the given page. Pages that follow it
+// in the file are read ahead while the scan is sequential. Returns whether it
+// is.
+bool pager_readahead(Pager *pager, uint32_t page_num);
+
+// Unpin every page returned so far, allowing the buffer pool to evict them
+void pager_unpin_all(Pager *pager);
+
+// PagerLatchMode is the mode of a page latch: any number of threads can hold
+// the latch of a page in shared mode to read it, a single one in exclusive
+// mode to modify it
+typedef enum { PAGER_LATCH_SHARED, PAGER_LATCH_EXCLUSIVE } PagerLatchMode;
+
+// Pin a page and take its latch in the given mode, waiting for threads that
+// hold it in a conflicting mode. The page stays in the buffer pool until it is
+// unlatched.
+void *pager_latch_page(Pager *pager, uint32_t page_num, PagerLatchMode mode);
+
+// Same as pager_latch_page() but returns NULL instead of waiting
+void *pager_try_latch_page(Pager *pager, uint32_t page_num,
+                           PagerLatchMode mode);
+
+// Release the latch of a page and unpin it
+void pager_unlatch_page(Pager *pager, uint32_t page_num);
+
+// Pin a page without latching it, for pages that only change while the whole
+// B-tree is latched, such as overflow pages
+void *pager_pin_page(Pager *pager, uint32_t page_num);
+
+// Start reading pages with pager_read_page(). Until pager_read_exit(), the
+// calling thread must not wait for a latch nor for the mutex of the pager,
+// since a thread reusing a frame may be waiting for it to stop reading.
+void pager_read_enter(Pager *pager);
+
+void pager_read_exit(Pager *pager);
+
+// Find a page to read it without taking its latch or pinning it, between
+// pager_read_enter() and pager_read_exit(). The version of the latch from
+// before the page is read is checked by pager_read_validate() after: the page
+// may have changed in between, or its frame may have been given to another
+// page, and what was read must be discarded if it did. Nothing may be read
+// from the page while the version is odd. A page in the buffer pool is found
+// without the mutex, so that reading it writes to no memory shared with other
+// threads. Otherwise the thread stops reading while the page is loaded, and
+// the pages it read before must be validated again before they are read. The
+// latch is NULL in memory-mapped mode.
+void *pager_read_page(Pager *pager, uint32_t page_num, PagerLatch **latch,
+                      uint32_t *version);
+
+// Get the version of a latch, odd while a thread holds it exclusively
+uint32_t pager_read_begin(PagerLatch *latch);
+
+// Get whether the page of a latch is unchanged since the version was read
+bool pager_read_validate(PagerLatch *latch, uint32_t version);
+
+// Wait for the thread holding a latch exclusively, if any. The caller must not
+// hold any latch, nor be reading pages.
+void pager_read_wait(PagerLatch *latch);
+
+// Pin a page found by pager_read_page() and take its latch, unless the page
+// changed since the version was read. Returns whether it did not, in which
+// case pager_unlatch_page() releases both the latch and the pin. It waits for
+// the latch, so it is called after pager_read_exit().
+bool pager_latch_unchanged(PagerLatch *latch, uint32_t version,
+                           PagerLatchMode mode);
+
+void pager_unpin_page(Pager *pager, uint32_t page_num);
+
+// Mark a cached page as modified so that it is written back to disk
+void pager_mark_dirty(Pager *pager, uint32_t page_num);
+
+// Write the page with the given page number to disk if it is dirty
 void pager_flush(Pager *pager, uint32_t page_num);
 
-// Get the page number of the first unused page
+// Write every dirty page to disk, coalescing adjacent pages
+void pager_flush_all(Pager *pager);
+
+// Get the page number of an unused page, a page from the freelist if there is
+// one and a new page at the end of the file otherwise
 uint32_t pager_get_unused_page_num(Pager *pager);
 
+// Release a page that is no longer used, it is added to the freelist
+void pager_free_page(Pager *pager, uint32_t page_num);
+
+// Initialize the header of a file that has none, the freelist can only be used
+// once the file has a header. Pages are checksummed from then on with the
+// given scheme.
+void pager_init_header(Pager *pager, PagerChecksumType checksum_type);
+
+// Get whether the checksum in the trailer of a page matches its content
+bool pager_page_checksum_valid(Pager *pager, uint32_t page_num,
+                               const void *page);
+
+// Copy the in-memory header into the header page, after a field has changed
+void pager_write_header(Pager *pager);
+
+// Append the pages modified since the last commit to the write-ahead log
+void pager_commit(Pager *pager);
+
+// Make every pending commit durable
+void pager_sync(Pager *pager);
+
+// Write dirty pages to the database file and restart the write-ahead log
+void pager_checkpoint(Pager *pager);
+
+// Start a bulk load: pages are appended to the file from now on, and the
+// header recording where they start is made durable
+void pager_bulk_begin(Pager *pager);
+
+// Write the dirty pages of the bulk load to the database file without logging
+// them, they can then be evicted like committed pages
+void pager_bulk_write(Pager *pager);
+
+// Write and sync the pages of the bulk load and clear the header field, for
+// the caller to commit with the changes that make the pages reachable
+void pager_bulk_end(Pager *pager);
+
+// Print buffer pool statistics to stdout
+void pager_print_stats(Pager *pager);
+
 #endif
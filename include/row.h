@@ -3,28 +3,33 @@
 
 #include <stdint.h>
 
-// Hardcoded Row for now.
-enum { ROW_COLUMN_USERNAME_SIZE = 32, ROW_COLUMN_EMAIL_SIZE = 255 };
+// Hardcoded Row for now. Emails can be large, rows that do not fit in a leaf
+// continue in overflow pages.
+enum { ROW_COLUMN_USERNAME_SIZE = 32, ROW_COLUMN_EMAIL_SIZE = 65535 };
 typedef struct {
   uint32_t id;
   char username[ROW_COLUMN_USERNAME_SIZE + 1];
   char email[ROW_COLUMN_EMAIL_SIZE + 1];
 } Row;
 
-// Compact representation of a row, hardcoded for now
-#define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
-static const uint32_t ROW_ID_SIZE = size_of_attribute(Row, id);
-static const uint32_t ROW_USERNAME_SIZE = size_of_attribute(Row, username);
-static const uint32_t ROW_EMAIL_SIZE = size_of_attribute(Row, email);
-static const uint32_t ROW_ID_OFFSET = 0;
-static const uint32_t ROW_USERNAME_OFFSET = ROW_ID_OFFSET + ROW_ID_SIZE;
-static const uint32_t ROW_EMAIL_OFFSET =
-    ROW_USERNAME_OFFSET + ROW_USERNAME_SIZE;
-static const uint32_t ROW_SIZE =
-    ROW_ID_SIZE + ROW_USERNAME_SIZE + ROW_EMAIL_SIZE;
+// Compact representation of a row: the id as a varint of 7 bits per byte,
+// followed by the username and the email, each prefixed with its length as a
+// varint. A row takes as many bytes as its data and not the size of its
+// columns.
+enum {
+  ROW_ID_MAX_SIZE = 5,
+  // Length of the username
+  ROW_SHORT_LENGTH_MAX_SIZE = 1,
+  // Length of the email
+  ROW_LONG_LENGTH_MAX_SIZE = 3,
+  ROW_MAX_SIZE = ROW_ID_MAX_SIZE + ROW_SHORT_LENGTH_MAX_SIZE +
+                 ROW_COLUMN_USERNAME_SIZE + ROW_LONG_LENGTH_MAX_SIZE +
+                 ROW_COLUMN_EMAIL_SIZE
+};
 
-// Serialize a row for storage in a database.
-void row_serialize(Row *source, void *destination);
+// Serialize a row for storage in a database. Returns the number of bytes
+// written, at most ROW_MAX_SIZE.
+uint32_t row_serialize(Row *source, void *destination);
 
 // Deserialize a row from storage in a database.
 void row_deserialize(void *source, Row *destination);
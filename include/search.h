@@ -0,0 +1,33 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Key search inside nodes. Keys are 32-bit and sorted, spaced stride bytes
+// apart: 4 for an array of keys, 8 for an array of pairs with the key in the
+// first or second word, and the cell size for keys stored in front of their
+// values. The search narrows the range with a branchless binary search and
+// finishes with a linear scan, using AVX2 or SSE2 when the keys are close
+// enough to be loaded together.
+
+enum {
+  // SEARCH_LINEAR_KEYS is the largest range scanned linearly instead of being
+  // halved again, the keys of a range fit in one or two cache lines
+  SEARCH_LINEAR_KEYS = 16
+};
+
+// Get the number of keys less than key, which is the position of the first
+// key greater than or equal to key, or count if there is none
+uint32_t search_lower_bound(const void *keys, uint32_t count, size_t stride,
+                            uint32_t key);
+
+// Same as search_lower_bound() with a plain binary search, kept as a
+// reference for tests and benchmarks
+uint32_t search_lower_bound_scalar(const void *keys, uint32_t count,
+                                   size_t stride, uint32_t key);
+
+// Get the name of the instruction set used by search_lower_bound()
+const char *search_implementation(void);
+
+#endif
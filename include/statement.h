@@ -3,10 +3,16 @@
 
 #include "database.h"
 #include "row.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 enum {
   // STATEMENT_INSERT_COMMAND_SIZE is the length of the "insert" command.
-  STATEMENT_INSERT_COMMAND_SIZE = 6
+  STATEMENT_INSERT_COMMAND_SIZE = 6,
+  // STATEMENT_DELETE_COMMAND_SIZE is the length of the "delete" command.
+  STATEMENT_DELETE_COMMAND_SIZE = 6,
+  // STATEMENT_SELECT_COMMAND_SIZE is the length of the "select" command.
+  STATEMENT_SELECT_COMMAND_SIZE = 6
 };
 
 // StatementPrepareResult is an enum that represents the result of preparing a
@@ -28,13 +34,25 @@ typedef enum {
 } StatementExecuteResult;
 
 // StatementType is an enum that represents the type of a statement.
-typedef enum { STATEMENT_INSERT, STATEMENT_SELECT } StatementType;
+typedef enum {
+  STATEMENT_INSERT,
+  STATEMENT_SELECT,
+  STATEMENT_DELETE
+} StatementType;
 
 // Statement is a struct that represents a statement.
 typedef struct {
   StatementType type;
   // Only used by insert statement
   Row row_to_insert;
+  // Only used by select and delete statements, the ids of the rows are from
+  // min_id to max_id
+  uint32_t min_id;
+  uint32_t max_id;
+  // Only used by select statement, the order of the rows and the largest
+  // number of rows returned, UINT32_MAX when there is no limit
+  bool descending;
+  uint32_t limit;
 } Statement;
 
 // Prepare a statement
@@ -44,6 +62,14 @@ StatementPrepareResult statement_prepare(char *query, Statement *statement);
 StatementPrepareResult statement_prepare_insert(char *query,
                                                 Statement *statement);
 
+// Prepare a select statement
+StatementPrepareResult statement_prepare_select(char *query,
+                                                Statement *statement);
+
+// Prepare a delete statement
+StatementPrepareResult statement_prepare_delete(char *query,
+                                                Statement *statement);
+
 // Execute a statement
 StatementExecuteResult statement_execute(Statement *statement,
                                          Database *database);
@@ -53,6 +79,11 @@ StatementExecuteResult statement_execute_insert(Statement *statement,
                                                 Database *database);
 
 // Execute a select statement
-StatementExecuteResult statement_execute_select(Database *database);
+StatementExecuteResult statement_execute_select(Statement *statement,
+                                                Database *database);
+
+// Execute a delete statement
+StatementExecuteResult statement_execute_delete(Statement *statement,
+                                                Database *database);
 
 #endif
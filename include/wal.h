@@ -0,0 +1,126 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+  // WAL_MAGIC identifies a gnaro write-ahead log file
+  WAL_MAGIC = 0x676e6c77,
+  // WAL_VERSION is the version of the log format
+  WAL_VERSION = 1,
+  // WAL_CHECKPOINT_FRAMES is the number of frames after which the pager copies
+  // the logged pages into the database file and restarts the log
+  WAL_CHECKPOINT_FRAMES = 1000,
+  // WAL_DEFAULT_MAX_BATCH is the default number of commits synced together,
+  // one means that every commit is synced on its own
+  WAL_DEFAULT_MAX_BATCH = 1,
+  // WAL_DEFAULT_MAX_DELAY_MS is the default time a commit waits for others to
+  // join its group before the log is synced
+  WAL_DEFAULT_MAX_DELAY_MS = 10
+};
+
+// WalConfig configures group commit: pending commits are synced together once
+// max_batch commits are waiting or the oldest one has waited max_delay_ms,
+// whether or not more commits follow
+typedef struct {
+  uint32_t max_batch;
+  uint32_t max_delay_ms;
+} WalConfig;
+
+// WalHeader is stored at the beginning of the log file. The salt changes every
+// time the log is restarted, so frames left over from a previous generation
+// are never replayed.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t salt;
+  uint32_t checksum[2];
+} WalHeader;
+
+// WalFrameHeader precedes every page image in the log. A frame with a non-zero
+// database size is the last frame of a commit. The checksum covers the frame
+// header fields and the page image, chained with the checksum of the previous
+// frame, so a torn write invalidates the rest of the log.
+typedef struct {
+  uint32_t page_num;
+  uint32_t database_size;
+  uint32_t salt;
+  uint32_t checksum[2];
+} WalFrameHeader;
+
+// WalStats counts log activity, syncs only count the syncs that made commits
+// durable so that commits / syncs is the average size of a commit group
+typedef struct {
+  uint64_t commits;
+  uint64_t frames;
+  uint64_t syncs;
+  uint64_t checkpoints;
+} WalStats;
+
+// Wal is a write-ahead log stored next to the database file. Committed pages
+// are appended to the log sequentially and synced, and only copied into the
+// database file when the log is checkpointed.
+//
+// With group commit, the frames of pending commits are buffered in memory and
+// written with a single write and sync for the whole group. A pending commit
+// is not durable yet: a flusher thread syncs the group when its oldest commit
+// has waited max_delay_ms, so a crash loses at most that much.
+typedef struct {
+  int file_descriptor;
+  char *filename;
+  WalConfig config;
+  uint32_t page_size;
+  uint32_t salt;
+  uint32_t checksum[2];
+  // Frames in the log, including the pending ones still in the buffer
+  uint32_t num_frames;
+  void *buffer;
+  uint32_t buffer_capacity;
+  uint32_t pending_frames;
+  uint32_t pending_commits;
+  // Time at which the oldest pending commit was made
+  uint64_t pending_since_ms;
+  WalStats stats;
+  // Protects the log from the flusher thread, which only runs with group
+  // commit and waits on pending until a group is due
+  pthread_mutex_t mutex;
+  pthread_cond_t pending;
+  pthread_t flusher;
+  bool flusher_running;
+  bool stopping;
+} Wal;
+
+// Open the log of a database, replaying committed frames into the database
+// file left over by a crash
+Wal *wal_open(const char *database_filename, int database_fd,
+              const WalConfig *config);
+
+// Restart the log for pages of the given size, once the page size of the
+// database is known
+void wal_start(Wal *wal, uint32_t page_size);
+
+// Append the pages of a transaction to the log, the log is synced once the
+// group of pending commits is complete
+void wal_commit(Wal *wal, void **pages, const uint32_t *page_nums,
+                uint32_t count, uint32_t database_size);
+
+// Write and sync every pending commit
+void wal_sync(Wal *wal);
+
+// Restart the log after its pages have been written to the database file
+void wal_reset(Wal *wal);
+
+// Close the log and remove its file, the log must have been checkpointed
+void wal_close(Wal *wal);
+
+// Close the log and free it as a crash would, pending commits are dropped and
+// the file is left for recovery
+void wal_abandon(Wal *wal);
+
+// Print log statistics to stdout
+void wal_print_stats(Wal *wal);
+
+#endif
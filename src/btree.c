@@ -3,7 +3,9 @@
 #include "../include/database.h"
 #include "../include/pager.h"
 #include "../include/row.h"
+#include "../include/search.h"
 #include "../lib/log/log.h"
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -11,6 +13,43 @@
 #include <stdlib.h>
 #include <string.h>
 
+// Nodes hold as many cells as fit in a page after the header, and a full node
+// is split in two halves when one more cell is inserted. Leaves are full when
+// their free space is too small for the slot and the value of the new cell.
+BtreeLayout btree_layout(uint32_t usable_size) {
+  BtreeLayout layout;
+  layout.leaf_space_for_cells = usable_size - BTREE_NODE_LEAF_HEADER_SIZE;
+  layout.leaf_max_value =
+      layout.leaf_space_for_cells / 4 - BTREE_NODE_LEAF_SLOT_SIZE;
+  layout.overflow_space = usable_size - BTREE_OVERFLOW_HEADER_SIZE;
+  layout.internal_max_keys = (usable_size - BTREE_NODE_INTERNAL_HEADER_SIZE) /
+                             BTREE_NODE_INTERNAL_CELL_SIZE;
+  layout.leaf_min_used = layout.leaf_space_for_cells / 3;
+  layout.internal_min_keys = layout.internal_max_keys / 3;
+  return layout;
+}
+
+// Internal nodes are read without their latch by other threads while an
+// insert modifies them, so the fields that those threads read are loaded and
+// stored with relaxed atomics. The fields are only aligned on two bytes and
+// are accessed in halves: a torn value is caught by the version of the node.
+static uint32_t btree_node_load(const void *field) {
+  const _Atomic uint16_t *halves = field;
+  uint16_t value[2] = {atomic_load_explicit(&halves[0], memory_order_relaxed),
+                       atomic_load_explicit(&halves[1], memory_order_relaxed)};
+  uint32_t result;
+  memcpy(&result, value, sizeof(result));
+  return result;
+}
+
+static void btree_node_store(void *field, uint32_t value) {
+  _Atomic uint16_t *halves = field;
+  uint16_t halves_value[2];
+  memcpy(halves_value, &value, sizeof(value));
+  atomic_store_explicit(&halves[0], halves_value[0], memory_order_relaxed);
+  atomic_store_explicit(&halves[1], halves_value[1], memory_order_relaxed);
+}
+
 NodeType btree_node_get_type(void *node) {
   log_debug("getting node type...");
   // Cast to uint8_t to ensure it is serialized as a single byte
@@ -18,10 +57,15 @@ NodeType btree_node_get_type(void *node) {
   return (NodeType)value;
 }
 
+NodeType btree_node_peek_type(void *node) {
+  return (NodeType)atomic_load_explicit(
+      (_Atomic uint8_t *)(node + BTREE_NODE_TYPE_OFFSET), memory_order_relaxed);
+}
+
 void btree_node_set_type(void *node, NodeType type) {
   log_debug("setting node type to %d...", type);
-  uint8_t value = type;
-  *((uint8_t *)(node + BTREE_NODE_TYPE_OFFSET)) = value;
+  atomic_store_explicit((_Atomic uint8_t *)(node + BTREE_NODE_TYPE_OFFSET),
+                        (uint8_t)type, memory_order_relaxed);
 }
 
 void btree_node_new_root(Database *database, uint32_t right_child_page_num) {
@@ -35,40 +79,32 @@ void btree_node_new_root(Database *database, uint32_t right_child_page_num) {
   void *right_child = pager_get_page(database->pager, right_child_page_num);
   uint32_t left_child_page_num = pager_get_unused_page_num(database->pager);
   void *left_child = pager_get_page(database->pager, left_child_page_num);
+  pager_mark_dirty(database->pager, database->root_page_num);
+  pager_mark_dirty(database->pager, right_child_page_num);
+  pager_mark_dirty(database->pager, left_child_page_num);
 
   if (btree_node_get_type(root) == BTREE_NODE_TYPE_INTERNAL) {
     btree_node_internal_init(right_child);
     btree_node_internal_init(left_child);
   }
 
+  // The children of the old root are found through the path of a cursor, not
+  // through pointers to their parent, so they are left untouched
   log_debug("copying old root to left child...");
-  memcpy(left_child, root, PAGER_PAGE_SIZE);
+  memcpy(left_child, root, database->pager->page_size);
   btree_node_set_root(left_child, false);
 
-  if (btree_node_get_type(left_child) == BTREE_NODE_TYPE_INTERNAL) {
-    void *child;
-    for (uint32_t i = 0; i < *btree_node_internal_num_keys(left_child); i++) {
-      child = pager_get_page(database->pager,
-                             *btree_node_internal_child(left_child, i));
-      *btree_node_parent(child) = left_child_page_num;
-    }
-    child = pager_get_page(database->pager,
-                           *btree_node_internal_right_child(left_child));
-    *btree_node_parent(child) = left_child_page_num;
-  }
-
   // Root node is a new internal node with one key and two children
   log_debug("initializing new root node...");
   btree_node_internal_init(root);
   btree_node_set_root(root, true);
-  *btree_node_internal_num_keys(root) = 1;
-  *btree_node_internal_child(root, 0) = left_child_page_num;
+  btree_node_store(btree_node_internal_num_keys(root), 1);
+  btree_node_store(btree_node_internal_cell(root, 0), left_child_page_num);
   uint32_t left_child_max_key =
       btree_node_get_max_key(database->pager, left_child);
-  *btree_node_internal_key(root, 0) = left_child_max_key;
-  *btree_node_internal_right_child(root) = right_child_page_num;
-  *btree_node_parent(left_child) = database->root_page_num;
-  *btree_node_parent(right_child) = database->root_page_num;
+  btree_node_store(btree_node_internal_key(root, 0), left_child_max_key);
+  btree_node_store(btree_node_internal_right_child(root),
+                   right_child_page_num);
 }
 
 uint32_t btree_node_get_max_key(Pager *pager, void *node) {
@@ -92,11 +128,6 @@ void btree_node_set_root(void *node, bool is_root) {
   *((uint8_t *)(node + BTREE_NODE_IS_ROOT_OFFSET)) = value;
 }
 
-uint32_t *btree_node_parent(void *node) {
-  log_debug("getting parent from node...");
-  return node + BTREE_NODE_PARENT_POINTER_OFFSET;
-}
-
 void btree_print(Pager *pager, uint32_t page_num, uint32_t indent_level) {
   void *node = pager_get_page(pager, page_num);
   uint32_t num_keys;
@@ -138,24 +169,25 @@ void btree_print(Pager *pager, uint32_t page_num, uint32_t indent_level) {
   }
 }
 
-void btree_node_leaf_init(void *node) {
+void btree_node_leaf_init(void *node, uint32_t usable_size) {
   log_debug("initializing leaf node...");
   btree_node_set_type(node, BTREE_NODE_TYPE_LEAF);
   btree_node_set_root(node, false);
   *btree_node_leaf_num_cells(node) = 0;
   // Set the next leaf to 0 (no sibling)
   *btree_node_leaf_next(node) = 0;
+  *btree_node_leaf_values_start(node) = usable_size;
 }
 
 uint32_t *btree_node_leaf_key(void *node, uint32_t cell_num) {
   log_debug("getting key from cell %d...", cell_num);
-  return btree_node_leaf_cell(node, cell_num);
+  return btree_node_leaf_slot(node, cell_num) + BTREE_NODE_LEAF_KEY_OFFSET;
 }
 
-void *btree_node_leaf_cell(void *node, uint32_t cell_num) {
-  log_debug("getting cell %d from node...", cell_num);
+void *btree_node_leaf_slot(void *node, uint32_t cell_num) {
+  log_debug("getting slot %d from node...", cell_num);
   return node + BTREE_NODE_LEAF_HEADER_SIZE +
-         (size_t)(cell_num * BTREE_NODE_LEAF_CELL_SIZE);
+         (size_t)cell_num * BTREE_NODE_LEAF_SLOT_SIZE;
 }
 
 uint32_t *btree_node_leaf_num_cells(void *node) {
@@ -163,173 +195,394 @@ uint32_t *btree_node_leaf_num_cells(void *node) {
   return node + BTREE_NODE_LEAF_NUM_CELLS_OFFSET;
 }
 
+uint32_t *btree_node_leaf_values_start(void *node) {
+  return node + BTREE_NODE_LEAF_VALUES_START_OFFSET;
+}
+
 void *btree_node_leaf_value(void *node, uint32_t cell_num) {
   log_debug("getting value from cell %d...", cell_num);
-  return btree_node_leaf_cell(node, cell_num) + BTREE_NODE_LEAF_KEY_SIZE;
+  uint16_t *offset = btree_node_leaf_slot(node, cell_num) +
+                     BTREE_NODE_LEAF_VALUE_OFFSET_OFFSET;
+  return node + *offset;
 }
 
-uint32_t *btree_node_leaf_next(void *node) {
-  return node + BTREE_NODE_LEAF_NEXT_LEAF_OFFSET;
+// Size of a value with the overflow flag, as passed to
+// btree_node_leaf_insert_cell()
+static uint32_t btree_node_leaf_value_size_field(void *node,
+                                                 uint32_t cell_num) {
+  uint16_t *size =
+      btree_node_leaf_slot(node, cell_num) + BTREE_NODE_LEAF_VALUE_SIZE_OFFSET;
+  return *size;
 }
 
-// Returns the position of the key, or the position of another key to move to
-// for inserting the new key, or the position one past the last key
-Cursor *btree_node_leaf_find(Database *database, uint32_t key,
-                             uint32_t page_num) {
-  log_debug("finding key %d in node...", key);
-  void *node = pager_get_page(database->pager, page_num);
-  uint32_t num_cells = *btree_node_leaf_num_cells(node);
+uint32_t btree_node_leaf_value_size(void *node, uint32_t cell_num) {
+  return btree_node_leaf_value_size_field(node, cell_num) &
+         ~BTREE_NODE_LEAF_VALUE_OVERFLOW;
+}
 
-  log_debug("allocating cursor...");
-  Cursor *cursor = malloc(sizeof(Cursor));
-  cursor->database = database;
-  cursor->page_num = page_num;
-
-  log_debug("binary searching for key %d...", key);
-  uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
-  while (one_past_max_index != min_index) {
-    log_debug("min_index: %d, one_past_max_index: %d...", min_index,
-              one_past_max_index);
-    uint32_t index = (min_index + one_past_max_index) / 2;
-    uint32_t key_at_index = *btree_node_leaf_key(node, index);
-
-    if (key == key_at_index) {
-      log_debug("key found at index %d", index);
-      cursor->cell_num = index;
-      return cursor;
-    }
-    if (key < key_at_index) {
-      log_debug("key is less than key at index %d...", index);
-      one_past_max_index = index;
+bool btree_node_leaf_value_overflows(void *node, uint32_t cell_num) {
+  return btree_node_leaf_value_size_field(node, cell_num) &
+         BTREE_NODE_LEAF_VALUE_OVERFLOW;
+}
+
+// Write the end of a row to a chain of new overflow pages, returns the first
+// page of the chain
+static uint32_t btree_overflow_write(Pager *pager, const uint8_t *data,
+                                     uint32_t size) {
+  BtreeLayout layout = btree_layout(pager->usable_size);
+  uint32_t first_page_num = 0;
+  void *previous = NULL;
+  while (size > 0) {
+    uint32_t page_num = pager_get_unused_page_num(pager);
+    void *page = pager_get_page(pager, page_num);
+    pager_mark_dirty(pager, page_num);
+    log_debug("writing overflow page %d...", page_num);
+
+    uint32_t chunk = size < layout.overflow_space ? size : layout.overflow_space;
+    *(uint8_t *)(page + BTREE_NODE_TYPE_OFFSET) = BTREE_OVERFLOW_PAGE_TYPE;
+    *(uint32_t *)(page + BTREE_OVERFLOW_NEXT_OFFSET) = 0;
+    memcpy(page + BTREE_OVERFLOW_HEADER_SIZE, data, chunk);
+    if (previous == NULL) {
+      first_page_num = page_num;
     } else {
-      log_debug("key is greater than key at index %d...", index);
-      min_index = index + 1;
+      *(uint32_t *)(previous + BTREE_OVERFLOW_NEXT_OFFSET) = page_num;
     }
+    previous = page;
+    data += chunk;
+    size -= chunk;
+  }
+  return first_page_num;
+}
+
+// A row larger than a leaf value keeps its prefix in the value and the rest
+// goes to overflow pages
+uint32_t btree_node_leaf_spill(Pager *pager, uint8_t *value,
+                               uint32_t row_size) {
+  if (row_size <= btree_layout(pager->usable_size).leaf_max_value) {
+    return row_size;
   }
 
-  log_debug("setting cursor at index %d...", min_index);
-  cursor->cell_num = min_index;
-  return cursor;
+  log_debug("row of %d bytes goes to overflow pages...", row_size);
+  uint32_t page_num =
+      btree_overflow_write(pager, value + BTREE_NODE_LEAF_OVERFLOW_PREFIX_SIZE,
+                           row_size - BTREE_NODE_LEAF_OVERFLOW_PREFIX_SIZE);
+  memcpy(value + BTREE_NODE_LEAF_OVERFLOW_ROW_SIZE_OFFSET, &row_size,
+         sizeof(row_size));
+  memcpy(value + BTREE_NODE_LEAF_OVERFLOW_PAGE_OFFSET, &page_num,
+         sizeof(page_num));
+  return BTREE_NODE_LEAF_OVERFLOW_VALUE_SIZE | BTREE_NODE_LEAF_VALUE_OVERFLOW;
 }
 
-void btree_node_leaf_insert(Cursor *cursor, uint32_t key, Row *value) {
-  log_debug("inserting row into node...");
-  void *node = pager_get_page(cursor->database->pager, cursor->page_num);
+void btree_node_leaf_free_overflow(Pager *pager, void *node,
+                                   uint32_t cell_num) {
+  if (!btree_node_leaf_value_overflows(node, cell_num)) {
+    return;
+  }
 
-  uint32_t num_cells = *btree_node_leaf_num_cells(node);
-  if (num_cells >= BTREE_NODE_LEAF_MAX_CELLS) {
-    btree_node_leaf_split_and_insert(cursor, key, value);
+  uint32_t page_num;
+  memcpy(&page_num,
+         btree_node_leaf_value(node, cell_num) +
+             BTREE_NODE_LEAF_OVERFLOW_PAGE_OFFSET,
+         sizeof(page_num));
+  while (page_num != 0) {
+    void *page = pager_get_page(pager, page_num);
+    if (page == NULL ||
+        *(uint8_t *)(page + BTREE_NODE_TYPE_OFFSET) != BTREE_OVERFLOW_PAGE_TYPE) {
+      log_error("page %d is not an overflow page: corrupt file", page_num);
+      exit(EXIT_FAILURE);
+    }
+    uint32_t next_page_num = *(uint32_t *)(page + BTREE_OVERFLOW_NEXT_OFFSET);
+    log_debug("freeing overflow page %d...", page_num);
+    pager_free_page(pager, page_num);
+    page_num = next_page_num;
+  }
+}
+
+// Serialize a row into the value stored in a leaf, returns the size of the
+// value with the overflow flag
+static uint32_t btree_node_leaf_make_value(Pager *pager, Row *row,
+                                           uint8_t *value) {
+  log_debug("serializing row...");
+  return btree_node_leaf_spill(pager, value, row_serialize(row, value));
+}
+
+// Overflow pages are only read when the whole row is needed, keys and inline
+// values are read from the leaf alone. They are pinned instead of latched:
+// the latch of the leaf protects them, they only change with their row.
+void btree_node_leaf_row(Pager *pager, void *node, uint32_t cell_num,
+                         Row *row) {
+  void *value = btree_node_leaf_value(node, cell_num);
+  if (!btree_node_leaf_value_overflows(node, cell_num)) {
+    row_deserialize(value, row);
     return;
   }
 
-  if (cursor->cell_num < num_cells) {
-    log_debug("making room for new cell...");
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      log_debug("moving cell %d to the right...", i);
-      memcpy(btree_node_leaf_cell(node, i), btree_node_leaf_cell(node, i - 1),
-             BTREE_NODE_LEAF_CELL_SIZE);
+  uint32_t row_size;
+  uint32_t page_num;
+  memcpy(&row_size, value + BTREE_NODE_LEAF_OVERFLOW_ROW_SIZE_OFFSET,
+         sizeof(row_size));
+  memcpy(&page_num, value + BTREE_NODE_LEAF_OVERFLOW_PAGE_OFFSET,
+         sizeof(page_num));
+  if (row_size > ROW_MAX_SIZE) {
+    log_error("row of %d bytes is larger than %d bytes", row_size,
+              ROW_MAX_SIZE);
+    exit(EXIT_FAILURE);
+  }
+
+  uint8_t *buffer = malloc(row_size);
+  memcpy(buffer, value, BTREE_NODE_LEAF_OVERFLOW_PREFIX_SIZE);
+  BtreeLayout layout = btree_layout(pager->usable_size);
+  uint32_t size = BTREE_NODE_LEAF_OVERFLOW_PREFIX_SIZE;
+  while (size < row_size) {
+    void *page = page_num == 0 ? NULL : pager_pin_page(pager, page_num);
+    if (page == NULL ||
+        *(uint8_t *)(page + BTREE_NODE_TYPE_OFFSET) != BTREE_OVERFLOW_PAGE_TYPE) {
+      log_error("page %d is not an overflow page: corrupt file", page_num);
+      exit(EXIT_FAILURE);
     }
+    log_debug("reading overflow page %d...", page_num);
+    uint32_t chunk = row_size - size < layout.overflow_space
+                         ? row_size - size
+                         : layout.overflow_space;
+    memcpy(buffer + size, page + BTREE_OVERFLOW_HEADER_SIZE, chunk);
+    size += chunk;
+    uint32_t next_page_num = *(uint32_t *)(page + BTREE_OVERFLOW_NEXT_OFFSET);
+    pager_unpin_page(pager, page_num);
+    page_num = next_page_num;
   }
+  row_deserialize(buffer, row);
+  free(buffer);
+}
 
-  log_debug("incrementing num_cells...");
-  *(btree_node_leaf_num_cells(node)) += 1;
+uint32_t btree_node_leaf_free_space(void *node) {
+  return *btree_node_leaf_values_start(node) - BTREE_NODE_LEAF_HEADER_SIZE -
+         *btree_node_leaf_num_cells(node) * BTREE_NODE_LEAF_SLOT_SIZE;
+}
+
+// The value is stored below the others and only the slots after the new one
+// are shifted
+void btree_node_leaf_insert_cell(void *node, uint32_t cell_num, uint32_t key,
+                                 const void *value, uint32_t size) {
+  uint32_t num_cells = *btree_node_leaf_num_cells(node);
+  if (cell_num < num_cells) {
+    log_debug("making room for new slot...");
+    memmove(btree_node_leaf_slot(node, cell_num + 1),
+            btree_node_leaf_slot(node, cell_num),
+            (size_t)(num_cells - cell_num) * BTREE_NODE_LEAF_SLOT_SIZE);
+  }
 
-  log_debug("setting key...");
-  *(btree_node_leaf_key(node, cursor->cell_num)) = key;
+  uint32_t value_size = size & ~BTREE_NODE_LEAF_VALUE_OVERFLOW;
+  uint32_t offset = *btree_node_leaf_values_start(node) - value_size;
+  memcpy(node + offset, value, value_size);
+  *btree_node_leaf_values_start(node) = offset;
 
-  log_debug("serializing row...");
-  row_serialize(value, btree_node_leaf_value(node, cursor->cell_num));
+  void *slot = btree_node_leaf_slot(node, cell_num);
+  *(uint32_t *)(slot + BTREE_NODE_LEAF_KEY_OFFSET) = key;
+  *(uint16_t *)(slot + BTREE_NODE_LEAF_VALUE_OFFSET_OFFSET) = offset;
+  *(uint16_t *)(slot + BTREE_NODE_LEAF_VALUE_SIZE_OFFSET) = size;
+  *btree_node_leaf_num_cells(node) = num_cells + 1;
+}
+
+uint32_t btree_node_leaf_used_space(Pager *pager, void *node) {
+  return btree_layout(pager->usable_size).leaf_space_for_cells -
+         btree_node_leaf_free_space(node);
+}
+
+void btree_node_leaf_remove_cell(void *node, uint32_t cell_num) {
+  uint32_t num_cells = *btree_node_leaf_num_cells(node);
+  void *slot = btree_node_leaf_slot(node, cell_num);
+  uint32_t offset = *(uint16_t *)(slot + BTREE_NODE_LEAF_VALUE_OFFSET_OFFSET);
+  uint32_t size = btree_node_leaf_value_size(node, cell_num);
+  uint32_t values_start = *btree_node_leaf_values_start(node);
+
+  log_debug("closing gap of %d bytes left by cell %d...", size, cell_num);
+  memmove(node + values_start + size, node + values_start,
+          offset - values_start);
+  *btree_node_leaf_values_start(node) = values_start + size;
+  for (uint32_t i = 0; i < num_cells; i++) {
+    uint16_t *value_offset = btree_node_leaf_slot(node, i) +
+                             BTREE_NODE_LEAF_VALUE_OFFSET_OFFSET;
+    if (*value_offset < offset) {
+      *value_offset += size;
+    }
+  }
+
+  memmove(slot, slot + BTREE_NODE_LEAF_SLOT_SIZE,
+          (size_t)(num_cells - cell_num - 1) * BTREE_NODE_LEAF_SLOT_SIZE);
+  *btree_node_leaf_num_cells(node) = num_cells - 1;
+}
+
+uint32_t *btree_node_leaf_next(void *node) {
+  return node + BTREE_NODE_LEAF_NEXT_LEAF_OFFSET;
+}
+
+// Leaves that follow each other in the chain are children of the same parent
+// until the last one, so the parent of the leaf of a cursor lists the next
+// leaves without reading them. The parent is read without its latch and
+// nothing is returned if it changed meanwhile, or if it no longer has the leaf
+// where the path says.
+uint32_t btree_node_leaf_next_siblings(Cursor *cursor, uint32_t *page_nums,
+                                       uint32_t max) {
+  if (cursor->depth == 0) {
+    return 0;
+  }
+
+  Pager *pager = cursor->database->pager;
+  BtreeLayout layout = btree_layout(pager->usable_size);
+  uint32_t parent_page_num = cursor->path[cursor->depth - 1];
+  uint32_t child_num = cursor->path_child_nums[cursor->depth - 1];
+  PagerLatch *latch;
+  uint32_t version;
+  pager_read_enter(pager);
+  void *parent = pager_read_page(pager, parent_page_num, &latch, &version);
+  uint32_t count = 0;
+  if ((version & 1) == 0 &&
+      btree_node_peek_type(parent) == BTREE_NODE_TYPE_INTERNAL) {
+    uint32_t num_keys = btree_node_internal_peek_num_keys(parent, &layout);
+    if (child_num <= num_keys &&
+        btree_node_internal_peek_child(parent, num_keys, child_num) ==
+            cursor->page_num) {
+      for (child_num++; child_num <= num_keys && count < max; child_num++) {
+        page_nums[count++] =
+            btree_node_internal_peek_child(parent, num_keys, child_num);
+      }
+    }
+  }
+  if (!pager_read_validate(latch, version)) {
+    count = 0;
+  }
+  pager_read_exit(pager);
+  return count;
+}
+
+// A leaf can take any cell when it has room for the largest value stored in
+// a leaf, and an internal node any key until it is full
+bool btree_node_has_room(void *node, const BtreeLayout *layout) {
+  if (btree_node_get_type(node) == BTREE_NODE_TYPE_LEAF) {
+    return btree_node_leaf_free_space(node) >=
+           BTREE_NODE_LEAF_SLOT_SIZE + layout->leaf_max_value;
+  }
+  return *btree_node_internal_num_keys(node) < layout->internal_max_keys;
+}
+
+void btree_node_leaf_insert(Cursor *cursor, uint32_t key, Row *value) {
+  log_debug("inserting row into node...");
+  void *node = pager_get_page(cursor->database->pager, cursor->page_num);
+
+  uint8_t *row = malloc(ROW_MAX_SIZE);
+  uint32_t size = btree_node_leaf_make_value(cursor->database->pager, value, row);
+  if (btree_node_leaf_free_space(node) <
+      BTREE_NODE_LEAF_SLOT_SIZE + (size & ~BTREE_NODE_LEAF_VALUE_OVERFLOW)) {
+    btree_node_leaf_split_and_insert(cursor, key, row, size);
+    free(row);
+    return;
+  }
+
+  pager_mark_dirty(cursor->database->pager, cursor->page_num);
+  btree_node_leaf_insert_cell(node, cursor->cell_num, key, row, size);
+  free(row);
 
   log_debug("row inserted into node");
 }
 
+// The cells of the full node and the new cell are divided by size between the
+// old node and a new one. The cells are copied out of a copy of the old node,
+// which packs the values of both nodes again.
 void btree_node_leaf_split_and_insert(Cursor *cursor, uint32_t key,
-                                      Row *value) {
+                                      const void *value, uint32_t size) {
   // Create a new node and move half the cells over.
   // Insert the new value in one of the two nodes.
   // Update parent or create a new parent.
   log_debug("splitting node and inserting row...");
-  void *old_node = pager_get_page(cursor->database->pager, cursor->page_num);
-  uint32_t old_max = btree_node_get_max_key(cursor->database->pager, old_node);
-  uint32_t new_page_num = pager_get_unused_page_num(cursor->database->pager);
-  void *new_node = pager_get_page(cursor->database->pager, new_page_num);
+  Pager *pager = cursor->database->pager;
+  void *old_node = pager_get_page(pager, cursor->page_num);
+  uint32_t old_max = btree_node_get_max_key(pager, old_node);
+  uint32_t new_page_num = pager_get_unused_page_num(pager);
+  void *new_node = pager_get_page(pager, new_page_num);
+  pager_mark_dirty(pager, cursor->page_num);
+  pager_mark_dirty(pager, new_page_num);
+
+  void *copy = malloc(pager->page_size);
+  memcpy(copy, old_node, pager->page_size);
+  uint32_t num_cells = *btree_node_leaf_num_cells(copy);
 
   log_debug("initializing new node...");
-  btree_node_leaf_init(new_node);
-  *btree_node_parent(new_node) = *btree_node_parent(old_node);
+  btree_node_leaf_init(new_node, pager->usable_size);
   *btree_node_leaf_next(new_node) = *btree_node_leaf_next(old_node);
   *btree_node_leaf_next(old_node) = new_page_num;
+  *btree_node_leaf_num_cells(old_node) = 0;
+  *btree_node_leaf_values_start(old_node) = pager->usable_size;
+
+  // Appending past the last key of the rightmost leaf, as increasing ids do,
+  // leaves the old node full and starts the new one with the new cell only
+  bool appending =
+      cursor->cell_num == num_cells && *btree_node_leaf_next(new_node) == 0;
+  if (appending) {
+    cursor->database->rightmost_leaf_page_num = new_page_num;
+  }
 
-  log_debug("dividing keys evenly between old (left) and new (right) nodes...");
-  for (int32_t i = (int32_t)BTREE_NODE_LEAF_MAX_CELLS; i >= 0; i--) {
-    log_debug("moving cell %d...", i);
+  log_debug("dividing cells evenly between old (left) and new (right) nodes...");
+  uint32_t total_size =
+      BTREE_NODE_LEAF_SLOT_SIZE + (size & ~BTREE_NODE_LEAF_VALUE_OVERFLOW);
+  for (uint32_t i = 0; i < num_cells; i++) {
+    total_size += BTREE_NODE_LEAF_SLOT_SIZE + btree_node_leaf_value_size(copy, i);
+  }
 
-    void *destination_node;
-    if (i >= (int32_t)BTREE_NODE_LEAF_LEFT_SPLIT_COUNT) {
-      destination_node = new_node;
+  uint32_t left_size = 0;
+  for (uint32_t i = 0; i <= num_cells; i++) {
+    uint32_t cell_key;
+    const void *cell_value;
+    uint32_t cell_size;
+    if (i == cursor->cell_num) {
+      cell_key = key;
+      cell_value = value;
+      cell_size = size;
     } else {
-      destination_node = old_node;
+      uint32_t source = i < cursor->cell_num ? i : i - 1;
+      cell_key = *btree_node_leaf_key(copy, source);
+      cell_value = btree_node_leaf_value(copy, source);
+      cell_size = btree_node_leaf_value_size_field(copy, source);
     }
-    uint32_t index_within_node = i % BTREE_NODE_LEAF_LEFT_SPLIT_COUNT;
-    void *destination =
-        btree_node_leaf_cell(destination_node, index_within_node);
-
-    if (i == (int32_t)cursor->cell_num) {
-      log_debug("inserting row into new node...");
-      row_serialize(value,
-                    btree_node_leaf_value(destination_node, index_within_node));
-      *btree_node_leaf_key(destination_node, index_within_node) = key;
-    } else if (i > (int32_t)cursor->cell_num) {
-      memcpy(destination, btree_node_leaf_cell(old_node, i - 1),
-             BTREE_NODE_LEAF_CELL_SIZE);
-    } else {
-      memcpy(destination, btree_node_leaf_cell(old_node, i),
-             BTREE_NODE_LEAF_CELL_SIZE);
+
+    // The left node takes cells until it holds half of the bytes, or all of
+    // the old cells when appending, and the right node keeps at least one
+    // cell
+    void *destination_node = new_node;
+    if ((left_size * 2 < total_size && i < num_cells) || i == 0 ||
+        (appending && i < num_cells)) {
+      destination_node = old_node;
+      left_size += BTREE_NODE_LEAF_SLOT_SIZE +
+                   (cell_size & ~BTREE_NODE_LEAF_VALUE_OVERFLOW);
     }
+    btree_node_leaf_insert_cell(destination_node,
+                                *btree_node_leaf_num_cells(destination_node),
+                                cell_key, cell_value, cell_size);
   }
-
-  log_debug("updating cell counts...");
-  *(btree_node_leaf_num_cells(old_node)) = BTREE_NODE_LEAF_LEFT_SPLIT_COUNT;
-  *(btree_node_leaf_num_cells(new_node)) = BTREE_NODE_LEAF_RIGHT_SPLIT_COUNT;
+  free(copy);
 
   log_debug("updating parent node...");
   if (btree_node_is_root(old_node)) {
     return btree_node_new_root(cursor->database, new_page_num);
   }
 
-  uint32_t parent_page_num = *btree_node_parent(old_node);
-  uint32_t new_max = btree_node_get_max_key(cursor->database->pager, old_node);
-  void *parent = pager_get_page(cursor->database->pager, parent_page_num);
+  uint32_t parent_page_num = cursor->path[cursor->depth - 1];
+  uint32_t new_max = btree_node_get_max_key(pager, old_node);
+  void *parent = pager_get_page(pager, parent_page_num);
+  pager_mark_dirty(pager, parent_page_num);
 
   btree_node_internal_update_key(parent, old_max, new_max);
-  btree_node_internal_insert(cursor->database, parent_page_num, new_page_num);
+  btree_node_internal_insert(cursor, cursor->depth - 1, new_page_num);
 }
 
 void btree_node_internal_init(void *node) {
   log_debug("initializing internal node...");
   btree_node_set_type(node, BTREE_NODE_TYPE_INTERNAL);
   btree_node_set_root(node, false);
-  *btree_node_internal_num_keys(node) = 0;
+  btree_node_store(btree_node_internal_num_keys(node), 0);
   log_debug("setting right child to invalid page number to avoid root parent "
             "bug...");
-  *btree_node_internal_right_child(node) = BTREE_NODE_INTERNAL_INVALID_PAGE_NUM;
-}
-
-Cursor *btree_node_internal_find(Database *database, uint32_t key,
-                                 uint32_t page_num) {
-  log_debug("finding key %d in internal node...", key);
-  void *node = pager_get_page(database->pager, page_num);
-  uint32_t child_index = btree_node_internal_find_child(node, key);
-  uint32_t child_num = *btree_node_internal_child(node, child_index);
-  void *child = pager_get_page(database->pager, child_num);
-
-  switch (btree_node_get_type(child)) {
-  case BTREE_NODE_TYPE_LEAF:
-    return btree_node_leaf_find(database, key, child_num);
-  case BTREE_NODE_TYPE_INTERNAL:
-    return btree_node_internal_find(database, key, child_num);
-  }
+  btree_node_store(btree_node_internal_right_child(node),
+                   BTREE_NODE_INTERNAL_INVALID_PAGE_NUM);
 }
 
 uint32_t *btree_node_internal_key(void *node, uint32_t key_num) {
@@ -381,168 +634,475 @@ uint32_t *btree_node_internal_right_child(void *node) {
   return node + BTREE_NODE_INTERNAL_RIGHT_CHILD_OFFSET;
 }
 
-void btree_node_internal_insert(Database *database, uint32_t parent_page_num,
-                                uint32_t child_page_num) {
+// Insert a child into an internal node that has room for it
+static void btree_node_internal_insert_child(Database *database,
+                                             uint32_t parent_page_num,
+                                             uint32_t child_page_num) {
   log_debug("inserting new child into internal node...");
   void *parent = pager_get_page(database->pager, parent_page_num);
   void *child = pager_get_page(database->pager, child_page_num);
   uint32_t child_max_key = btree_node_get_max_key(database->pager, child);
   uint32_t index = btree_node_internal_find_child(parent, child_max_key);
+  pager_mark_dirty(database->pager, parent_page_num);
 
   uint32_t original_num_keys = *btree_node_internal_num_keys(parent);
-  *btree_node_internal_num_keys(parent) = original_num_keys + 1;
-
-  if (original_num_keys >= BTREE_NODE_INTERNAL_MAX_CELLS) {
-    btree_node_internal_split_and_insert(database, parent_page_num,
-                                         child_page_num);
-    return;
-  }
-
   uint32_t right_child_page_num = *btree_node_internal_right_child(parent);
 
   if (right_child_page_num == BTREE_NODE_INTERNAL_INVALID_PAGE_NUM) {
     log_debug("node is empty...");
-    *btree_node_internal_right_child(parent) = child_page_num;
+    btree_node_store(btree_node_internal_right_child(parent), child_page_num);
     return;
   }
 
   void *right_child = pager_get_page(database->pager, right_child_page_num);
 
   log_debug("incrementing num_keys...");
-  *btree_node_internal_num_keys(parent) = original_num_keys + 1;
+  btree_node_store(btree_node_internal_num_keys(parent),
+                   original_num_keys + 1);
 
   if (child_max_key > btree_node_get_max_key(database->pager, right_child)) {
     log_debug("replace right child...");
-    *btree_node_internal_child(parent, original_num_keys) =
-        right_child_page_num;
-    *btree_node_internal_key(parent, original_num_keys) =
-        btree_node_get_max_key(database->pager, right_child);
-    *btree_node_internal_right_child(parent) = child_page_num;
+    btree_node_store(btree_node_internal_cell(parent, original_num_keys),
+                     right_child_page_num);
+    btree_node_store(btree_node_internal_key(parent, original_num_keys),
+                     btree_node_get_max_key(database->pager, right_child));
+    btree_node_store(btree_node_internal_right_child(parent), child_page_num);
   } else {
     log_debug("making room for new cell...");
     for (uint32_t i = original_num_keys; i > index; i--) {
-      void *destination = btree_node_internal_cell(parent, i);
-      void *source = btree_node_internal_cell(parent, i - 1);
-      memcpy(destination, source, BTREE_NODE_INTERNAL_CELL_SIZE);
+      btree_node_store(btree_node_internal_cell(parent, i),
+                       *btree_node_internal_cell(parent, i - 1));
+      btree_node_store(btree_node_internal_key(parent, i),
+                       *btree_node_internal_key(parent, i - 1));
     }
-    *btree_node_internal_child(parent, index) = child_page_num;
-    *btree_node_internal_key(parent, index) = child_max_key;
+    btree_node_store(btree_node_internal_cell(parent, index), child_page_num);
+    btree_node_store(btree_node_internal_key(parent, index), child_max_key);
   }
 }
 
-void btree_node_internal_split_and_insert(Database *database,
-                                          uint32_t parent_page_num,
+void btree_node_internal_insert(Cursor *cursor, uint32_t depth,
+                                uint32_t child_page_num) {
+  Database *database = cursor->database;
+  uint32_t parent_page_num = cursor->path[depth];
+  void *parent = pager_get_page(database->pager, parent_page_num);
+  BtreeLayout layout = btree_layout(database->pager->usable_size);
+  if (*btree_node_internal_num_keys(parent) >= layout.internal_max_keys) {
+    btree_node_internal_split_and_insert(cursor, depth, child_page_num);
+    return;
+  }
+  btree_node_internal_insert_child(database, parent_page_num, child_page_num);
+}
+
+// The upper half of the cells of a full node is moved to a new node at once,
+// or only the last cell when appending.
+// The child in the middle becomes the right child of the old node and its key
+// goes up to the parent, then the new child is inserted into the half that
+// covers its keys.
+void btree_node_internal_split_and_insert(Cursor *cursor, uint32_t depth,
                                           uint32_t child_page_num) {
   log_debug("splitting internal node and inserting new child...");
+  Database *database = cursor->database;
+  uint32_t parent_page_num = cursor->path[depth];
   uint32_t old_page_num = parent_page_num;
   void *old_node = pager_get_page(database->pager, parent_page_num);
   uint32_t old_max = btree_node_get_max_key(database->pager, old_node);
 
   void *child = pager_get_page(database->pager, child_page_num);
   uint32_t child_max = btree_node_get_max_key(database->pager, child);
+  pager_mark_dirty(database->pager, parent_page_num);
 
   uint32_t new_page_num = pager_get_unused_page_num(database->pager);
-
-  log_debug("checking if node is root...");
-  uint32_t splitting_root = btree_node_is_root(old_node);
+  bool splitting_root = btree_node_is_root(old_node);
 
   void *parent;
+  uint32_t grandparent_page_num = 0;
   void *new_node;
   if (splitting_root) {
     log_debug("splitting root node...");
+    // The old root moves to a new left child, the new node is the right one
     btree_node_new_root(database, new_page_num);
     parent = pager_get_page(database->pager, database->root_page_num);
-
-    log_debug("updating old node to point to new root's left child...");
     old_page_num = *btree_node_internal_child(parent, 0);
     old_node = pager_get_page(database->pager, old_page_num);
+    new_node = pager_get_page(database->pager, new_page_num);
   } else {
     log_debug("splitting non-root node...");
-    parent = pager_get_page(database->pager, *btree_node_parent(old_node));
+    grandparent_page_num = cursor->path[depth - 1];
+    parent = pager_get_page(database->pager, grandparent_page_num);
+    pager_mark_dirty(database->pager, grandparent_page_num);
     new_node = pager_get_page(database->pager, new_page_num);
+    pager_mark_dirty(database->pager, new_page_num);
     btree_node_internal_init(new_node);
   }
 
-  uint32_t *old_num_keys = btree_node_internal_num_keys(old_node);
+  // A nearly empty child after every other one comes from a split that
+  // appended past the end of the tree. The old node is left full and the new
+  // one starts with the last child only.
+  uint32_t child_size = btree_node_get_type(child) == BTREE_NODE_TYPE_LEAF
+                            ? *btree_node_leaf_num_cells(child)
+                            : *btree_node_internal_num_keys(child);
+  bool appending = child_max > old_max && child_size <= 1;
+  uint32_t num_keys = *btree_node_internal_num_keys(old_node);
+  uint32_t middle = appending ? num_keys - 1 : num_keys / 2;
+  uint32_t num_moved_keys = num_keys - middle - 1;
+  uint32_t old_node_max = *btree_node_internal_key(old_node, middle);
+
+  log_debug("moving %d keys to new node...", num_moved_keys);
+  memcpy(btree_node_internal_cell(new_node, 0),
+         btree_node_internal_cell(old_node, middle + 1),
+         (size_t)num_moved_keys * BTREE_NODE_INTERNAL_CELL_SIZE);
+  *btree_node_internal_num_keys(new_node) = num_moved_keys;
+  *btree_node_internal_right_child(new_node) =
+      *btree_node_internal_right_child(old_node);
+  btree_node_store(btree_node_internal_right_child(old_node),
+                   *btree_node_internal_child(old_node, middle));
+  btree_node_store(btree_node_internal_num_keys(old_node), middle);
+
+  // Only the children of the new node have a new parent, and they do not
+  // record it, so none of them is written
+  uint32_t destination_page_num =
+      child_max < old_node_max ? old_page_num : new_page_num;
+  log_debug("inserting new child into page %d...", destination_page_num);
+  btree_node_internal_insert_child(database, destination_page_num,
+                                   child_page_num);
 
-  uint32_t cur_page_num = *btree_node_internal_right_child(old_node);
-  void *cur = pager_get_page(database->pager, cur_page_num);
+  log_debug("updating parent node...");
+  btree_node_internal_update_key(parent, old_max, old_node_max);
 
-  log_debug("moving right child to new node...");
-  btree_node_internal_insert(database, new_page_num, cur_page_num);
-  *btree_node_parent(cur) = new_page_num;
-  *btree_node_internal_right_child(old_node) =
-      BTREE_NODE_INTERNAL_INVALID_PAGE_NUM;
+  if (!splitting_root) {
+    // The parent is the node above in the path of the cursor, and it may
+    // split too
+    btree_node_internal_insert(cursor, depth - 1, new_page_num);
+  }
+}
+
+// The right child has no key, its maximum is the one of the node itself
+void btree_node_internal_update_key(void *node, uint32_t old_key,
+                                    uint32_t new_key) {
+  uint32_t old_child_index = btree_node_internal_find_child(node, old_key);
+  if (old_child_index < *btree_node_internal_num_keys(node)) {
+    btree_node_store(btree_node_internal_key(node, old_child_index), new_key);
+  }
+}
+
+// The child to follow is the first one whose key is not less than the key
+uint32_t btree_node_internal_find_child(void *node, uint32_t key) {
+  uint32_t num_keys = *btree_node_internal_num_keys(node);
+  return search_lower_bound(btree_node_internal_key(node, 0), num_keys,
+                            BTREE_NODE_INTERNAL_CELL_SIZE, key);
+}
 
-  log_debug("moving keys and children to new node...");
-  for (uint32_t i = BTREE_NODE_INTERNAL_MAX_CELLS - 1;
-       i > BTREE_NODE_INTERNAL_MAX_CELLS / 2; i--) {
-    log_debug("moving cell %d...", i);
-    cur_page_num = *btree_node_internal_child(old_node, i);
-    cur = pager_get_page(database->pager, cur_page_num);
+uint32_t btree_node_internal_peek_num_keys(void *node,
+                                           const BtreeLayout *layout) {
+  uint32_t num_keys =
+      btree_node_load(node + BTREE_NODE_INTERNAL_NUM_KEYS_OFFSET);
+  return num_keys < layout->internal_max_keys ? num_keys
+                                              : layout->internal_max_keys;
+}
 
-    btree_node_internal_insert(database, new_page_num, cur_page_num);
-    *btree_node_parent(cur) = new_page_num;
+uint32_t btree_node_internal_peek_child(void *node, uint32_t num_keys,
+                                        uint32_t child_num) {
+  return child_num < num_keys
+             ? btree_node_load(node + BTREE_NODE_INTERNAL_HEADER_SIZE +
+                               (size_t)child_num *
+                                   BTREE_NODE_INTERNAL_CELL_SIZE)
+             : btree_node_load(node + BTREE_NODE_INTERNAL_RIGHT_CHILD_OFFSET);
+}
 
-    (*old_num_keys)--;
+// A binary search over the keys loaded one by one, the keys of a node being
+// modified are not copied into a buffer for search_lower_bound()
+uint32_t btree_node_internal_peek_find_child(void *node, uint32_t num_keys,
+                                             uint32_t key) {
+  uint32_t low = 0;
+  uint32_t high = num_keys;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    uint32_t middle_key =
+        btree_node_load(node + BTREE_NODE_INTERNAL_HEADER_SIZE +
+                        (size_t)middle * BTREE_NODE_INTERNAL_CELL_SIZE +
+                        BTREE_NODE_INTERNAL_CHILD_SIZE);
+    if (middle_key < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
   }
+  return low;
+}
 
-  log_debug("updating old node to point to new node's left child...");
-  *btree_node_internal_right_child(old_node) =
-      *btree_node_internal_child(old_node, *old_num_keys - 1);
-  (*old_num_keys)--;
+void btree_node_internal_remove_child(void *node, uint32_t child_num) {
+  uint32_t num_keys = *btree_node_internal_num_keys(node);
+  if (child_num == num_keys) {
+    log_debug("replacing right child with last child...");
+    *btree_node_internal_right_child(node) =
+        *btree_node_internal_child(node, num_keys - 1);
+  } else {
+    memmove(btree_node_internal_cell(node, child_num),
+            btree_node_internal_cell(node, child_num + 1),
+            (size_t)(num_keys - child_num - 1) * BTREE_NODE_INTERNAL_CELL_SIZE);
+  }
+  *btree_node_internal_num_keys(node) = num_keys - 1;
+}
+
+// The key of the leaf of a cursor is held by the first ancestor in which the
+// path does not follow the right child, leaves on the right edge of the tree
+// have none
+static void btree_node_update_max_key(Cursor *cursor, uint32_t new_max) {
+  Pager *pager = cursor->database->pager;
+  for (uint32_t depth = cursor->depth; depth > 0; depth--) {
+    uint32_t parent_page_num = cursor->path[depth - 1];
+    void *parent = pager_get_page(pager, parent_page_num);
+    uint32_t index = cursor->path_child_nums[depth - 1];
+    if (index < *btree_node_internal_num_keys(parent)) {
+      *btree_node_internal_key(parent, index) = new_max;
+      pager_mark_dirty(pager, parent_page_num);
+      return;
+    }
+  }
+}
 
-  log_debug(
-      "determining which node should contain the child to be inserted...");
-  uint32_t max_after_split = btree_node_get_max_key(database->pager, old_node);
+// Move every cell of the right leaf to the end of the left one
+static void btree_node_leaf_merge(Database *database, void *left,
+                                  uint32_t left_page_num, void *right) {
+  uint32_t num_cells = *btree_node_leaf_num_cells(right);
+  for (uint32_t i = 0; i < num_cells; i++) {
+    btree_node_leaf_insert_cell(left, *btree_node_leaf_num_cells(left),
+                                *btree_node_leaf_key(right, i),
+                                btree_node_leaf_value(right, i),
+                                btree_node_leaf_value_size_field(right, i));
+  }
+  *btree_node_leaf_next(left) = *btree_node_leaf_next(right);
+  if (*btree_node_leaf_next(left) == 0) {
+    database->rightmost_leaf_page_num = left_page_num;
+  }
+}
 
-  uint32_t destination_page_num =
-      child_max < max_after_split ? old_page_num : new_page_num;
+// Move cells from the larger leaf to the smaller one until they hold about as
+// many bytes, the left leaf gives its last cells and the right leaf its first
+static void btree_node_leaf_redistribute(Pager *pager, void *left,
+                                         void *right) {
+  while (btree_node_leaf_used_space(pager, left) <
+             btree_node_leaf_used_space(pager, right) &&
+         *btree_node_leaf_num_cells(right) > 1) {
+    btree_node_leaf_insert_cell(left, *btree_node_leaf_num_cells(left),
+                                *btree_node_leaf_key(right, 0),
+                                btree_node_leaf_value(right, 0),
+                                btree_node_leaf_value_size_field(right, 0));
+    btree_node_leaf_remove_cell(right, 0);
+  }
+  while (btree_node_leaf_used_space(pager, right) <
+             btree_node_leaf_used_space(pager, left) &&
+         *btree_node_leaf_num_cells(left) > 1) {
+    uint32_t last = *btree_node_leaf_num_cells(left) - 1;
+    btree_node_leaf_insert_cell(right, 0, *btree_node_leaf_key(left, last),
+                                btree_node_leaf_value(left, last),
+                                btree_node_leaf_value_size_field(left, last));
+    btree_node_leaf_remove_cell(left, last);
+  }
+}
 
-  log_debug("inserting new child into destination node...");
-  btree_node_internal_split_and_insert(database, destination_page_num,
-                                       child_page_num);
-  *btree_node_parent(child) = destination_page_num;
+// Move every child of the right node to the end of the left one. The former
+// right child of the left node takes the separator key from the parent.
+static void btree_node_internal_merge(void *left, void *right,
+                                      uint32_t separator) {
+  uint32_t left_keys = *btree_node_internal_num_keys(left);
+  uint32_t right_keys = *btree_node_internal_num_keys(right);
+  *btree_node_internal_num_keys(left) = left_keys + 1 + right_keys;
+  *btree_node_internal_child(left, left_keys) =
+      *btree_node_internal_right_child(left);
+  *btree_node_internal_key(left, left_keys) = separator;
+  memcpy(btree_node_internal_cell(left, left_keys + 1),
+         btree_node_internal_cell(right, 0),
+         (size_t)right_keys * BTREE_NODE_INTERNAL_CELL_SIZE);
+  *btree_node_internal_right_child(left) =
+      *btree_node_internal_right_child(right);
+}
 
-  log_debug("updating parent node...");
-  btree_node_internal_update_key(
-      parent, old_max, btree_node_get_max_key(database->pager, old_node));
+// Move children from the node with more keys to the other one until they hold
+// about as many, rotating them through the separator key in the parent.
+// Returns the new separator.
+static uint32_t btree_node_internal_redistribute(void *left, void *right,
+                                                 uint32_t separator) {
+  while (*btree_node_internal_num_keys(left) + 1 <
+         *btree_node_internal_num_keys(right)) {
+    uint32_t left_keys = *btree_node_internal_num_keys(left);
+    uint32_t moved_page_num = *btree_node_internal_child(right, 0);
+    *btree_node_internal_num_keys(left) = left_keys + 1;
+    *btree_node_internal_child(left, left_keys) =
+        *btree_node_internal_right_child(left);
+    *btree_node_internal_key(left, left_keys) = separator;
+    *btree_node_internal_right_child(left) = moved_page_num;
+    separator = *btree_node_internal_key(right, 0);
+    btree_node_internal_remove_child(right, 0);
+  }
+  while (*btree_node_internal_num_keys(right) + 1 <
+         *btree_node_internal_num_keys(left)) {
+    uint32_t left_keys = *btree_node_internal_num_keys(left);
+    uint32_t right_keys = *btree_node_internal_num_keys(right);
+    uint32_t moved_page_num = *btree_node_internal_right_child(left);
+    memmove(btree_node_internal_cell(right, 1),
+            btree_node_internal_cell(right, 0),
+            (size_t)right_keys * BTREE_NODE_INTERNAL_CELL_SIZE);
+    *btree_node_internal_num_keys(right) = right_keys + 1;
+    *btree_node_internal_child(right, 0) = moved_page_num;
+    *btree_node_internal_key(right, 0) = separator;
+    separator = *btree_node_internal_key(left, left_keys - 1);
+    btree_node_internal_remove_child(left, left_keys);
+  }
+  return separator;
+}
 
-  if (!splitting_root) {
-    log_debug("not a root node, updating parent...");
-    btree_node_internal_insert(database, *btree_node_parent(old_node),
-                               new_page_num);
-    *btree_node_parent(new_node) = *btree_node_parent(old_node);
+// The root page never moves, the content of its only child is copied into it
+static void btree_node_collapse_root(Database *database) {
+  Pager *pager = database->pager;
+  void *root = pager_get_page(pager, database->root_page_num);
+  while (btree_node_get_type(root) == BTREE_NODE_TYPE_INTERNAL &&
+         *btree_node_internal_num_keys(root) == 0) {
+    uint32_t child_page_num = *btree_node_internal_right_child(root);
+    log_debug("replacing root with its only child %d...", child_page_num);
+    void *child = pager_get_page(pager, child_page_num);
+    memcpy(root, child, pager->usable_size);
+    btree_node_set_root(root, true);
+    pager_mark_dirty(pager, database->root_page_num);
+    if (btree_node_get_type(root) == BTREE_NODE_TYPE_LEAF) {
+      database->rightmost_leaf_page_num = database->root_page_num;
+    }
+    pager_free_page(pager, child_page_num);
   }
 }
 
-void btree_node_internal_update_key(void *node, uint32_t old_key,
-                                    uint32_t new_key) {
-  uint32_t old_child_index = btree_node_internal_find_child(node, old_key);
-  *btree_node_internal_key(node, old_child_index) = new_key;
+// The node at a depth of the path of a cursor, its leaf below the path
+static uint32_t btree_cursor_node(Cursor *cursor, uint32_t depth) {
+  return depth == cursor->depth ? cursor->page_num : cursor->path[depth];
 }
 
-uint32_t btree_node_internal_find_child(void *node, uint32_t key) {
-  log_debug("finding child for key %d...", key);
-  uint32_t num_keys = *btree_node_internal_num_keys(node);
+void btree_node_rebalance(Cursor *cursor, uint32_t depth) {
+  Database *database = cursor->database;
+  Pager *pager = database->pager;
+  BtreeLayout layout = btree_layout(pager->usable_size);
+  uint32_t page_num = btree_cursor_node(cursor, depth);
+  void *node = pager_get_page(pager, page_num);
+  if (depth == 0) {
+    btree_node_collapse_root(database);
+    return;
+  }
+
+  bool is_leaf = btree_node_get_type(node) == BTREE_NODE_TYPE_LEAF;
+  if (is_leaf ? btree_node_leaf_used_space(pager, node) >= layout.leaf_min_used
+              : *btree_node_internal_num_keys(node) >= layout.internal_min_keys) {
+    return;
+  }
 
-  log_debug("binary searching for key %d...", key);
-  uint32_t min_index = 0;
-  uint32_t max_index = num_keys;
-
-  while (min_index != max_index) {
-    log_debug("min_index: %d, max_index: %d...", min_index, max_index);
-    uint32_t index = (min_index + max_index) / 2;
-    uint32_t key_to_right = *btree_node_internal_key(node, index);
-    if (key_to_right >= key) {
-      log_debug("key is less than key at index %d...", index);
-      max_index = index;
+  uint32_t parent_page_num = cursor->path[depth - 1];
+  void *parent = pager_get_page(pager, parent_page_num);
+  uint32_t num_keys = *btree_node_internal_num_keys(parent);
+  if (num_keys == 0) {
+    log_debug("node %d has no sibling...", page_num);
+    btree_node_rebalance(cursor, depth - 1);
+    return;
+  }
+
+  // The node is paired with its left sibling, or its right one if it is the
+  // first child
+  uint32_t index = cursor->path_child_nums[depth - 1];
+  uint32_t left_index = index > 0 ? index - 1 : 0;
+  uint32_t left_page_num = *btree_node_internal_child(parent, left_index);
+  uint32_t right_page_num = *btree_node_internal_child(parent, left_index + 1);
+  void *left = pager_get_page(pager, left_page_num);
+  void *right = pager_get_page(pager, right_page_num);
+  uint32_t separator = *btree_node_internal_key(parent, left_index);
+  pager_mark_dirty(pager, left_page_num);
+  pager_mark_dirty(pager, right_page_num);
+  pager_mark_dirty(pager, parent_page_num);
+
+  bool merge =
+      is_leaf ? btree_node_leaf_used_space(pager, left) +
+                        btree_node_leaf_used_space(pager, right) <=
+                    layout.leaf_space_for_cells
+              : *btree_node_internal_num_keys(left) +
+                        *btree_node_internal_num_keys(right) + 1 <=
+                    layout.internal_max_keys;
+  if (!merge) {
+    log_debug("moving cells between nodes %d and %d...", left_page_num,
+              right_page_num);
+    if (is_leaf) {
+      btree_node_leaf_redistribute(pager, left, right);
+      separator = btree_node_get_max_key(pager, left);
     } else {
-      log_debug("key is greater than key at index %d...", index);
-      min_index = index + 1;
+      separator = btree_node_internal_redistribute(left, right, separator);
     }
+    *btree_node_internal_key(parent, left_index) = separator;
+    return;
+  }
+
+  log_debug("merging node %d into node %d...", right_page_num, left_page_num);
+  if (is_leaf) {
+    btree_node_leaf_merge(database, left, left_page_num, right);
+  } else {
+    btree_node_internal_merge(left, right, separator);
   }
+  // The merged node takes the place of the right one, whose key is the
+  // largest of both
+  btree_node_internal_remove_child(parent, left_index);
+  *btree_node_internal_child(parent, left_index) = left_page_num;
+  pager_free_page(pager, right_page_num);
+  btree_node_rebalance(cursor, depth - 1);
+}
+
+// Rows are deleted one leaf at a time: the cells in range are removed from the
+// leaf, then the leaf is rebalanced along the path of the cursor and the next
+// leaf is searched from the root, since merges move cells between leaves. The
+// cursor latches the leaf exclusively, but merges modify nodes it does not
+// hold, so the whole B-tree must be latched exclusively by the caller.
+uint32_t btree_delete(Database *database, uint32_t min_key, uint32_t max_key) {
+  log_debug("deleting keys %d to %d...", min_key, max_key);
+  Pager *pager = database->pager;
+  uint32_t num_deleted = 0;
+  while (min_key <= max_key) {
+    Cursor *cursor = cursor_find_key(database, min_key);
+    uint32_t page_num = cursor->page_num;
+    uint32_t first = cursor->cell_num;
+    void *node = cursor->node;
+    uint32_t num_cells = *btree_node_leaf_num_cells(node);
+    if (first == num_cells) {
+      // The rows from min_key start in the next leaf, which is searched from
+      // the root too so that the cursor has the path to it
+      uint32_t next_page_num = *btree_node_leaf_next(node);
+      cursor_close(cursor);
+      if (next_page_num == 0) {
+        break;
+      }
+      min_key = *btree_node_leaf_key(pager_get_page(pager, next_page_num), 0);
+      continue;
+    }
+    uint32_t end = first;
+    while (end < num_cells && *btree_node_leaf_key(node, end) <= max_key) {
+      end++;
+    }
+    if (end == first) {
+      cursor_close(cursor);
+      break;
+    }
 
-  log_debug("returning min_index %d...", min_index);
-  return min_index;
+    log_debug("deleting %d cells from leaf %d...", end - first, page_num);
+    uint32_t last_key = *btree_node_leaf_key(node, end - 1);
+    pager_mark_dirty(pager, page_num);
+    for (uint32_t i = end; i > first; i--) {
+      btree_node_leaf_free_overflow(pager, node, i - 1);
+      btree_node_leaf_remove_cell(node, i - 1);
+    }
+    num_deleted += end - first;
+    if (end == num_cells && first > 0) {
+      btree_node_update_max_key(cursor, *btree_node_leaf_key(node, first - 1));
+    }
+    btree_node_rebalance(cursor, cursor->depth);
+    cursor_close(cursor);
+    pager_unpin_all(pager);
+
+    if (last_key == max_key) {
+      break;
+    }
+    min_key = last_key + 1;
+  }
+  return num_deleted;
 }
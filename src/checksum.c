@@ -0,0 +1,139 @@
+#include "../include/checksum.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CHECKSUM_HAVE_SSE42 1
+#else
+#define CHECKSUM_HAVE_SSE42 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CHECKSUM_HAVE_ARM_CRC 1
+#else
+#define CHECKSUM_HAVE_ARM_CRC 0
+#endif
+
+// Reflected CRC32C polynomial
+static const uint32_t CHECKSUM_CRC32C_POLYNOMIAL = 0x82f63b78;
+
+// Tables for slicing-by-8: table[k][b] is the CRC of byte b followed by k
+// zero bytes, so eight bytes are folded with eight lookups
+static uint32_t checksum_table[8][256];
+
+__attribute__((constructor)) static void checksum_init_table(void) {
+  for (uint32_t byte = 0; byte < 256; byte++) {
+    uint32_t crc = byte;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (CHECKSUM_CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+    }
+    checksum_table[0][byte] = crc;
+  }
+  for (uint32_t byte = 0; byte < 256; byte++) {
+    for (int k = 1; k < 8; k++) {
+      uint32_t crc = checksum_table[k - 1][byte];
+      checksum_table[k][byte] = (crc >> 8) ^ checksum_table[0][crc & 0xff];
+    }
+  }
+}
+
+uint32_t checksum_crc32c_portable(uint32_t crc, const void *data, size_t size) {
+  const uint8_t *bytes = data;
+  crc = ~crc;
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    word ^= crc;
+    crc = checksum_table[7][word & 0xff] ^
+          checksum_table[6][(word >> 8) & 0xff] ^
+          checksum_table[5][(word >> 16) & 0xff] ^
+          checksum_table[4][(word >> 24) & 0xff] ^
+          checksum_table[3][(word >> 32) & 0xff] ^
+          checksum_table[2][(word >> 40) & 0xff] ^
+          checksum_table[1][(word >> 48) & 0xff] ^
+          checksum_table[0][word >> 56];
+    bytes += 8;
+    size -= 8;
+  }
+  while (size > 0) {
+    crc = (crc >> 8) ^ checksum_table[0][(crc ^ *bytes) & 0xff];
+    bytes++;
+    size--;
+  }
+  return ~crc;
+}
+
+#if CHECKSUM_HAVE_SSE42
+__attribute__((target("sse4.2"))) static uint32_t
+checksum_crc32c_sse42(uint32_t crc, const void *data, size_t size) {
+  const uint8_t *bytes = data;
+  uint64_t crc64 = ~crc;
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    bytes += 8;
+    size -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (size > 0) {
+    crc = _mm_crc32_u8(crc, *bytes);
+    bytes++;
+    size--;
+  }
+  return ~crc;
+}
+#endif
+
+#if CHECKSUM_HAVE_ARM_CRC
+static uint32_t checksum_crc32c_arm(uint32_t crc, const void *data,
+                                    size_t size) {
+  const uint8_t *bytes = data;
+  crc = ~crc;
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    crc = __crc32cd(crc, word);
+    bytes += 8;
+    size -= 8;
+  }
+  while (size > 0) {
+    crc = __crc32cb(crc, *bytes);
+    bytes++;
+    size--;
+  }
+  return ~crc;
+}
+#endif
+
+// The CPU is queried on every call, which costs a load and a test once the
+// compiler runtime has identified it at startup
+static bool checksum_have_sse42(void) {
+#if CHECKSUM_HAVE_SSE42
+  return __builtin_cpu_supports("sse4.2");
+#else
+  return false;
+#endif
+}
+
+uint32_t checksum_crc32c(uint32_t crc, const void *data, size_t size) {
+#if CHECKSUM_HAVE_ARM_CRC
+  return checksum_crc32c_arm(crc, data, size);
+#elif CHECKSUM_HAVE_SSE42
+  if (checksum_have_sse42()) {
+    return checksum_crc32c_sse42(crc, data, size);
+  }
+#endif
+  return checksum_crc32c_portable(crc, data, size);
+}
+
+const char *checksum_crc32c_implementation(void) {
+  if (CHECKSUM_HAVE_ARM_CRC) {
+    return "armv8 crc";
+  }
+  return checksum_have_sse42() ? "sse4.2" : "portable";
+}
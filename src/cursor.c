@@ -2,73 +2,566 @@
 #include "../include/btree.h"
 #include "../include/database.h"
 #include "../include/pager.h"
+#include "../include/row.h"
+#include "../include/search.h"
 #include "../lib/log/log.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+// Release the latches of the nodes of the path from depth from to depth to
+static void cursor_unlatch_path(Cursor *cursor, uint32_t from, uint32_t to) {
+  for (uint32_t depth = from; depth < to; depth++) {
+    pager_unlatch_page(cursor->database->pager, cursor->path[depth]);
+  }
+}
+
+// CursorRead is a node read without its latch or a pin, and the version of its
+// latch from before it was read
+typedef struct {
+  uint32_t page_num;
+  void *node;
+  PagerLatch *latch;
+  uint32_t version;
+} CursorRead;
+
+// Find a node to read, returns false while a thread modifies it, in which case
+// nothing may be read from it
+static bool cursor_read(Pager *pager, uint32_t page_num, CursorRead *read) {
+  read->page_num = page_num;
+  read->node =
+      pager_read_page(pager, page_num, &read->latch, &read->version);
+  return (read->version & 1) == 0;
+}
+
+// When a thread is still modifying a node, wait for it to finish instead of
+// reading the node again and again until then. The caller must not hold any
+// latch, nor be reading pages.
+static void cursor_read_wait(const CursorRead *read) {
+  if (pager_read_begin(read->latch) & 1) {
+    pager_read_wait(read->latch);
+  }
+}
+
+// Stop reading after a node, or the child read from it, changed. Returns false
+// for the caller to start over.
+static bool cursor_read_abort(Pager *pager, const CursorRead *read,
+                              const CursorRead *child) {
+  pager_read_exit(pager);
+  cursor_read_wait(read);
+  if (child != NULL) {
+    cursor_read_wait(child);
+  }
+  return false;
+}
+
+// Read child child_num of an internal node, or its right child when child_num
+// is past its keys, which sets child_num to the number of keys. The node is
+// checked before it is read, since the thread may have stopped reading to load
+// a page since it was found. The child is only read once the node is found
+// unchanged, and the node is checked again after the version of the child is
+// read, so that the child cannot have been split away from the node in
+// between. Returns false when the node changed or the child is being modified.
+static bool cursor_read_child(Pager *pager, const CursorRead *read,
+                              uint32_t *child_num, CursorRead *child) {
+  child->latch = NULL;
+  if (!pager_read_validate(read->latch, read->version)) {
+    return false;
+  }
+  BtreeLayout layout = btree_layout(pager->usable_size);
+  uint32_t num_keys = btree_node_internal_peek_num_keys(read->node, &layout);
+  if (*child_num > num_keys) {
+    *child_num = num_keys;
+  }
+  uint32_t child_page_num =
+      btree_node_internal_peek_child(read->node, num_keys, *child_num);
+  if (!pager_read_validate(read->latch, read->version)) {
+    return false;
+  }
+  return cursor_read(pager, child_page_num, child) &&
+         pager_read_validate(read->latch, read->version);
+}
+
+// Find the child to follow for a key in an internal node being read
+static uint32_t cursor_read_find_child(Pager *pager, const CursorRead *read,
+                                       uint32_t key) {
+  BtreeLayout layout = btree_layout(pager->usable_size);
+  return btree_node_internal_peek_find_child(
+      read->node, btree_node_internal_peek_num_keys(read->node, &layout), key);
+}
+
+// Latch a leaf that was read without its latch, once the thread stopped
+// reading. The cursor moves to it unless it changed in the meantime. Returns
+// whether it did not.
+static bool cursor_read_leaf(Cursor *cursor, const CursorRead *read) {
+  if (!pager_latch_unchanged(read->latch, read->version, PAGER_LATCH_SHARED)) {
+    cursor_read_wait(read);
+    return false;
+  }
+  cursor->page_num = read->page_num;
+  cursor->node = read->node;
+  return true;
+}
+
+static void cursor_check_depth(uint32_t depth) {
+  if (depth == CURSOR_MAX_DEPTH) {
+    log_error("tree is deeper than %d levels: corrupt file",
+              CURSOR_MAX_DEPTH);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Descend from the root to the leaf that holds the key without latching the
+// internal nodes on the way (optimistic lock coupling): every node is searched
+// between two reads of its version, and the descent starts over from the root
+// when one changed in between. Only the leaf is latched. Returns false when
+// the descent must start over.
+static bool cursor_descend_optimistic(Cursor *cursor, uint32_t key) {
+  Pager *pager = cursor->database->pager;
+  pager_read_enter(pager);
+  CursorRead read;
+  if (!cursor_read(pager, cursor->database->root_page_num, &read)) {
+    return cursor_read_abort(pager, &read, NULL);
+  }
+  cursor->depth = 0;
+  while (btree_node_peek_type(read.node) == BTREE_NODE_TYPE_INTERNAL) {
+    cursor_check_depth(cursor->depth);
+    uint32_t child_num = cursor_read_find_child(pager, &read, key);
+    CursorRead child;
+    if (!cursor_read_child(pager, &read, &child_num, &child)) {
+      return cursor_read_abort(pager, &read, &child);
+    }
+    cursor->path[cursor->depth] = read.page_num;
+    cursor->path_child_nums[cursor->depth] = child_num;
+    cursor->depth++;
+    read = child;
+  }
+  pager_read_exit(pager);
+  cursor->latched_depth = cursor->depth;
+  return cursor_read_leaf(cursor, &read);
+}
+
+// Descend to the leaf that holds the key, or the rightmost leaf, for the
+// thread that modifies the database. No other thread changes the tree, so the
+// nodes are read without their latch, then the nodes that a split of the leaf
+// would modify are latched from the top down: the leaf and its ancestors up to
+// the first one with room for one more key, since a split stops there.
+static void cursor_descend_exclusive(Cursor *cursor, uint32_t key,
+                                     bool rightmost) {
+  Pager *pager = cursor->database->pager;
+  BtreeLayout layout = btree_layout(pager->usable_size);
+  uint32_t page_num = cursor->database->root_page_num;
+  void *node = pager_get_page(pager, page_num);
+  void *nodes[CURSOR_MAX_DEPTH + 1];
+  cursor->depth = 0;
+  while (btree_node_get_type(node) == BTREE_NODE_TYPE_INTERNAL) {
+    cursor_check_depth(cursor->depth);
+    uint32_t child_index = rightmost ? *btree_node_internal_num_keys(node)
+                                     : btree_node_internal_find_child(node, key);
+    cursor->path[cursor->depth] = page_num;
+    cursor->path_child_nums[cursor->depth] = child_index;
+    nodes[cursor->depth] = node;
+    cursor->depth++;
+    page_num = *btree_node_internal_child(node, child_index);
+    node = pager_get_page(pager, page_num);
+  }
+  nodes[cursor->depth] = node;
+
+  uint32_t top = cursor->depth;
+  while (top > 0 && !btree_node_has_room(nodes[top], &layout)) {
+    top--;
+  }
+  for (uint32_t depth = top; depth < cursor->depth; depth++) {
+    pager_latch_page(pager, cursor->path[depth], PAGER_LATCH_EXCLUSIVE);
+  }
+  cursor->page_num = page_num;
+  cursor->node = pager_latch_page(pager, page_num, PAGER_LATCH_EXCLUSIVE);
+  cursor->latched_depth = top;
+}
+
+// Create a cursor at the leaf that holds the key, or the rightmost leaf, with
+// the leaf latched in the given mode
+static Cursor *cursor_descend(Database *database, uint32_t key,
+                              PagerLatchMode mode, bool rightmost) {
+  log_debug("allocating cursor...");
+  Cursor *cursor = malloc(sizeof(Cursor));
+  cursor->database = database;
+  cursor->end_of_table = false;
+  cursor->start_key = 0;
+  cursor->end_key = UINT32_MAX;
+  cursor->latch_mode = mode;
+
+  if (mode == PAGER_LATCH_EXCLUSIVE) {
+    cursor_descend_exclusive(cursor, key, rightmost);
+  } else {
+    while (!cursor_descend_optimistic(cursor, key)) {
+      log_debug("restarting search for key %d...", key);
+    }
+  }
+
+  uint32_t num_cells = *btree_node_leaf_num_cells(cursor->node);
+  cursor->cell_num =
+      rightmost ? num_cells
+                : search_lower_bound(btree_node_leaf_key(cursor->node, 0),
+                                     num_cells, BTREE_NODE_LEAF_SLOT_SIZE, key);
+  log_debug("setting cursor at index %d of page %d...", cursor->cell_num,
+            cursor->page_num);
+  return cursor;
+}
+
+// Move the path of a cursor to the leaf after the current one: the deepest
+// node of the path with a child after the one followed takes that child, and
+// the first children are followed down from there. The nodes are read without
+// their latch, and the cursor holds the latch of a leaf below them, so it
+// does not wait for a node that is being modified. Returns the page number of
+// the leaf, 0 when there is none or a node changed while it was read.
+static uint32_t cursor_path_read_next(Cursor *cursor) {
+  Pager *pager = cursor->database->pager;
+  BtreeLayout layout = btree_layout(pager->usable_size);
+  uint32_t depth = cursor->depth;
+  uint32_t page_num = 0;
+  while (depth > 0 && page_num == 0) {
+    CursorRead read;
+    bool internal =
+        cursor_read(pager, cursor->path[depth - 1], &read) &&
+        btree_node_peek_type(read.node) == BTREE_NODE_TYPE_INTERNAL;
+    uint32_t child_num = cursor->path_child_nums[depth - 1];
+    if (internal) {
+      uint32_t num_keys =
+          btree_node_internal_peek_num_keys(read.node, &layout);
+      if (child_num < num_keys) {
+        page_num =
+            btree_node_internal_peek_child(read.node, num_keys, child_num + 1);
+      }
+    }
+    bool valid = internal && pager_read_validate(read.latch, read.version);
+    if (!valid) {
+      return 0;
+    }
+    if (page_num != 0) {
+      cursor->path_child_nums[depth - 1]++;
+    } else {
+      depth--;
+    }
+  }
+  if (page_num == 0) {
+    return 0;
+  }
+
+  for (; depth < cursor->depth; depth++) {
+    CursorRead read;
+    bool internal = cursor_read(pager, page_num, &read) &&
+                    btree_node_peek_type(read.node) == BTREE_NODE_TYPE_INTERNAL;
+    uint32_t child_page_num =
+        internal ? btree_node_internal_peek_child(
+                       read.node,
+                       btree_node_internal_peek_num_keys(read.node, &layout), 0)
+                 : 0;
+    bool valid = internal && pager_read_validate(read.latch, read.version);
+    if (!valid) {
+      return 0;
+    }
+    cursor->path[depth] = page_num;
+    cursor->path_child_nums[depth] = 0;
+    page_num = child_page_num;
+  }
+  return page_num;
+}
+
+static uint32_t cursor_path_next(Cursor *cursor) {
+  Pager *pager = cursor->database->pager;
+  pager_read_enter(pager);
+  uint32_t page_num = cursor_path_read_next(cursor);
+  pager_read_exit(pager);
+  return page_num;
+}
+
+// Move to the first cell of the leaf after the current one, returns false at
+// the last leaf. The next leaf is latched before the current one is released,
+// so that rows cannot move past the cursor in between.
+static bool cursor_next_leaf(Cursor *cursor) {
+  Pager *pager = cursor->database->pager;
+  uint32_t next_page_num = *btree_node_leaf_next(cursor->node);
+  if (next_page_num == 0) {
+    return false;
+  }
+  void *next = pager_latch_page(pager, next_page_num, cursor->latch_mode);
+  pager_unlatch_page(pager, cursor->page_num);
+  cursor->page_num = next_page_num;
+  cursor->node = next;
+  cursor->cell_num = 0;
+
+  // Leaves split by another thread are not in the path, which is dropped
+  if (cursor->depth > 0 && cursor_path_next(cursor) != next_page_num) {
+    log_debug("path of cursor no longer leads to page %d...", next_page_num);
+    cursor->depth = 0;
+    cursor->latched_depth = 0;
+  }
+  return true;
+}
+
 // Get cell 0 of the leftmost leaf node
 Cursor *cursor_start(Database *database) {
   log_debug("allocating cursor at start of database...");
-  Cursor *cursor = cursor_find_key(database, 0);
+  Cursor *cursor = cursor_seek(database, 0);
+  pager_readahead(database->pager, cursor->page_num);
+
+  return cursor;
+}
+
+// The search ends one past the last cell of a leaf when the key is larger
+// than every key in it, the row is then the first one of the next leaf
+Cursor *cursor_seek(Database *database, uint32_t key) {
+  log_debug("seeking key %d...", key);
+  Cursor *cursor = cursor_descend(database, key, PAGER_LATCH_SHARED, false);
+  while (cursor->cell_num >= *btree_node_leaf_num_cells(cursor->node)) {
+    if (!cursor_next_leaf(cursor)) {
+      log_debug("no key from %d...", key);
+      cursor->end_of_table = true;
+      break;
+    }
+  }
+  return cursor;
+}
+
+// Move to the last row with a key smaller than the given one, or to the end of
+// the database when there is none. The row is before the position of the key
+// in its leaf, or it is the last row of the rightmost leaf under the child
+// before the one followed in the deepest node where there is one. The nodes
+// are read as in cursor_descend_optimistic(), and kept with their version
+// until the leaf is found so that the search can go back up to that node.
+// Leaves other than the root are never empty, so the leaf found holds a row.
+// Returns false when a node changed and the search must start over.
+static bool cursor_seek_before_optimistic(Cursor *cursor, uint32_t key) {
+  Pager *pager = cursor->database->pager;
+  CursorRead reads[CURSOR_MAX_DEPTH];
+  uint32_t depth = 0;
+  uint32_t branch_depth = 0;
+  pager_read_enter(pager);
+  CursorRead read;
+  if (!cursor_read(pager, cursor->database->root_page_num, &read)) {
+    return cursor_read_abort(pager, &read, NULL);
+  }
+  while (btree_node_peek_type(read.node) == BTREE_NODE_TYPE_INTERNAL) {
+    cursor_check_depth(depth);
+    uint32_t child_num = cursor_read_find_child(pager, &read, key);
+    CursorRead child;
+    if (!cursor_read_child(pager, &read, &child_num, &child)) {
+      return cursor_read_abort(pager, &read, &child);
+    }
+    cursor->path[depth] = read.page_num;
+    cursor->path_child_nums[depth] = child_num;
+    reads[depth] = read;
+    depth++;
+    if (child_num > 0) {
+      branch_depth = depth;
+    }
+    read = child;
+  }
+  pager_read_exit(pager);
+  if (!cursor_read_leaf(cursor, &read)) {
+    return false;
+  }
+
+  uint32_t cell_num =
+      search_lower_bound(btree_node_leaf_key(cursor->node, 0),
+                         *btree_node_leaf_num_cells(cursor->node),
+                         BTREE_NODE_LEAF_SLOT_SIZE, key);
+  if (cell_num > 0 || branch_depth == 0) {
+    cursor->depth = depth;
+    cursor->latched_depth = depth;
+    cursor->cell_num = cell_num > 0 ? cell_num - 1 : 0;
+    if (cell_num == 0) {
+      log_debug("cursor is at start of database...");
+      cursor->end_of_table = true;
+    }
+    return true;
+  }
+
+  pager_unlatch_page(pager, cursor->page_num);
+  depth = branch_depth - 1;
+  read = reads[depth];
+  uint32_t child_num = cursor->path_child_nums[depth] - 1;
+  pager_read_enter(pager);
+  while (true) {
+    CursorRead child;
+    if (!cursor_read_child(pager, &read, &child_num, &child)) {
+      return cursor_read_abort(pager, &read, &child);
+    }
+    cursor->path[depth] = read.page_num;
+    cursor->path_child_nums[depth] = child_num;
+    depth++;
+    read = child;
+    if (btree_node_peek_type(read.node) != BTREE_NODE_TYPE_INTERNAL) {
+      break;
+    }
+    cursor_check_depth(depth);
+    child_num = UINT32_MAX;
+  }
+  pager_read_exit(pager);
+  if (!cursor_read_leaf(cursor, &read)) {
+    return false;
+  }
+  cursor->depth = depth;
+  cursor->latched_depth = depth;
+  cursor->cell_num = *btree_node_leaf_num_cells(cursor->node) - 1;
+  return true;
+}
 
-  log_debug("getting root node...");
-  void *node = pager_get_page(database->pager, cursor->page_num);
+// The cursor holds no latch when it is called
+static void cursor_seek_before(Cursor *cursor, uint32_t key) {
+  log_debug("seeking last key before %d...", key);
+  while (!cursor_seek_before_optimistic(cursor, key)) {
+    log_debug("restarting search for the key before %d...", key);
+  }
+}
+
+// The search ends at the first key larger than the given key, the row before
+// it may then be the last one of the leaf before
+Cursor *cursor_seek_last(Database *database, uint32_t key) {
+  log_debug("seeking last key up to %d...", key);
+  Cursor *cursor = cursor_descend(database, key, PAGER_LATCH_SHARED, false);
+  if (cursor->cell_num < *btree_node_leaf_num_cells(cursor->node) &&
+      *btree_node_leaf_key(cursor->node, cursor->cell_num) == key) {
+    return cursor;
+  }
+  if (cursor->cell_num > 0) {
+    cursor->cell_num--;
+  } else {
+    pager_unlatch_page(database->pager, cursor->page_num);
+    cursor_seek_before(cursor, key);
+  }
+  return cursor;
+}
+
+void cursor_set_bounds(Cursor *cursor, uint32_t start_key, uint32_t end_key) {
+  cursor->start_key = start_key;
+  cursor->end_key = end_key;
+  if (!cursor->end_of_table) {
+    uint32_t key = cursor_key(cursor);
+    cursor->end_of_table = key < start_key || key > end_key;
+  }
+}
+
+// A key larger than every key of the tree belongs at the end of the rightmost
+// leaf. The cached leaf is still the rightmost one as long as it is a leaf
+// without a next leaf, otherwise the tree is searched from the root. The path
+// to it follows the right child of every node, without searching them. The
+// cached leaf is read before it is latched, which is safe since only the
+// thread that modifies the database uses it.
+static Cursor *cursor_find_append(Database *database, uint32_t key) {
+  uint32_t page_num = database->rightmost_leaf_page_num;
+  if (page_num == 0) {
+    return NULL;
+  }
+  void *node = pager_get_page(database->pager, page_num);
+  if (btree_node_get_type(node) != BTREE_NODE_TYPE_LEAF ||
+      *btree_node_leaf_next(node) != 0) {
+    return NULL;
+  }
   uint32_t num_cells = *btree_node_leaf_num_cells(node);
-  cursor->end_of_table = (num_cells == 0);
+  if (num_cells == 0 || key <= *btree_node_leaf_key(node, num_cells - 1)) {
+    return NULL;
+  }
 
+  log_debug("appending key %d to rightmost leaf %d...", key, page_num);
+  Cursor *cursor = cursor_descend(database, key, PAGER_LATCH_EXCLUSIVE, true);
+  if (cursor->page_num != page_num) {
+    cursor_close(cursor);
+    return NULL;
+  }
+  cursor->end_of_table = true;
   return cursor;
 }
 
 // Search the tree for the given key.
 Cursor *cursor_find_key(Database *database, uint32_t key) {
   log_debug("finding key %d...", key);
-  uint32_t root_page_num = database->root_page_num;
-  void *root_node = pager_get_page(database->pager, root_page_num);
+  Cursor *cursor = cursor_find_append(database, key);
+  if (cursor != NULL) {
+    return cursor;
+  }
 
-  if (btree_node_get_type(root_node) == BTREE_NODE_TYPE_LEAF) {
-    log_debug("searching leaf node...");
-    return btree_node_leaf_find(database, key, root_page_num);
+  cursor = cursor_descend(database, key, PAGER_LATCH_EXCLUSIVE, false);
+  if (*btree_node_leaf_next(cursor->node) == 0) {
+    database->rightmost_leaf_page_num = cursor->page_num;
   }
+  return cursor;
+}
 
-  log_debug("searching internal node...");
-  return btree_node_internal_find(database, key, root_page_num);
+// Tell the pager that the scan has moved to the leaf of the cursor. When leaves
+// are not laid out in order in the file, the parent of the leaf still lists
+// the next ones, so they are read ahead from there.
+static void cursor_readahead(Cursor *cursor) {
+  Pager *pager = cursor->database->pager;
+  if (pager_readahead(pager, cursor->page_num)) {
+    return;
+  }
+
+  uint32_t page_nums[PAGER_READAHEAD_MIN_PAGES];
+  uint32_t count = btree_node_leaf_next_siblings(cursor, page_nums,
+                                                 PAGER_READAHEAD_MIN_PAGES);
+  pager_prefetch(pager, page_nums, count);
 }
 
 void cursor_advance(Cursor *cursor) {
   log_debug("advancing cursor to page %d...", cursor->page_num);
-  uint32_t page_num = cursor->page_num;
-  void *node = pager_get_page(cursor->database->pager, page_num);
-
   cursor->cell_num += 1;
-  if (cursor->cell_num >= (*btree_node_leaf_num_cells(node))) {
+  if (cursor->cell_num >= (*btree_node_leaf_num_cells(cursor->node))) {
     log_debug("advancing to next page...");
-    uint32_t next_page_num = *btree_node_leaf_next(node);
-    if (next_page_num == 0) {
+    if (!cursor_next_leaf(cursor)) {
       log_debug("cursor is at end of database...");
       cursor->end_of_table = true;
     } else {
       log_debug("cursor is not at end of database...");
-      cursor->page_num = next_page_num;
-      cursor->cell_num = 0;
+      cursor_readahead(cursor);
     }
   }
+  if (!cursor->end_of_table && cursor_key(cursor) > cursor->end_key) {
+    log_debug("cursor is past its end key...");
+    cursor->end_of_table = true;
+  }
+}
+
+// The leaf before is found from the root, the cursor releases its leaf first
+// since no latch is taken on a node above a latched one
+void cursor_retreat(Cursor *cursor) {
+  log_debug("retreating cursor from page %d...", cursor->page_num);
+  if (cursor->cell_num > 0) {
+    cursor->cell_num -= 1;
+  } else {
+    log_debug("retreating to previous page...");
+    uint32_t key = *btree_node_leaf_key(cursor->node, 0);
+    pager_unlatch_page(cursor->database->pager, cursor->page_num);
+    cursor_seek_before(cursor, key);
+  }
+  if (!cursor->end_of_table && cursor_key(cursor) < cursor->start_key) {
+    log_debug("cursor is before its start key...");
+    cursor->end_of_table = true;
+  }
 }
 
 // The database is a tree, therefore we identify a position by the page number
 // of the node, and the cell number within that node.
 void *cursor_value(Cursor *cursor) {
-  log_debug("getting cursor value...");
-  uint32_t page_num = cursor->page_num;
-  void *page = pager_get_page(cursor->database->pager, page_num);
+  log_debug("getting node value from page %d...", cursor->page_num);
+  return btree_node_leaf_value(cursor->node, cursor->cell_num);
+}
 
-  log_debug("getting node value from page %d...", page_num);
+uint32_t cursor_key(Cursor *cursor) {
+  return *btree_node_leaf_key(cursor->node, cursor->cell_num);
+}
 
-  return btree_node_leaf_value(page, cursor->cell_num);
+void cursor_row(Cursor *cursor, Row *row) {
+  log_debug("getting cursor row...");
+  btree_node_leaf_row(cursor->database->pager, cursor->node, cursor->cell_num,
+                      row);
 }
 
 void cursor_close(Cursor *cursor) {
   log_debug("freeing cursor...");
+  pager_unlatch_page(cursor->database->pager, cursor->page_num);
+  cursor_unlatch_path(cursor, cursor->latched_depth, cursor->depth);
   free(cursor);
   log_debug("cursor freed");
 }
@@ -1,16 +1,169 @@
 #include "../include/database.h"
 #include "../include/btree.h"
+#include "../include/cursor.h"
 #include "../include/pager.h"
+#include "../include/row.h"
 #include "../lib/log/log.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
+
+// Rows of format 2 and older have fixed-size columns
+static const uint32_t DATABASE_V2_ROW_USERNAME_SIZE = 33;
+static const uint32_t DATABASE_V2_ROW_EMAIL_SIZE = 256;
+static const uint32_t DATABASE_V2_ROW_USERNAME_OFFSET = sizeof(uint32_t);
+static const uint32_t DATABASE_V2_ROW_EMAIL_OFFSET =
+    DATABASE_V2_ROW_USERNAME_OFFSET + DATABASE_V2_ROW_USERNAME_SIZE;
+static const uint32_t DATABASE_V2_ROW_SIZE =
+    DATABASE_V2_ROW_EMAIL_OFFSET + DATABASE_V2_ROW_EMAIL_SIZE;
+
+// Leaves of format 1, and of files without a header, hold cells of a key and a
+// row one after the other after a shorter header
+static const uint32_t DATABASE_V1_LEAF_HEADER_SIZE = 14;
+static const uint32_t DATABASE_V1_LEAF_CELL_SIZE =
+    sizeof(uint32_t) + DATABASE_V2_ROW_SIZE;
+
+static void database_upgrade_fixed_row(void *source, Row *row) {
+  memcpy(&row->id, source, sizeof(uint32_t));
+  memcpy(row->username, source + DATABASE_V2_ROW_USERNAME_OFFSET,
+         DATABASE_V2_ROW_USERNAME_SIZE);
+  memcpy(row->email, source + DATABASE_V2_ROW_EMAIL_OFFSET,
+         DATABASE_V2_ROW_EMAIL_SIZE);
+  row->username[DATABASE_V2_ROW_USERNAME_SIZE - 1] = '\0';
+  row->email[DATABASE_V2_ROW_EMAIL_SIZE - 1] = '\0';
+}
+
+// Rows of format 3 are compact, but the lengths of the username and the email
+// take one byte each
+static void database_upgrade_compact_row(const uint8_t *source, Row *row) {
+  uint32_t size = 0;
+  uint32_t shift = 0;
+  row->id = 0;
+  do {
+    row->id |= (uint32_t)(source[size] & 0x7f) << shift;
+    shift += 7;
+  } while (source[size++] & 0x80 && size < ROW_ID_MAX_SIZE);
+
+  uint8_t username_length = source[size++];
+  if (username_length > ROW_COLUMN_USERNAME_SIZE) {
+    log_error("username of %d bytes is too long: corrupt file",
+              username_length);
+    exit(EXIT_FAILURE);
+  }
+  memcpy(row->username, source + size, username_length);
+  row->username[username_length] = '\0';
+  size += username_length;
+
+  uint8_t email_length = source[size++];
+  memcpy(row->email, source + size, email_length);
+  row->email[email_length] = '\0';
+}
+
+// Files written before the header existed keep the root of the B-tree in the
+// first page. The root is moved to a new page at the end of the file to make
+// room for the header. The other pages were written without checksums, so the
+// file keeps going without them.
+static void database_upgrade_header(Database *database) {
+  Pager *pager = database->pager;
+  uint32_t root_page_num = pager->num_pages;
+  log_info("moving root to page %d to make room for the file header...",
+           root_page_num);
+
+  void *old_root = pager_get_page(pager, PAGER_HEADER_PAGE_NUM);
+  void *root = pager_get_page(pager, root_page_num);
+  memcpy(root, old_root, pager->page_size);
+  pager_mark_dirty(pager, root_page_num);
+
+  memset(old_root, 0, pager->page_size);
+  pager_init_header(pager, PAGER_CHECKSUM_NONE);
+  pager->header.root_page_num = root_page_num;
+}
+
+// Leaves of older formats are converted to slotted leaves of compact rows. The
+// rows of each leaf are inserted again into the emptied leaf, which splits it
+// if they no longer fit.
+// Leaves are converted from the last one, so that the largest key of every
+// node on the right of the one being converted is read from a converted leaf.
+static void database_upgrade_leaves(Database *database, uint32_t version) {
+  Pager *pager = database->pager;
+  uint32_t page_num = database->root_page_num;
+  void *node = pager_get_page(pager, page_num);
+  while (btree_node_get_type(node) == BTREE_NODE_TYPE_INTERNAL) {
+    page_num = *btree_node_internal_child(node, 0);
+    node = pager_get_page(pager, page_num);
+  }
+
+  uint32_t num_leaves = 0;
+  uint32_t *leaves = malloc(pager->num_pages * sizeof(uint32_t));
+  while (page_num != 0) {
+    leaves[num_leaves++] = page_num;
+    page_num = *btree_node_leaf_next(pager_get_page(pager, page_num));
+  }
+  log_info("converting %d leaves...", num_leaves);
+
+  void *copy = malloc(pager->page_size);
+  for (uint32_t i = num_leaves; i > 0; i--) {
+    page_num = leaves[i - 1];
+    node = pager_get_page(pager, page_num);
+    memcpy(copy, node, pager->page_size);
+    pager_mark_dirty(pager, page_num);
+
+    uint32_t num_cells = *btree_node_leaf_num_cells(copy);
+    btree_node_leaf_init(node, pager->usable_size);
+    btree_node_set_root(node, btree_node_is_root(copy));
+    *btree_node_leaf_next(node) = *btree_node_leaf_next(copy);
+
+    for (uint32_t cell_num = 0; cell_num < num_cells; cell_num++) {
+      uint32_t key;
+      Row row;
+      if (version < 2) {
+        void *cell = copy + DATABASE_V1_LEAF_HEADER_SIZE +
+                     (size_t)cell_num * DATABASE_V1_LEAF_CELL_SIZE;
+        key = *(uint32_t *)cell;
+        database_upgrade_fixed_row(cell + sizeof(uint32_t), &row);
+      } else if (version < 3) {
+        key = *btree_node_leaf_key(copy, cell_num);
+        database_upgrade_fixed_row(btree_node_leaf_value(copy, cell_num), &row);
+      } else {
+        key = *btree_node_leaf_key(copy, cell_num);
+        database_upgrade_compact_row(btree_node_leaf_value(copy, cell_num),
+                                     &row);
+      }
+      Cursor *cursor = cursor_find_key(database, key);
+      btree_node_leaf_insert(cursor, key, &row);
+      cursor_close(cursor);
+    }
+  }
+  free(copy);
+  free(leaves);
+}
+
+static void database_upgrade(Database *database) {
+  Pager *pager = database->pager;
+  uint32_t version = pager->header.version;
+  if (version == 0) {
+    database_upgrade_header(database);
+  }
+  database->root_page_num = pager->header.root_page_num;
+
+  log_info("upgrading database from format %d to %d...", version,
+           PAGER_FORMAT_VERSION);
+  if (version < 4) {
+    database_upgrade_leaves(database, version);
+  }
+
+  pager->header.version = PAGER_FORMAT_VERSION;
+  pager->header.root_page_num = database->root_page_num;
+  pager_write_header(pager);
+  pager_commit(pager);
+}
 
 // Opens a connection to the database by opening the database file and
 // initializing a pager and a database data structure
-Database *database_open(const char *filename) {
-  Pager *pager = pager_open(filename);
+Database *database_open(const char *filename, const PagerConfig *config) {
+  Pager *pager = pager_open(filename, config);
   if (pager == NULL) {
     log_error("failed to open database file %s", filename);
     return NULL;
@@ -19,14 +172,28 @@ Database *database_open(const char *filename) {
   log_debug("allocating database...");
   Database *database = malloc(sizeof(Database));
   database->pager = pager;
-  database->root_page_num = 0;
+  database->rightmost_leaf_page_num = 0;
+  pthread_rwlock_init(&database->tree_latch, NULL);
+  pthread_mutex_init(&database->writer_latch, NULL);
 
   if (pager->num_pages == 0) {
+    pager_init_header(pager, PAGER_CHECKSUM_CRC32C);
+  } else if (pager->header.version < PAGER_FORMAT_VERSION) {
+    database_upgrade(database);
+  }
+
+  if (pager->header.root_page_num == 0) {
     log_debug("database file is empty, initializing new database...");
-    void *root_node = pager_get_page(pager, 0);
-    btree_node_leaf_init(root_node);
+    uint32_t root_page_num = pager_get_unused_page_num(pager);
+    void *root_node = pager_get_page(pager, root_page_num);
+    btree_node_leaf_init(root_node, pager->usable_size);
     btree_node_set_root(root_node, true);
+    pager_mark_dirty(pager, root_page_num);
+    pager->header.root_page_num = root_page_num;
+    pager_write_header(pager);
+    pager_commit(pager);
   }
+  database->root_page_num = pager->header.root_page_num;
 
   return database;
 }
@@ -36,49 +203,38 @@ Database *database_open(const char *filename) {
 DatabaseResult database_close(Database *database) {
   log_debug("closing database...");
 
-  Pager *pager = database->pager;
-
-  log_debug("flushing %d pages...", pager->num_pages);
-  for (uint32_t i = 0; i < pager->num_pages; i++) {
-    if (pager->pages[i] == NULL) {
-      log_debug("page %d is empty, skipping...", i);
-      continue;
-    }
-
-    log_debug("flushing page %d...", i);
-    pager_flush(pager, i);
-
-    log_debug("freeing page %d...", i);
-    free(pager->pages[i]);
-
-    log_debug("setting page %d to NULL...", i);
-    pager->pages[i] = NULL;
-  }
-
-  log_debug("closing file descriptor...");
-  int result = close(pager->file_descriptor);
-  if (result == -1) {
-    log_error("failed to close db file: %m");
+  log_debug("closing pager...");
+  if (pager_close(database->pager) == -1) {
     return DATABASE_CLOSE_FAIL;
   }
 
-  log_debug("freeing pages...");
-  for (uint32_t i = 0; i < PAGER_MAX_PAGES; i++) {
-    void *page = pager->pages[i];
-    if (page) {
-      log_debug("freeing page %d...", i);
-      free(page);
-
-      log_debug("setting page %d to NULL...", i);
-      pager->pages[i] = NULL;
-    }
-  }
-
-  log_debug("freeing pager...");
-  free(pager);
-
   log_debug("freeing database...");
+  pthread_rwlock_destroy(&database->tree_latch);
+  pthread_mutex_destroy(&database->writer_latch);
   free(database);
 
   return DATABASE_CLOSE_SUCCESS;
 }
+
+// Every writer takes the writer latch before the tree latch, so writers never
+// wait for each other while holding the tree latch
+// Memory-mapped pages have no latches, so statements take turns there
+void database_latch(Database *database, DatabaseLatchMode mode) {
+  log_debug("latching database...");
+  if (mode != DATABASE_LATCH_READ) {
+    pthread_mutex_lock(&database->writer_latch);
+  }
+  if (mode == DATABASE_LATCH_EXCLUSIVE || database->pager->map != NULL) {
+    pthread_rwlock_wrlock(&database->tree_latch);
+  } else {
+    pthread_rwlock_rdlock(&database->tree_latch);
+  }
+}
+
+void database_unlatch(Database *database, DatabaseLatchMode mode) {
+  log_debug("unlatching database...");
+  pthread_rwlock_unlock(&database->tree_latch);
+  if (mode != DATABASE_LATCH_READ) {
+    pthread_mutex_unlock(&database->writer_latch);
+  }
+}
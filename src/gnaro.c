@@ -1,6 +1,8 @@
 #include "../include/database.h"
 #include "../include/input.h"
+#include "../include/load.h"
 #include "../include/meta.h"
+#include "../include/pager.h"
 #include "../include/statement.h"
 #include "../lib/argtable/argtable3.h"
 #include "../lib/log/log.h"
@@ -15,8 +17,10 @@ enum {
 };
 
 struct arg_lit *help, *version;
-struct arg_str *dbf;
-struct arg_lit *vrb;
+struct arg_str *dbf, *load;
+struct arg_lit *vrb, *mmap_mode, *async_io, *skip_verify;
+struct arg_int *cache, *page_size;
+struct arg_int *commit_batch, *commit_delay, *fill_factor;
 struct arg_end *end;
 
 int main(int argc, char **argv) {
@@ -28,6 +32,28 @@ int main(int argc, char **argv) {
       dbf =
           arg_strn("d", "database", "<string>", 1, 1, "path to database file"),
       vrb = arg_litn("v", "verbosity", 0, 1, "verbose output"),
+      cache = arg_intn("c", "cache-pages", "<n>", 0, 1,
+                       "number of pages kept in the buffer pool"),
+      page_size = arg_intn("p", "page-size", "<bytes>", 0, 1,
+                           "page size of a new database, a power of two "
+                           "from 4096 to 65536"),
+      mmap_mode = arg_litn("m", "mmap", 0, 1,
+                           "memory-map the database file instead of caching "
+                           "pages in the buffer pool"),
+      async_io = arg_litn("a", "async-io", 0, 1,
+                          "batch page reads and writes through io_uring"),
+      skip_verify = arg_litn(NULL, "skip-verify", 0, 1,
+                             "trust the database file and skip verifying "
+                             "page checksums"),
+      commit_batch = arg_intn(NULL, "commit-batch", "<n>", 0, 1,
+                              "number of commits synced together"),
+      commit_delay =
+          arg_intn(NULL, "commit-delay", "<ms>", 0, 1,
+                   "maximum time a commit waits for its group to be synced"),
+      load = arg_strn("l", "load", "<file>", 0, 1,
+                      "bulk load rows from a file into an empty database"),
+      fill_factor = arg_intn(NULL, "fill-factor", "<percent>", 0, 1,
+                             "percentage of every page filled by a bulk load"),
       end = arg_end(ARGTABLE_ARG_MAX),
   };
 
@@ -61,18 +87,88 @@ int main(int argc, char **argv) {
     log_set_level(LOG_TRACE);
   }
 
+  PagerConfig config = {
+      .cache_pages = PAGER_DEFAULT_CACHE_PAGES,
+      .mmap = mmap_mode->count > 0,
+      .async_io = async_io->count > 0,
+      .skip_verify = skip_verify->count > 0,
+      .wal = {.max_batch = WAL_DEFAULT_MAX_BATCH,
+              .max_delay_ms = WAL_DEFAULT_MAX_DELAY_MS},
+  };
+  if (cache->count > 0) {
+    if (cache->ival[0] <= 0) {
+      printf("%s: cache size must be greater than zero.\n", progname);
+      exitcode = 1;
+      goto exithard;
+    }
+    config.cache_pages = cache->ival[0];
+  }
+  if (page_size->count > 0) {
+    if (page_size->ival[0] <= 0 || !pager_page_size_valid(page_size->ival[0])) {
+      printf("%s: page size must be a power of two from %d to %d.\n",
+             progname, PAGER_MIN_PAGE_SIZE, PAGER_MAX_PAGE_SIZE);
+      exitcode = 1;
+      goto exithard;
+    }
+    config.page_size = page_size->ival[0];
+  }
+  if (commit_batch->count > 0) {
+    if (commit_batch->ival[0] <= 0) {
+      printf("%s: commit batch must be greater than zero.\n", progname);
+      exitcode = 1;
+      goto exithard;
+    }
+    config.wal.max_batch = commit_batch->ival[0];
+  }
+  if (commit_delay->count > 0) {
+    if (commit_delay->ival[0] < 0) {
+      printf("%s: commit delay must not be negative.\n", progname);
+      exitcode = 1;
+      goto exithard;
+    }
+    config.wal.max_delay_ms = commit_delay->ival[0];
+  }
+
+  LoadConfig load_config = {0};
+  if (fill_factor->count > 0) {
+    if (fill_factor->ival[0] < LOAD_MIN_FILL_FACTOR ||
+        fill_factor->ival[0] > LOAD_MAX_FILL_FACTOR) {
+      printf("%s: fill factor must be from %d to %d percent.\n", progname,
+             LOAD_MIN_FILL_FACTOR, LOAD_MAX_FILL_FACTOR);
+      exitcode = 1;
+      goto exithard;
+    }
+    load_config.fill_factor = fill_factor->ival[0];
+  }
+
   log_debug("starting gnaro repl...");
 
   InputBuffer *input_buffer = input_new_buffer();
-  Database *database = database_open(dbf->sval[0]);
+  Database *database = database_open(dbf->sval[0], &config);
   if (database == NULL) {
     log_error("failed to open database file %s", dbf->sval[0]);
     exitcode = 1;
     goto cleanup;
   }
 
+  if (load->count > 0) {
+    log_info("loading %s...", load->sval[0]);
+    if (meta_load(database, load->sval[0], &load_config) != LOAD_SUCCESS) {
+      exitcode = 1;
+      goto cleanup;
+    }
+  }
+
   // Start REPL loop
   while (true) {
+    // Commits waiting for their group are made durable before waiting for
+    // the user, pipelined input keeps filling the group instead. Statements
+    // reported as executed meanwhile are durable once the log flusher syncs
+    // their group, at most --commit-delay later.
+    if (!input_pending()) {
+      pager_sync(database->pager);
+    }
+
     printf("gnaro> ");
 
     if (input_read(input_buffer) < 0) {
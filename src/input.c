@@ -1,8 +1,11 @@
 #include "../include/input.h"
 #include "../lib/log/log.h"
+#include <poll.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 InputBuffer *input_new_buffer(void) {
   log_debug("creating new input buffer...");
@@ -32,6 +35,13 @@ int input_read(InputBuffer *input_buffer) {
   return 0;
 }
 
+// Input that has already been buffered by stdio is not visible to poll(), so
+// this may report no input while lines are still buffered, never the opposite
+bool input_pending(void) {
+  struct pollfd stdin_poll = {.fd = STDIN_FILENO, .events = POLLIN};
+  return poll(&stdin_poll, 1, 0) > 0;
+}
+
 void input_close_buffer(InputBuffer *input_buffer) {
   log_debug("closing input buffer...");
   free(input_buffer->buffer);
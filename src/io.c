@@ -0,0 +1,352 @@
+#include "../include/io.h"
+#include "../lib/log/log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define IO_HAVE_URING 1
+#else
+#define IO_HAVE_URING 0
+#endif
+
+ssize_t io_read_at(int fd, void *buffer, size_t size, off_t offset) {
+  size_t total = 0;
+  while (total < size) {
+    ssize_t bytes_read = pread(fd, buffer + total, size - total,
+                               offset + (off_t)total);
+    if (bytes_read == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (bytes_read == 0) {
+      log_debug("end of file after %zu bytes...", total);
+      break;
+    }
+    total += (size_t)bytes_read;
+  }
+  return (ssize_t)total;
+}
+
+ssize_t io_write_at(int fd, const void *buffer, size_t size, off_t offset) {
+  size_t total = 0;
+  while (total < size) {
+    ssize_t bytes_written = pwrite(fd, buffer + total, size - total,
+                                   offset + (off_t)total);
+    if (bytes_written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    total += (size_t)bytes_written;
+  }
+  return (ssize_t)total;
+}
+
+// Advance a vector past the bytes already transferred, trimming the first
+// buffer that was only partially transferred
+static void io_advance(struct iovec **iov, int *iovcnt, size_t transferred) {
+  while (*iovcnt > 0 && transferred >= (*iov)->iov_len) {
+    transferred -= (*iov)->iov_len;
+    (*iov)++;
+    (*iovcnt)--;
+  }
+  if (*iovcnt > 0) {
+    (*iov)->iov_base += transferred;
+    (*iov)->iov_len -= transferred;
+  }
+}
+
+ssize_t io_writev_at(int fd, struct iovec *iov, int iovcnt, off_t offset) {
+  size_t total = 0;
+  while (iovcnt > 0) {
+    ssize_t bytes_written = pwritev(fd, iov, iovcnt, offset + (off_t)total);
+    if (bytes_written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    total += (size_t)bytes_written;
+    io_advance(&iov, &iovcnt, (size_t)bytes_written);
+  }
+  return (ssize_t)total;
+}
+
+ssize_t io_readv_at(int fd, struct iovec *iov, int iovcnt, off_t offset) {
+  size_t total = 0;
+  while (iovcnt > 0) {
+    ssize_t bytes_read = preadv(fd, iov, iovcnt, offset + (off_t)total);
+    if (bytes_read == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (bytes_read == 0) {
+      log_debug("end of file after %zu bytes...", total);
+      break;
+    }
+    total += (size_t)bytes_read;
+    io_advance(&iov, &iovcnt, (size_t)bytes_read);
+  }
+  return (ssize_t)total;
+}
+
+#if IO_HAVE_URING
+
+static int io_uring_setup(uint32_t entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, uint32_t to_submit,
+                          uint32_t min_complete, uint32_t flags) {
+  return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                      flags, NULL, 0);
+}
+
+IoRing *io_ring_open(uint32_t entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ring_fd = io_uring_setup(entries, &params);
+  if (ring_fd == -1) {
+    log_info("io_uring is not available (%m), using synchronous I/O");
+    return NULL;
+  }
+
+  log_debug("mapping io_uring queues...");
+  IoRing *ring = malloc(sizeof(IoRing));
+  ring->ring_fd = ring_fd;
+  ring->entries = params.sq_entries;
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  // Recent kernels map both queues with a single mapping
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+    ring->sq_ring_size = ring->cq_ring_size;
+  }
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  ring->cq_ring = single_mmap ? ring->sq_ring
+                              : mmap(NULL, ring->cq_ring_size,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, ring_fd,
+                                     IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+      ring->sqes == MAP_FAILED) {
+    log_warn("failed to map io_uring queues (%m), using synchronous I/O");
+    if (ring->sq_ring != MAP_FAILED) {
+      munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (!single_mmap && ring->cq_ring != MAP_FAILED) {
+      munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sqes != MAP_FAILED) {
+      munmap(ring->sqes, ring->sqes_size);
+    }
+    close(ring_fd);
+    free(ring);
+    return NULL;
+  }
+
+  ring->sq_head = ring->sq_ring + params.sq_off.head;
+  ring->sq_tail = ring->sq_ring + params.sq_off.tail;
+  ring->sq_mask = ring->sq_ring + params.sq_off.ring_mask;
+  ring->sq_array = ring->sq_ring + params.sq_off.array;
+  ring->cq_head = ring->cq_ring + params.cq_off.head;
+  ring->cq_tail = ring->cq_ring + params.cq_off.tail;
+  ring->cq_mask = ring->cq_ring + params.cq_off.ring_mask;
+  ring->cqes = ring->cq_ring + params.cq_off.cqes;
+  pthread_mutex_init(&ring->mutex, NULL);
+
+  log_debug("io_uring ready with %d entries", ring->entries);
+  return ring;
+}
+
+void io_ring_close(IoRing *ring) {
+  if (ring == NULL) {
+    return;
+  }
+  log_debug("closing io_uring...");
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  munmap(ring->sq_ring, ring->sq_ring_size);
+  close(ring->ring_fd);
+  pthread_mutex_destroy(&ring->mutex);
+  free(ring);
+}
+
+// Queue up to the free space of the submission queue, returns the number of
+// requests queued
+static uint32_t io_ring_queue(IoRing *ring, int fd, uint8_t opcode,
+                              IoRequest *requests, uint32_t count) {
+  uint32_t tail = *ring->sq_tail;
+  uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  uint32_t queued = 0;
+  while (queued < count && tail - head < ring->entries) {
+    uint32_t index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)ring->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)requests[queued].iov;
+    sqe->len = (uint32_t)requests[queued].iovcnt;
+    sqe->off = (uint64_t)requests[queued].offset;
+    sqe->user_data = queued;
+    ring->sq_array[index] = index;
+    tail++;
+    queued++;
+  }
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+  return queued;
+}
+
+// Requests are queued as many at a time as the ring holds, submitted and
+// waited for with one system call. A transfer that completes short is
+// finished synchronously, like the kernel would for a blocking call.
+static ssize_t io_ring_batch(IoRing *ring, int fd, bool write,
+                             IoRequest *requests, uint32_t count) {
+  uint8_t opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+  size_t total = 0;
+  uint32_t done = 0;
+  while (done < count) {
+    uint32_t queued =
+        io_ring_queue(ring, fd, opcode, requests + done, count - done);
+
+    uint32_t to_submit = queued;
+    uint32_t completed = 0;
+    while (completed < queued) {
+      int result = io_uring_enter(ring->ring_fd, to_submit,
+                                  queued - completed, IORING_ENTER_GETEVENTS);
+      if (result == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return -1;
+      }
+      to_submit -= (uint32_t)result < to_submit ? (uint32_t)result : to_submit;
+
+      uint32_t head = *ring->cq_head;
+      uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++) {
+        struct io_uring_cqe *cqe =
+            (struct io_uring_cqe *)ring->cqes + (head & *ring->cq_mask);
+        IoRequest *request = &requests[done + cqe->user_data];
+        ssize_t transferred = cqe->res;
+        if (transferred < 0 && transferred != -EINTR &&
+            transferred != -EAGAIN) {
+          errno = -cqe->res;
+          __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+          return -1;
+        }
+        if (transferred < 0) {
+          transferred = 0;
+        }
+
+        size_t size = 0;
+        for (int i = 0; i < request->iovcnt; i++) {
+          size += request->iov[i].iov_len;
+        }
+        if ((size_t)transferred < size) {
+          log_debug("short transfer at offset %ld, finishing...",
+                    (long)request->offset);
+          struct iovec *iov = request->iov;
+          int iovcnt = request->iovcnt;
+          io_advance(&iov, &iovcnt, (size_t)transferred);
+          off_t offset = request->offset + transferred;
+          ssize_t rest = write ? io_writev_at(fd, iov, iovcnt, offset)
+                               : io_readv_at(fd, iov, iovcnt, offset);
+          if (rest == -1) {
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return -1;
+          }
+          transferred += rest;
+        }
+        total += (size_t)transferred;
+        completed++;
+      }
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    done += queued;
+  }
+  return (ssize_t)total;
+}
+
+#else
+
+IoRing *io_ring_open(uint32_t entries) {
+  log_info("built without io_uring, using synchronous I/O for %d entries",
+           entries);
+  return NULL;
+}
+
+void io_ring_close(IoRing *ring) { (void)ring; }
+
+static ssize_t io_ring_batch(IoRing *ring, int fd, bool write,
+                             IoRequest *requests, uint32_t count) {
+  (void)ring;
+  (void)fd;
+  (void)write;
+  (void)requests;
+  (void)count;
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
+
+// Without a ring the requests are transferred one after the other
+static ssize_t io_batch(IoRing *ring, int fd, bool write, IoRequest *requests,
+                        uint32_t count) {
+  if (ring != NULL) {
+    pthread_mutex_lock(&ring->mutex);
+    ssize_t transferred = io_ring_batch(ring, fd, write, requests, count);
+    pthread_mutex_unlock(&ring->mutex);
+    return transferred;
+  }
+
+  size_t total = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    ssize_t transferred =
+        write ? io_writev_at(fd, requests[i].iov, requests[i].iovcnt,
+                             requests[i].offset)
+              : io_readv_at(fd, requests[i].iov, requests[i].iovcnt,
+                            requests[i].offset);
+    if (transferred == -1) {
+      return -1;
+    }
+    total += (size_t)transferred;
+  }
+  return (ssize_t)total;
+}
+
+ssize_t io_readv_batch(IoRing *ring, int fd, IoRequest *requests,
+                       uint32_t count) {
+  return io_batch(ring, fd, false, requests, count);
+}
+
+ssize_t io_writev_batch(IoRing *ring, int fd, IoRequest *requests,
+                        uint32_t count) {
+  return io_batch(ring, fd, true, requests, count);
+}
@@ -0,0 +1,550 @@
+#include "../include/load.h"
+#include "../include/btree.h"
+#include "../include/database.h"
+#include "../include/pager.h"
+#include "../include/row.h"
+#include "../lib/log/log.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// LoadEntry locates a serialized row in the memory of the sorter
+typedef struct {
+  uint32_t key;
+  uint32_t size;
+  size_t offset;
+} LoadEntry;
+
+// LoadRun reads back a sorted run from its temporary file. A run is a
+// sequence of records holding a key, the size of a row and the row.
+typedef struct {
+  FILE *file;
+  uint32_t key;
+  uint32_t size;
+  uint8_t *row;
+  bool done;
+} LoadRun;
+
+// LoadSorter sorts the rows of a load. Rows are serialized into an arena and
+// sorted by key through an index. When the arena is full, the sorted rows are
+// written to a temporary file as a run, and the runs are merged at the end.
+typedef struct {
+  size_t run_size;
+  uint8_t *arena;
+  size_t arena_size;
+  size_t arena_capacity;
+  LoadEntry *entries;
+  size_t num_entries;
+  size_t entries_capacity;
+  // Rows have been added in key order so far, sorting can be skipped
+  bool sorted;
+  LoadRun *runs;
+  uint32_t num_runs;
+  size_t next_entry;
+  // Run that returned the last row, it moves to its next record before the
+  // next row is picked
+  int64_t last_run;
+} LoadSorter;
+
+// LoadLevel is the node being filled at one level of internal nodes
+typedef struct {
+  uint32_t page_num;
+  // Largest key under the right child of the node
+  uint32_t max_key;
+} LoadLevel;
+
+// LoadBuilder builds the B-tree from the rows in key order. Only the last
+// node of every level is open, earlier nodes are complete and never read
+// again.
+typedef struct {
+  Pager *pager;
+  // Bytes of slots and values filled in a leaf
+  uint32_t leaf_target;
+  // Keys of a filled internal node
+  uint32_t internal_target;
+  // Leaf being filled, 0 before the first row
+  uint32_t leaf_page_num;
+  uint32_t leaf_used;
+  uint32_t leaf_max_key;
+  LoadLevel levels[LOAD_MAX_HEIGHT];
+  // Every page of the new tree, released if the load fails
+  uint32_t *pages;
+  uint32_t num_pages;
+  uint32_t pages_capacity;
+  uint32_t pages_since_write;
+  LoadStats *stats;
+} LoadBuilder;
+
+static int load_entry_compare(const void *a, const void *b) {
+  uint32_t key_a = ((const LoadEntry *)a)->key;
+  uint32_t key_b = ((const LoadEntry *)b)->key;
+  return (key_a > key_b) - (key_a < key_b);
+}
+
+static void load_write(const void *data, size_t size, FILE *file) {
+  if (fwrite(data, 1, size, file) != size) {
+    log_error("error writing sorted run: %m");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void load_sorter_sort(LoadSorter *sorter) {
+  if (sorter->sorted) {
+    log_debug("rows are already sorted...");
+    return;
+  }
+  log_debug("sorting %zu rows...", sorter->num_entries);
+  qsort(sorter->entries, sorter->num_entries, sizeof(LoadEntry),
+        load_entry_compare);
+}
+
+// Sort the rows in memory and write them to a new run
+static void load_sorter_spill(LoadSorter *sorter) {
+  load_sorter_sort(sorter);
+
+  log_debug("writing run %d of %zu rows...", sorter->num_runs,
+            sorter->num_entries);
+  FILE *file = tmpfile();
+  if (file == NULL) {
+    log_error("error creating sorted run: %m");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < sorter->num_entries; i++) {
+    LoadEntry *entry = &sorter->entries[i];
+    load_write(&entry->key, sizeof(entry->key), file);
+    load_write(&entry->size, sizeof(entry->size), file);
+    load_write(sorter->arena + entry->offset, entry->size, file);
+  }
+
+  sorter->runs =
+      realloc(sorter->runs, (sorter->num_runs + 1) * sizeof(LoadRun));
+  sorter->runs[sorter->num_runs++] = (LoadRun){.file = file};
+  sorter->arena_size = 0;
+  sorter->num_entries = 0;
+  sorter->sorted = true;
+}
+
+// Serialize a row into the sorter, spilling the rows in memory to a run when
+// they reach the run size
+static void load_sorter_add(LoadSorter *sorter, Row *row) {
+  if (sorter->num_entries > 0 &&
+      sorter->arena_size + sorter->num_entries * sizeof(LoadEntry) >=
+          sorter->run_size) {
+    load_sorter_spill(sorter);
+  }
+
+  if (sorter->arena_size + ROW_MAX_SIZE > sorter->arena_capacity) {
+    sorter->arena_capacity = sorter->arena_capacity * 2 + ROW_MAX_SIZE;
+    sorter->arena = realloc(sorter->arena, sorter->arena_capacity);
+  }
+  if (sorter->num_entries == sorter->entries_capacity) {
+    sorter->entries_capacity = sorter->entries_capacity * 2 + 1024;
+    sorter->entries =
+        realloc(sorter->entries, sorter->entries_capacity * sizeof(LoadEntry));
+  }
+
+  LoadEntry *entry = &sorter->entries[sorter->num_entries];
+  entry->key = row->id;
+  entry->offset = sorter->arena_size;
+  entry->size = row_serialize(row, sorter->arena + sorter->arena_size);
+  if (sorter->num_entries > 0 && entry->key < entry[-1].key) {
+    sorter->sorted = false;
+  }
+  sorter->arena_size += entry->size;
+  sorter->num_entries++;
+}
+
+// Move a run to its next record
+static void load_run_read(LoadRun *run) {
+  if (fread(&run->key, sizeof(run->key), 1, run->file) != 1) {
+    if (ferror(run->file)) {
+      log_error("error reading sorted run: %m");
+      exit(EXIT_FAILURE);
+    }
+    run->done = true;
+    return;
+  }
+  if (fread(&run->size, sizeof(run->size), 1, run->file) != 1 ||
+      run->size > ROW_MAX_SIZE ||
+      fread(run->row, 1, run->size, run->file) != run->size) {
+    log_error("error reading sorted run: %m");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Prepare the sorter to return its rows in key order
+static void load_sorter_finish(LoadSorter *sorter) {
+  if (sorter->num_runs == 0) {
+    load_sorter_sort(sorter);
+    return;
+  }
+
+  if (sorter->num_entries > 0) {
+    load_sorter_spill(sorter);
+  }
+  log_debug("merging %d runs...", sorter->num_runs);
+  for (uint32_t i = 0; i < sorter->num_runs; i++) {
+    LoadRun *run = &sorter->runs[i];
+    rewind(run->file);
+    run->row = malloc(ROW_MAX_SIZE);
+    load_run_read(run);
+  }
+}
+
+// Get the next row in key order, returns false when every row was returned.
+// The row can be modified until the next call.
+static bool load_sorter_next(LoadSorter *sorter, uint32_t *key, uint8_t **row,
+                             uint32_t *size) {
+  if (sorter->num_runs == 0) {
+    if (sorter->next_entry == sorter->num_entries) {
+      return false;
+    }
+    LoadEntry *entry = &sorter->entries[sorter->next_entry++];
+    *key = entry->key;
+    *row = sorter->arena + entry->offset;
+    *size = entry->size;
+    return true;
+  }
+
+  if (sorter->last_run >= 0) {
+    load_run_read(&sorter->runs[sorter->last_run]);
+  }
+  // Runs are few, a linear scan finds the smallest key as fast as a heap
+  LoadRun *next = NULL;
+  for (uint32_t i = 0; i < sorter->num_runs; i++) {
+    LoadRun *run = &sorter->runs[i];
+    if (!run->done && (next == NULL || run->key < next->key)) {
+      next = run;
+      sorter->last_run = i;
+    }
+  }
+  if (next == NULL) {
+    return false;
+  }
+  *key = next->key;
+  *row = next->row;
+  *size = next->size;
+  return true;
+}
+
+static void load_sorter_free(LoadSorter *sorter) {
+  for (uint32_t i = 0; i < sorter->num_runs; i++) {
+    fclose(sorter->runs[i].file);
+    free(sorter->runs[i].row);
+  }
+  free(sorter->runs);
+  free(sorter->entries);
+  free(sorter->arena);
+}
+
+// Parse a line of input into a row, blank lines are skipped
+static LoadResult load_parse_line(char *line, Row *row, bool *blank) {
+  char *id_string = strtok(line, " \t\r\n");
+  *blank = id_string == NULL;
+  if (*blank) {
+    return LOAD_SUCCESS;
+  }
+  char *username = strtok(NULL, " \t\r\n");
+  char *email = strtok(NULL, " \t\r\n");
+  if (username == NULL || email == NULL || strtok(NULL, " \t\r\n") != NULL) {
+    return LOAD_SYNTAX_ERROR;
+  }
+
+  char *end;
+  errno = 0;
+  long long id = strtoll(id_string, &end, 10);
+  if (*end != '\0' || errno != 0) {
+    return LOAD_SYNTAX_ERROR;
+  }
+  if (id < 0) {
+    return LOAD_NEGATIVE_ID;
+  }
+  if (id > UINT32_MAX) {
+    return LOAD_SYNTAX_ERROR;
+  }
+  if (strlen(username) > ROW_COLUMN_USERNAME_SIZE ||
+      strlen(email) > ROW_COLUMN_EMAIL_SIZE) {
+    return LOAD_STRING_TOO_LONG;
+  }
+
+  row->id = (uint32_t)id;
+  strcpy(row->username, username);
+  strcpy(row->email, email);
+  return LOAD_SUCCESS;
+}
+
+// Read every row of the input into the sorter
+static LoadResult load_read(FILE *file, LoadSorter *sorter, LoadStats *stats) {
+  Row *row = malloc(sizeof(Row));
+  char *line = NULL;
+  size_t line_capacity = 0;
+  LoadResult result = LOAD_SUCCESS;
+
+  while (getline(&line, &line_capacity, file) != -1) {
+    stats->line++;
+    bool blank;
+    result = load_parse_line(line, row, &blank);
+    if (result != LOAD_SUCCESS) {
+      break;
+    }
+    if (!blank) {
+      load_sorter_add(sorter, row);
+    }
+  }
+
+  free(line);
+  free(row);
+  return result;
+}
+
+// Get a new page for the tree, remembering it in case the load fails
+static uint32_t load_new_page(LoadBuilder *builder) {
+  uint32_t page_num = pager_get_unused_page_num(builder->pager);
+  pager_get_page(builder->pager, page_num);
+  pager_mark_dirty(builder->pager, page_num);
+
+  if (builder->num_pages == builder->pages_capacity) {
+    builder->pages_capacity = builder->pages_capacity * 2 + 256;
+    builder->pages = realloc(builder->pages,
+                             builder->pages_capacity * sizeof(uint32_t));
+  }
+  builder->pages[builder->num_pages++] = page_num;
+  builder->pages_since_write++;
+  return page_num;
+}
+
+// Add a complete child to the open node of a level of internal nodes. A full
+// node is closed and added to the level above, and a new node is opened.
+static void load_add_child(LoadBuilder *builder, uint32_t level,
+                           uint32_t child_page_num, uint32_t child_max_key) {
+  if (level == LOAD_MAX_HEIGHT) {
+    log_error("bulk load is deeper than %d levels", LOAD_MAX_HEIGHT);
+    exit(EXIT_FAILURE);
+  }
+
+  LoadLevel *open = &builder->levels[level];
+  if (level == builder->stats->height) {
+    log_debug("starting internal level %d...", level);
+    open->page_num = load_new_page(builder);
+    btree_node_internal_init(pager_get_page(builder->pager, open->page_num));
+    builder->stats->internal_nodes++;
+    builder->stats->height++;
+  }
+
+  void *node = pager_get_page(builder->pager, open->page_num);
+  if (*btree_node_internal_right_child(node) !=
+          BTREE_NODE_INTERNAL_INVALID_PAGE_NUM &&
+      *btree_node_internal_num_keys(node) >= builder->internal_target) {
+    load_add_child(builder, level + 1, open->page_num, open->max_key);
+    open->page_num = load_new_page(builder);
+    node = pager_get_page(builder->pager, open->page_num);
+    btree_node_internal_init(node);
+    builder->stats->internal_nodes++;
+  }
+
+  pager_mark_dirty(builder->pager, open->page_num);
+  uint32_t num_keys = *btree_node_internal_num_keys(node);
+  if (*btree_node_internal_right_child(node) !=
+      BTREE_NODE_INTERNAL_INVALID_PAGE_NUM) {
+    *btree_node_internal_num_keys(node) = num_keys + 1;
+    *btree_node_internal_child(node, num_keys) =
+        *btree_node_internal_right_child(node);
+    *btree_node_internal_key(node, num_keys) = open->max_key;
+  }
+  *btree_node_internal_right_child(node) = child_page_num;
+  open->max_key = child_max_key;
+}
+
+// Append a row to the leaf being filled, or to a new leaf when it is full
+static void load_add_row(LoadBuilder *builder, uint32_t key, uint8_t *row,
+                         uint32_t size) {
+  uint32_t value_size = size;
+  if (size > btree_layout(builder->pager->usable_size).leaf_max_value) {
+    value_size = BTREE_NODE_LEAF_OVERFLOW_VALUE_SIZE;
+  }
+  uint32_t cell_size = BTREE_NODE_LEAF_SLOT_SIZE + value_size;
+
+  if (builder->leaf_page_num != 0 &&
+      builder->leaf_used + cell_size > builder->leaf_target) {
+    uint32_t full_page_num = builder->leaf_page_num;
+    builder->leaf_page_num = load_new_page(builder);
+    void *full = pager_get_page(builder->pager, full_page_num);
+    *btree_node_leaf_next(full) = builder->leaf_page_num;
+    pager_mark_dirty(builder->pager, full_page_num);
+    load_add_child(builder, 0, full_page_num, builder->leaf_max_key);
+    builder->leaf_used = 0;
+  } else if (builder->leaf_page_num == 0) {
+    builder->leaf_page_num = load_new_page(builder);
+  }
+
+  void *leaf = pager_get_page(builder->pager, builder->leaf_page_num);
+  pager_mark_dirty(builder->pager, builder->leaf_page_num);
+  if (builder->leaf_used == 0) {
+    btree_node_leaf_init(leaf, builder->pager->usable_size);
+    builder->stats->leaves++;
+  }
+
+  uint32_t size_field = btree_node_leaf_spill(builder->pager, row, size);
+  if (size_field & BTREE_NODE_LEAF_VALUE_OVERFLOW) {
+    // Overflow pages are counted towards the next write too
+    builder->pages_since_write +=
+        size / btree_layout(builder->pager->usable_size).overflow_space + 1;
+  }
+  btree_node_leaf_insert_cell(leaf, *btree_node_leaf_num_cells(leaf), key, row,
+                              size_field);
+  builder->leaf_used += cell_size;
+  builder->leaf_max_key = key;
+}
+
+// Close every open node, returns the root of the new tree
+static uint32_t load_finish_tree(LoadBuilder *builder) {
+  if (builder->stats->height == 0) {
+    return builder->leaf_page_num;
+  }
+
+  load_add_child(builder, 0, builder->leaf_page_num, builder->leaf_max_key);
+  // Closing a node can open a new level above it
+  uint32_t level = 0;
+  while (level + 1 < builder->stats->height) {
+    load_add_child(builder, level + 1, builder->levels[level].page_num,
+                   builder->levels[level].max_key);
+    level++;
+  }
+  return builder->levels[level].page_num;
+}
+
+// Release the pages of a tree that could not be completed, with their overflow
+// pages
+static void load_free_tree(LoadBuilder *builder) {
+  log_debug("releasing %d pages of the new tree...", builder->num_pages);
+  for (uint32_t i = 0; i < builder->num_pages; i++) {
+    uint32_t page_num = builder->pages[i];
+    void *node = pager_get_page(builder->pager, page_num);
+    if (btree_node_get_type(node) == BTREE_NODE_TYPE_LEAF) {
+      for (uint32_t cell_num = 0; cell_num < *btree_node_leaf_num_cells(node);
+           cell_num++) {
+        btree_node_leaf_free_overflow(builder->pager, node, cell_num);
+      }
+    }
+    pager_free_page(builder->pager, page_num);
+  }
+  pager_bulk_end(builder->pager);
+  pager_commit(builder->pager);
+  pager_unpin_all(builder->pager);
+}
+
+// The new tree is not reachable from the header until it is complete, the
+// previous empty root stays the root until then. Its pages are written to the
+// file without the log as they are closed, and only the switch to the new
+// root is committed.
+static LoadResult load_build(Database *database, LoadSorter *sorter,
+                             uint32_t fill_factor, LoadStats *stats) {
+  BtreeLayout layout = btree_layout(database->pager->usable_size);
+  LoadBuilder builder = {
+      .pager = database->pager,
+      .leaf_target = layout.leaf_space_for_cells * fill_factor / 100,
+      .internal_target = layout.internal_max_keys * fill_factor / 100,
+      .stats = stats,
+  };
+  pager_bulk_begin(database->pager);
+
+  uint32_t key;
+  uint8_t *row;
+  uint32_t size;
+  while (load_sorter_next(sorter, &key, &row, &size)) {
+    if (stats->rows > 0 && key == builder.leaf_max_key) {
+      log_debug("key %d is duplicated...", key);
+      stats->duplicate_key = key;
+      load_free_tree(&builder);
+      free(builder.pages);
+      return LOAD_DUPLICATE_KEY;
+    }
+
+    load_add_row(&builder, key, row, size);
+    stats->rows++;
+
+    if (builder.pages_since_write >= LOAD_WRITE_PAGES) {
+      pager_bulk_write(database->pager);
+      pager_unpin_all(database->pager);
+      builder.pages_since_write = 0;
+    }
+  }
+
+  if (stats->rows == 0) {
+    log_debug("nothing to load...");
+    pager_bulk_end(database->pager);
+    pager_commit(database->pager);
+    return LOAD_SUCCESS;
+  }
+
+  uint32_t root_page_num = load_finish_tree(&builder);
+  log_debug("new tree has root %d...", root_page_num);
+  btree_node_set_root(pager_get_page(database->pager, root_page_num), true);
+  pager_mark_dirty(database->pager, root_page_num);
+
+  pager_bulk_end(database->pager);
+  pager_free_page(database->pager, database->root_page_num);
+  database->root_page_num = root_page_num;
+  database->rightmost_leaf_page_num = builder.leaf_page_num;
+  database->pager->header.root_page_num = root_page_num;
+  pager_write_header(database->pager);
+  pager_commit(database->pager);
+  pager_unpin_all(database->pager);
+  free(builder.pages);
+  return LOAD_SUCCESS;
+}
+
+LoadResult load_file(Database *database, const char *filename,
+                     const LoadConfig *config, LoadStats *stats) {
+  memset(stats, 0, sizeof(LoadStats));
+  pager_unpin_all(database->pager);
+
+  void *root = pager_get_page(database->pager, database->root_page_num);
+  if (btree_node_get_type(root) != BTREE_NODE_TYPE_LEAF ||
+      *btree_node_leaf_num_cells(root) > 0) {
+    log_debug("database is not empty...");
+    return LOAD_NOT_EMPTY;
+  }
+
+  log_debug("opening %s...", filename);
+  FILE *file = fopen(filename, "r");
+  if (file == NULL) {
+    log_debug("failed to open %s: %m", filename);
+    return LOAD_OPEN_FAIL;
+  }
+
+  LoadSorter sorter = {
+      .run_size = config->run_size > 0 ? config->run_size
+                                       : LOAD_DEFAULT_RUN_SIZE,
+      .sorted = true,
+      .last_run = -1,
+  };
+  log_debug("reading rows...");
+  LoadResult result = load_read(file, &sorter, stats);
+  fclose(file);
+  if (result == LOAD_SUCCESS) {
+    load_sorter_finish(&sorter);
+    stats->runs = sorter.num_runs;
+    log_debug("building tree...");
+    result = load_build(database, &sorter,
+                        config->fill_factor > 0 ? config->fill_factor
+                                                : LOAD_DEFAULT_FILL_FACTOR,
+                        stats);
+  }
+
+  load_sorter_free(&sorter);
+  return result;
+}
+
+void load_print_stats(const LoadStats *stats) {
+  printf("Bulk load:\n");
+  printf("- rows: %" PRIu64 "\n", stats->rows);
+  printf("- sorted runs: %d\n", stats->runs);
+  printf("- leaves: %d\n", stats->leaves);
+  printf("- internal nodes: %d\n", stats->internal_nodes);
+  printf("- internal levels: %d\n", stats->height);
+}
@@ -1,12 +1,55 @@
 #include "../include/meta.h"
 #include "../include/btree.h"
 #include "../include/database.h"
+#include "../include/load.h"
+#include "../include/pager.h"
 #include "../lib/log/log.h"
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 
+LoadResult meta_load(Database *database, const char *filename,
+                     const LoadConfig *config) {
+  LoadStats stats;
+  // The load builds the tree without latching its pages
+  database_latch(database, DATABASE_LATCH_EXCLUSIVE);
+  LoadResult result = load_file(database, filename, config, &stats);
+  database_unlatch(database, DATABASE_LATCH_EXCLUSIVE);
+  switch (result) {
+  case (LOAD_SUCCESS):
+    load_print_stats(&stats);
+    break;
+  case (LOAD_OPEN_FAIL):
+    log_error("failed to load %s: cannot open file.", filename);
+    break;
+  case (LOAD_SYNTAX_ERROR):
+    log_error("failed to load %s: syntax error on line %" PRIu64 ".", filename,
+              stats.line);
+    break;
+  case (LOAD_NEGATIVE_ID):
+    log_error("failed to load %s: id must be greater than zero on line %" PRIu64
+              ".",
+              filename, stats.line);
+    break;
+  case (LOAD_STRING_TOO_LONG):
+    log_error("failed to load %s: string is too long on line %" PRIu64 ".",
+              filename, stats.line);
+    break;
+  case (LOAD_DUPLICATE_KEY):
+    log_error("failed to load %s: duplicate key %d.", filename,
+              stats.duplicate_key);
+    break;
+  case (LOAD_NOT_EMPTY):
+    log_error("failed to load %s: database is not empty.", filename);
+    break;
+  }
+  return result;
+}
+
 // Execute a meta command (e.g. .exit)
 MetaCommandResult meta_execute_command(char *command, Database *database) {
   log_debug("executing meta command '%s'...", command);
+  pager_unpin_all(database->pager);
 
   // .exit lets gnaro know that we want to exit the program
   if (strcmp(command, ".exit") == 0) {
@@ -15,10 +58,37 @@ MetaCommandResult meta_execute_command(char *command, Database *database) {
 
   if (strcmp(command, ".btree") == 0) {
     log_info("printing tree...");
-    btree_print(database->pager, 0, 0);
+    btree_print(database->pager, database->root_page_num, 0);
+    return META_COMMAND_SUCCESS;
+  }
+
+  if (strcmp(command, ".stats") == 0) {
+    log_info("printing statistics...");
+    pager_print_stats(database->pager);
     return META_COMMAND_SUCCESS;
   }
 
+  // .load takes the file to load and an optional fill factor
+  if (strncmp(command, ".load ", META_LOAD_COMMAND_SIZE) == 0) {
+    char *filename = strtok(command + META_LOAD_COMMAND_SIZE, " ");
+    char *fill_factor = strtok(NULL, " ");
+    LoadConfig config = {0};
+    if (fill_factor != NULL) {
+      config.fill_factor = atoi(fill_factor);
+      if (config.fill_factor < LOAD_MIN_FILL_FACTOR ||
+          config.fill_factor > LOAD_MAX_FILL_FACTOR) {
+        log_error("fill factor must be from %d to %d percent",
+                  LOAD_MIN_FILL_FACTOR, LOAD_MAX_FILL_FACTOR);
+        return META_COMMAND_SUCCESS;
+      }
+    }
+    if (filename != NULL) {
+      log_info("loading %s...", filename);
+      meta_load(database, filename, &config);
+      return META_COMMAND_SUCCESS;
+    }
+  }
+
   log_warn("unrecognized meta command '%s'", command);
   return META_COMMAND_UNRECOGNIZED;
 }
@@ -1,14 +1,698 @@
 #include "../include/pager.h"
+#include "../include/checksum.h"
+#include "../include/io.h"
+#include "../include/wal.h"
 #include "../lib/log/log.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-Pager *pager_open(const char *filename) {
+// Hash a page number into a bucket index
+static uint32_t pager_bucket(const PagerPageTable *table, uint32_t page_num) {
+  // Fibonacci hashing spreads consecutive page numbers over the buckets
+  return (uint32_t)(page_num * 2654435769U) & (table->num_buckets - 1);
+}
+
+// Find the frame of a page. Without the mutex, the frame found may be given to
+// another page at any time, and a page may be missed while the frames move
+// between buckets.
+static PagerFrame *pager_find_frame(Pager *pager, uint32_t page_num) {
+  PagerPageTable *table =
+      atomic_load_explicit(&pager->table, memory_order_acquire);
+  PagerFrame *frame = atomic_load_explicit(
+      &table->buckets[pager_bucket(table, page_num)], memory_order_acquire);
+  while (frame != NULL &&
+         atomic_load_explicit(&frame->page_num, memory_order_relaxed) !=
+             page_num) {
+    frame = atomic_load_explicit(&frame->next, memory_order_acquire);
+  }
+  return frame;
+}
+
+static uint32_t pager_lookup_frame(Pager *pager, uint32_t page_num) {
+  PagerFrame *frame = pager_find_frame(pager, page_num);
+  return frame != NULL ? frame->index : PAGER_INVALID_FRAME;
+}
+
+// A frame is linked before it is published, so that a thread walking the
+// bucket without the mutex never follows an uninitialized link
+static void pager_table_insert(PagerPageTable *table, PagerFrame *frame) {
+  _Atomic(PagerFrame *) *bucket =
+      &table->buckets[pager_bucket(table, frame->page_num)];
+  atomic_store_explicit(&frame->next,
+                        atomic_load_explicit(bucket, memory_order_relaxed),
+                        memory_order_relaxed);
+  atomic_store_explicit(bucket, frame, memory_order_release);
+}
+
+static void pager_hash_insert(Pager *pager, uint32_t frame_index) {
+  pager_table_insert(atomic_load_explicit(&pager->table, memory_order_relaxed),
+                     pager->frames[frame_index]);
+}
+
+// A thread standing on the frame removed still finds the rest of the bucket
+// through its link
+static void pager_hash_remove(Pager *pager, uint32_t frame_index) {
+  PagerPageTable *table =
+      atomic_load_explicit(&pager->table, memory_order_relaxed);
+  PagerFrame *frame = pager->frames[frame_index];
+  _Atomic(PagerFrame *) *link =
+      &table->buckets[pager_bucket(table, frame->page_num)];
+  PagerFrame *current;
+  while ((current = atomic_load_explicit(link, memory_order_relaxed)) !=
+         frame) {
+    link = &current->next;
+  }
+  atomic_store_explicit(
+      link, atomic_load_explicit(&frame->next, memory_order_relaxed),
+      memory_order_release);
+}
+
+// Replace the page table with one with enough buckets for frames_capacity
+// frames. The frames are linked into the new table before it is published:
+// a thread walking the old one in the meantime may miss its page, then looks
+// it up again with the mutex.
+static void pager_hash_resize(Pager *pager) {
+  uint32_t num_buckets = 1;
+  while (num_buckets < pager->frames_capacity * 2) {
+    num_buckets <<= 1;
+  }
+
+  log_debug("resizing page table to %d buckets...", num_buckets);
+  PagerPageTable *table = malloc(sizeof(PagerPageTable) +
+                                 num_buckets * sizeof(_Atomic(PagerFrame *)));
+  table->previous = atomic_load_explicit(&pager->table, memory_order_relaxed);
+  table->num_buckets = num_buckets;
+  for (uint32_t i = 0; i < num_buckets; i++) {
+    atomic_init(&table->buckets[i], NULL);
+  }
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    pager_table_insert(table, pager->frames[i]);
+  }
+  atomic_store_explicit(&pager->table, table, memory_order_release);
+}
+
+// Get the slot of the calling thread in a PagerCounter or PagerReaders.
+// Threads get their slot the first time they ask, one after the other.
+static uint32_t pager_thread_slot(void) {
+  static atomic_uint next_slot;
+  static _Thread_local uint32_t slot = PAGER_THREAD_SLOTS;
+  if (slot == PAGER_THREAD_SLOTS) {
+    slot = atomic_fetch_add_explicit(&next_slot, 1, memory_order_relaxed) %
+           PAGER_THREAD_SLOTS;
+  }
+  return slot;
+}
+
+static void pager_counter_add(PagerCounter *counter) {
+  atomic_fetch_add_explicit(&counter->slots[pager_thread_slot()].value, 1,
+                            memory_order_relaxed);
+}
+
+static uint64_t pager_counter_sum(PagerCounter *counter) {
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < PAGER_THREAD_SLOTS; i++) {
+    sum += atomic_load_explicit(&counter->slots[i].value, memory_order_relaxed);
+  }
+  return sum;
+}
+
+// Slot of PagerReaders held by the calling thread while it reads pages
+static _Thread_local atomic_uint_fast64_t *pager_reader_slot;
+
+// A slot shared by several threads is taken by the first one to start reading.
+// The fence keeps the versions of the pages from being read before the slot is
+// taken, see pager_wait_readers().
+void pager_read_enter(Pager *pager) {
+  if (pager->map != NULL) {
+    return;
+  }
+  for (uint32_t i = pager_thread_slot();; i = (i + 1) % PAGER_THREAD_SLOTS) {
+    atomic_uint_fast64_t *count = &pager->readers.slots[i].count;
+    uint_fast64_t value = atomic_load_explicit(count, memory_order_relaxed);
+    if ((value & 1) == 0 &&
+        atomic_compare_exchange_strong_explicit(count, &value, value + 1,
+                                                memory_order_seq_cst,
+                                                memory_order_relaxed)) {
+      pager_reader_slot = count;
+      break;
+    }
+  }
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+void pager_read_exit(Pager *pager) {
+  if (pager->map != NULL) {
+    return;
+  }
+  atomic_fetch_add_explicit(pager_reader_slot, 1, memory_order_release);
+  pager_reader_slot = NULL;
+}
+
+// Wait for the threads reading pages before a frame latched exclusively is
+// overwritten with another page. Its version changed before the slots are
+// read, so a thread that starts reading after that finds it odd and does not
+// read the frame.
+static void pager_wait_readers(Pager *pager) {
+  atomic_thread_fence(memory_order_seq_cst);
+  for (uint32_t i = 0; i < PAGER_THREAD_SLOTS; i++) {
+    atomic_uint_fast64_t *count = &pager->readers.slots[i].count;
+    uint_fast64_t value = atomic_load_explicit(count, memory_order_acquire);
+    while ((value & 1) != 0 && count != pager_reader_slot &&
+           atomic_load_explicit(count, memory_order_acquire) == value) {
+      sched_yield();
+    }
+  }
+}
+
+// The checksum covers the page number too, so that a page written at the
+// wrong place in the file is detected as well as a corrupted one
+static uint32_t pager_page_checksum(Pager *pager, uint32_t page_num,
+                                    const void *page) {
+  uint32_t checksum = checksum_crc32c(0, &page_num, sizeof(page_num));
+  return checksum_crc32c(checksum, page, pager->usable_size);
+}
+
+bool pager_page_checksum_valid(Pager *pager, uint32_t page_num,
+                               const void *page) {
+  uint32_t checksum;
+  memcpy(&checksum, page + pager->usable_size, PAGER_PAGE_TRAILER_SIZE);
+  return checksum == pager_page_checksum(pager, page_num, page);
+}
+
+// Store the checksum of a page in its trailer before the page leaves memory
+static void pager_stamp_page(Pager *pager, uint32_t page_num, void *page) {
+  if (pager->header.checksum_type == PAGER_CHECKSUM_NONE) {
+    return;
+  }
+  uint32_t checksum = pager_page_checksum(pager, page_num, page);
+  memcpy(page + pager->usable_size, &checksum, PAGER_PAGE_TRAILER_SIZE);
+}
+
+// Verify a page read from the file before anything interprets it. Pages torn
+// by a crash are restored from the log when the file is opened, so a mismatch
+// means the file was corrupted on disk. Returns whether the page was checked,
+// for the caller to count once it holds the mutex.
+static bool pager_verify_page(Pager *pager, uint32_t page_num,
+                              const void *page) {
+  if (!pager->verify_checksums ||
+      pager->header.checksum_type == PAGER_CHECKSUM_NONE) {
+    return false;
+  }
+  if (!pager_page_checksum_valid(pager, page_num, page)) {
+    log_error("page %d does not match its checksum: corrupt file", page_num);
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
+
+// Pages of files with checksums lose their trailer to the checksum
+static void pager_set_checksum_type(Pager *pager,
+                                    PagerChecksumType checksum_type) {
+  pager->header.checksum_type = checksum_type;
+  pager->usable_size = pager->page_size;
+  if (checksum_type != PAGER_CHECKSUM_NONE) {
+    pager->usable_size -= PAGER_PAGE_TRAILER_SIZE;
+  }
+}
+
+// Write a page at its place in the database file
+static void pager_write_page(Pager *pager, uint32_t page_num,
+                             const void *page) {
+  ssize_t bytes_written =
+      io_write_at(pager->file_descriptor, page, pager->page_size,
+                  (off_t)page_num * pager->page_size);
+  if (bytes_written == -1) {
+    log_error("error writing page: %m");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Account for a page written to the file, which may have grown
+static void pager_count_write(Pager *pager, uint32_t page_num) {
+  uint64_t end_of_page = ((uint64_t)page_num + 1) * pager->page_size;
+  if (end_of_page > pager->file_length) {
+    pager->file_length = end_of_page;
+  }
+  pager->stats.pages_written++;
+  pager->stats.write_calls++;
+}
+
+// Write the page held by a frame back to the database file
+static void pager_write_frame(Pager *pager, PagerFrame *frame) {
+  log_debug("writing page %d...", frame->page_num);
+  pager_stamp_page(pager, frame->page_num, frame->page);
+  pager_write_page(pager, frame->page_num, frame->page);
+  pager_count_write(pager, frame->page_num);
+  frame->dirty = false;
+}
+
+// PagerDirtyPage is a dirty page collected for a flush
+typedef struct {
+  uint32_t page_num;
+  void *page;
+} PagerDirtyPage;
+
+static int pager_compare_dirty_pages(const void *a, const void *b) {
+  uint32_t page_num_a = ((const PagerDirtyPage *)a)->page_num;
+  uint32_t page_num_b = ((const PagerDirtyPage *)b)->page_num;
+  return (page_num_a > page_num_b) - (page_num_a < page_num_b);
+}
+
+// Sort dirty pages by page number and write runs of adjacent pages with one
+// vectored write each. The writes of all runs are submitted together, so with
+// io_uring they are in flight at the same time.
+static void pager_write_dirty_pages(Pager *pager, PagerDirtyPage *dirty_pages,
+                                    uint32_t num_dirty) {
+  log_debug("flushing %d dirty pages...", num_dirty);
+  if (num_dirty == 0) {
+    return;
+  }
+  qsort(dirty_pages, num_dirty, sizeof(PagerDirtyPage),
+        pager_compare_dirty_pages);
+
+  struct iovec *iov = malloc(num_dirty * sizeof(struct iovec));
+  IoRequest *requests = malloc(num_dirty * sizeof(IoRequest));
+  uint32_t num_requests = 0;
+  uint32_t run_start = 0;
+  while (run_start < num_dirty) {
+    uint32_t run_length = 0;
+    while (run_start + run_length < num_dirty &&
+           run_length < PAGER_MAX_WRITE_PAGES &&
+           dirty_pages[run_start + run_length].page_num ==
+               dirty_pages[run_start].page_num + run_length) {
+      pager_stamp_page(pager, dirty_pages[run_start + run_length].page_num,
+                       dirty_pages[run_start + run_length].page);
+      iov[run_start + run_length].iov_base =
+          dirty_pages[run_start + run_length].page;
+      iov[run_start + run_length].iov_len = pager->page_size;
+      run_length++;
+    }
+    log_debug("writing pages %d to %d...", dirty_pages[run_start].page_num,
+              dirty_pages[run_start].page_num + run_length - 1);
+    requests[num_requests].iov = &iov[run_start];
+    requests[num_requests].iovcnt = (int)run_length;
+    requests[num_requests].offset =
+        (off_t)dirty_pages[run_start].page_num * pager->page_size;
+    num_requests++;
+    run_start += run_length;
+  }
+
+  ssize_t bytes_written = io_writev_batch(pager->ring, pager->file_descriptor,
+                                          requests, num_requests);
+  if (bytes_written == -1) {
+    log_error("error writing pages: %m");
+    exit(EXIT_FAILURE);
+  }
+  free(requests);
+  free(iov);
+
+  uint64_t end_of_last_run =
+      ((uint64_t)dirty_pages[num_dirty - 1].page_num + 1) * pager->page_size;
+  if (end_of_last_run > pager->file_length) {
+    pager->file_length = end_of_last_run;
+  }
+  pager->stats.pages_written += num_dirty;
+  pager->stats.write_calls += num_requests;
+}
+
+// Take a latch, returns EBUSY if it is held in a conflicting mode and wait is
+// false. An exclusive latch makes the version odd until it is released, and
+// the fence keeps the changes to the page from being seen before that.
+static int pager_take_latch(PagerLatch *latch, PagerLatchMode mode,
+                            bool wait) {
+  int result;
+  if (mode == PAGER_LATCH_SHARED) {
+    result = wait ? pthread_rwlock_rdlock(&latch->lock)
+                  : pthread_rwlock_tryrdlock(&latch->lock);
+  } else {
+    result = wait ? pthread_rwlock_wrlock(&latch->lock)
+                  : pthread_rwlock_trywrlock(&latch->lock);
+  }
+  if (result == 0 && mode == PAGER_LATCH_EXCLUSIVE) {
+    atomic_store_explicit(
+        &latch->version,
+        atomic_load_explicit(&latch->version, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+  }
+  return result;
+}
+
+// Only the thread holding a latch exclusively sees an odd version, it makes it
+// even again once the page is modified
+static void pager_release_latch(PagerLatch *latch) {
+  uint32_t version = atomic_load_explicit(&latch->version, memory_order_relaxed);
+  if (version & 1) {
+    atomic_store_explicit(&latch->version, version + 1, memory_order_release);
+  }
+  pthread_rwlock_unlock(&latch->lock);
+}
+
+static PagerFrame *pager_latch_frame(PagerLatch *latch) {
+  return (PagerFrame *)((char *)latch - offsetof(PagerFrame, latch));
+}
+
+static void pager_pin(PagerFrame *frame) {
+  atomic_fetch_add_explicit(&frame->pin_count, 1, memory_order_relaxed);
+}
+
+static void pager_unpin(PagerFrame *frame) {
+  atomic_fetch_sub_explicit(&frame->pin_count, 1, memory_order_release);
+}
+
+// Pin a frame found without the mutex unless its version changed since it was
+// read. The victim of an eviction is latched before it is checked to be
+// unpinned, so either the eviction sees the pin or the pin sees the version
+// change.
+static bool pager_pin_unchanged(PagerFrame *frame, uint32_t version) {
+  if (version & 1) {
+    return false;
+  }
+  atomic_fetch_add_explicit(&frame->pin_count, 1, memory_order_seq_cst);
+  if (atomic_load_explicit(&frame->latch.version, memory_order_seq_cst) ==
+      version) {
+    return true;
+  }
+  pager_unpin(frame);
+  return false;
+}
+
+// The reference bit is only written when it is clear, so that frames read
+// often stay in the caches of every thread reading them
+static void pager_reference(PagerFrame *frame) {
+  if (!atomic_load_explicit(&frame->referenced, memory_order_relaxed)) {
+    atomic_store_explicit(&frame->referenced, true, memory_order_relaxed);
+  }
+}
+
+// Find a frame that is not pinned by the current epoch with the CLOCK
+// algorithm: frames referenced since the last sweep get a second chance.
+// The victim is returned latched exclusively, frames whose latch is held are
+// skipped. Returns PAGER_INVALID_FRAME if every frame is pinned.
+static uint32_t pager_find_victim(Pager *pager) {
+  for (uint32_t i = 0; i < pager->num_frames * 2; i++) {
+    uint32_t frame_index = pager->clock_hand;
+    PagerFrame *frame = pager->frames[frame_index];
+    pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+    // Uncommitted pages must not reach the database file before the log
+    if (frame->epoch == pager->epoch ||
+        atomic_load_explicit(&frame->pin_count, memory_order_relaxed) > 0 ||
+        frame->uncommitted) {
+      continue;
+    }
+    if (atomic_load_explicit(&frame->referenced, memory_order_relaxed)) {
+      atomic_store_explicit(&frame->referenced, false, memory_order_relaxed);
+      continue;
+    }
+    if (pager_take_latch(&frame->latch, PAGER_LATCH_EXCLUSIVE, false) != 0) {
+      continue;
+    }
+    // A thread may have pinned the frame without the mutex in the meantime
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&frame->pin_count, memory_order_acquire) > 0) {
+      pager_release_latch(&frame->latch);
+      continue;
+    }
+    return frame_index;
+  }
+  return PAGER_INVALID_FRAME;
+}
+
+// Finish the I/O on the frame of a page: the frame is unpinned and its latch
+// released, waking up the threads waiting for the page
+static void pager_end_io(Pager *pager, uint32_t page_num) {
+  PagerFrame *frame = pager->frames[pager_lookup_frame(pager, page_num)];
+  frame->io_in_progress = false;
+  pager_unpin(frame);
+  pager_release_latch(&frame->latch);
+}
+
+// Write back a dirty victim, latched exclusively, without holding the mutex.
+// The page was stamped when it was committed, since uncommitted pages are
+// never evicted. It stays dirty until it is written, so that a checkpoint in
+// the meantime writes it too before the log is restarted. The CLOCK hand is
+// moved back to it so that it is the next victim.
+static void pager_write_back(Pager *pager, uint32_t frame_index) {
+  PagerFrame *frame = pager->frames[frame_index];
+  uint32_t page_num = frame->page_num;
+  void *page = frame->page;
+  log_debug("writing back page %d...", page_num);
+  frame->io_in_progress = true;
+  pager_pin(frame);
+  pthread_mutex_unlock(&pager->mutex);
+
+  // The log must be durable before the pages it protects are overwritten
+  wal_sync(pager->wal);
+  pager_write_page(pager, page_num, page);
+
+  pthread_mutex_lock(&pager->mutex);
+  frame_index = pager_lookup_frame(pager, page_num);
+  pager->frames[frame_index]->dirty = false;
+  pager_count_write(pager, page_num);
+  pager->stats.writebacks++;
+  pager->clock_hand = frame_index;
+  pager_end_io(pager, page_num);
+}
+
+// Drop a clean victim from the page table
+static void pager_evict_frame(Pager *pager, uint32_t frame_index) {
+  log_debug("evicting page %d...", pager->frames[frame_index]->page_num);
+  pager_hash_remove(pager, frame_index);
+  pager->stats.evictions++;
+}
+
+// Get a frame for a new page, latched exclusively, evicting another page if
+// the pool is full. A dirty victim is written back first, which releases the
+// mutex: PAGER_INVALID_FRAME is returned then, and the caller looks its page
+// up again before asking for another frame.
+static uint32_t pager_allocate_frame(Pager *pager) {
+  if (pager->num_frames >= pager->max_frames) {
+    uint32_t victim = pager_find_victim(pager);
+    if (victim != PAGER_INVALID_FRAME && pager->frames[victim]->dirty) {
+      pager_write_back(pager, victim);
+      return PAGER_INVALID_FRAME;
+    }
+    if (victim != PAGER_INVALID_FRAME) {
+      pager_evict_frame(pager, victim);
+      return victim;
+    }
+    log_warn("all %d frames are pinned, growing buffer pool...",
+             pager->num_frames);
+  }
+
+  if (pager->num_frames == pager->frames_capacity) {
+    pager->frames_capacity *= 2;
+    pager->frames =
+        realloc(pager->frames, pager->frames_capacity * sizeof(PagerFrame *));
+    pager_hash_resize(pager);
+  }
+
+  // A frame left over from a previous growth is reused first
+  uint32_t frame_index = pager->num_frames++;
+  if (frame_index == pager->num_allocated_frames) {
+    PagerFrame *frame = malloc(sizeof(PagerFrame));
+    frame->page = malloc(pager->page_size);
+    atomic_init(&frame->page_num, PAGER_NO_PAGE);
+    atomic_init(&frame->next, NULL);
+    frame->epoch = 0;
+    atomic_init(&frame->pin_count, 0);
+    pthread_rwlock_init(&frame->latch.lock, NULL);
+    atomic_init(&frame->latch.version, 0);
+    atomic_init(&frame->referenced, false);
+    frame->dirty = false;
+    frame->uncommitted = false;
+    frame->io_in_progress = false;
+    pager->frames[frame_index] = frame;
+    pager->num_allocated_frames++;
+  }
+  PagerFrame *frame = pager->frames[frame_index];
+  frame->index = frame_index;
+  pager_take_latch(&frame->latch, PAGER_LATCH_EXCLUSIVE, true);
+  return frame_index;
+}
+
+static void pager_free_frame(PagerFrame *frame) {
+  free(frame->page);
+  pthread_rwlock_destroy(&frame->latch.lock);
+  free(frame);
+}
+
+// Map pages [from, to) of the reserved address space, from the database file
+// if they are part of it and from anonymous memory otherwise. Mappings are
+// private, so the kernel never writes modified pages back on its own.
+static void pager_map_range(Pager *pager, uint32_t from, uint32_t to,
+                            bool from_file) {
+  if (from >= to) {
+    return;
+  }
+  log_debug("mapping pages %d to %d...", from, to - 1);
+  void *address = pager->map->base + (size_t)from * pager->page_size;
+  size_t length = (size_t)(to - from) * pager->page_size;
+  void *mapped =
+      from_file
+          ? mmap(address, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, pager->file_descriptor,
+                 (off_t)from * pager->page_size)
+          : mmap(address, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+                 0);
+  if (mapped == MAP_FAILED) {
+    log_error("error mapping database file: %m");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Grow the mapping so that it covers the given page, new pages are anonymous
+// until they are written to the file
+static void pager_map_grow(Pager *pager, uint32_t page_num) {
+  PagerMap *map = pager->map;
+  if (page_num >= map->max_pages) {
+    log_error("page number %d out of bounds, max: %d", page_num,
+              map->max_pages);
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t mapped_pages =
+      (page_num / PAGER_MMAP_GROW_PAGES + 1) * PAGER_MMAP_GROW_PAGES;
+  if (mapped_pages > map->max_pages) {
+    mapped_pages = map->max_pages;
+  }
+  pager_map_range(pager, map->mapped_pages, mapped_pages, false);
+
+  map->page_flags = realloc(map->page_flags, mapped_pages);
+  memset(map->page_flags + map->mapped_pages, 0,
+         mapped_pages - map->mapped_pages);
+  map->dirty_pages =
+      realloc(map->dirty_pages, mapped_pages * sizeof(uint32_t));
+  map->uncommitted_pages =
+      realloc(map->uncommitted_pages, mapped_pages * sizeof(uint32_t));
+  map->mapped_pages = mapped_pages;
+}
+
+// Remap the part of the file that has been written, which drops the private
+// copies of pages that are now clean and lets the OS page cache serve them
+// again. Every page must be clean, the contents seen by the B-tree do not
+// change and neither do the addresses.
+static void pager_map_refresh(Pager *pager) {
+  PagerMap *map = pager->map;
+  uint32_t file_pages = pager->file_length / pager->page_size;
+  log_debug("remapping %d pages of the database file...", file_pages);
+  pager_map_range(pager, 0, file_pages, true);
+  map->file_pages = file_pages;
+}
+
+static void pager_map_open(Pager *pager) {
+  PagerMap *map = malloc(sizeof(PagerMap));
+  map->max_pages = PAGER_MMAP_MAX_SIZE / pager->page_size;
+  log_debug("reserving address space for %d pages...", map->max_pages);
+  map->base = mmap(NULL, PAGER_MMAP_MAX_SIZE,
+                   PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+                   0);
+  if (map->base == MAP_FAILED) {
+    log_error("error reserving address space: %m");
+    exit(EXIT_FAILURE);
+  }
+  map->mapped_pages = 0;
+  map->file_pages = 0;
+  map->page_flags = NULL;
+  map->dirty_pages = NULL;
+  map->num_dirty_pages = 0;
+  map->uncommitted_pages = NULL;
+  map->num_uncommitted_pages = 0;
+  pager->map = map;
+
+  if (pager->num_pages > 0) {
+    pager_map_grow(pager, pager->num_pages - 1);
+    pager_map_refresh(pager);
+  }
+}
+
+// Read the header at the beginning of the file and take the page size from
+// it. A file without header, empty or written before headers existed, is left
+// with a zero version for the database to initialize: an empty file gets the
+// configured page size, an older file has 4 kilobyte pages.
+static bool pager_read_header(Pager *pager, uint32_t page_size) {
+  PagerHeader *header = &pager->header;
+  memset(header, 0, sizeof(PagerHeader));
+  pager->page_size = page_size > 0 ? page_size : PAGER_DEFAULT_PAGE_SIZE;
+  pager->usable_size = pager->page_size;
+  if (pager->file_length == 0) {
+    if (!pager_page_size_valid(pager->page_size)) {
+      log_error("unsupported page size %d", pager->page_size);
+      return false;
+    }
+    return true;
+  }
+
+  log_debug("reading file header...");
+  if (io_read_at(pager->file_descriptor, header, sizeof(PagerHeader), 0) !=
+      (ssize_t)sizeof(PagerHeader)) {
+    log_error("error reading file header: %m");
+    return false;
+  }
+  if (memcmp(header->magic, PAGER_HEADER_MAGIC, sizeof(header->magic)) != 0) {
+    log_info("database file has no header, it will be upgraded");
+    memset(header, 0, sizeof(PagerHeader));
+    pager->page_size = PAGER_DEFAULT_PAGE_SIZE;
+    pager->usable_size = pager->page_size;
+    return true;
+  }
+  if (header->version == 0 || header->version > PAGER_FORMAT_VERSION) {
+    log_error("unsupported format version %d", header->version);
+    return false;
+  }
+  if (!pager_page_size_valid(header->page_size)) {
+    log_error("unsupported page size %d", header->page_size);
+    return false;
+  }
+  if (header->checksum_type > PAGER_CHECKSUM_CRC32C) {
+    log_error("unsupported checksum type %d", header->checksum_type);
+    return false;
+  }
+  pager->page_size = header->page_size;
+  pager_set_checksum_type(pager, header->checksum_type);
+
+  // The header is used before its page is ever read through the pager
+  bool valid = true;
+  if (pager->verify_checksums &&
+      header->checksum_type != PAGER_CHECKSUM_NONE) {
+    void *page = malloc(pager->page_size);
+    valid = io_read_at(pager->file_descriptor, page, pager->page_size, 0) ==
+                (ssize_t)pager->page_size &&
+            pager_page_checksum_valid(pager, PAGER_HEADER_PAGE_NUM, page);
+    free(page);
+  }
+  if (!valid) {
+    log_error("file header does not match its checksum: corrupt file");
+  }
+  return valid;
+}
+
+static void pager_map_close(Pager *pager) {
+  PagerMap *map = pager->map;
+  munmap(map->base, PAGER_MMAP_MAX_SIZE);
+  free(map->page_flags);
+  free(map->dirty_pages);
+  free(map->uncommitted_pages);
+  free(map);
+}
+
+Pager *pager_open(const char *filename, const PagerConfig *config) {
   log_debug("opening file %s...", filename);
 
   // Read/Write mode, create if not exists, user read/write permission
@@ -19,116 +703,1083 @@ Pager *pager_open(const char *filename) {
     return NULL;
   }
 
-  log_debug("allocating pager...");
+  // Opening the log replays transactions committed before a crash, so the
+  // size of the database file is only known afterwards
+  Wal *wal = wal_open(filename, fd, &config->wal);
+  if (wal == NULL) {
+    close(fd);
+    return NULL;
+  }
 
-  off_t file_length = lseek(fd, 0, SEEK_END);
-  Pager *pager = malloc(sizeof(Pager));
-  pager->file_descriptor = fd;
-  pager->file_length = file_length;
-  pager->num_pages = (file_length / PAGER_PAGE_SIZE);
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    log_error("failed to stat file %s: %m", filename);
+    wal_close(wal);
+    close(fd);
+    return NULL;
+  }
 
-  if (file_length % PAGER_PAGE_SIZE != 0) {
+  log_debug("allocating pager...");
+  // The slots of the counters are aligned to cache lines
+  Pager *pager = aligned_alloc(_Alignof(Pager), sizeof(Pager));
+  pager->file_descriptor = fd;
+  pager->wal = wal;
+  pager->file_length = file_stat.st_size;
+  pager->verify_checksums = !config->skip_verify;
+  if (!pager_read_header(pager, config->page_size)) {
+    wal_close(wal);
+    close(fd);
+    free(pager);
+    return NULL;
+  }
+  if (pager->file_length % pager->page_size != 0) {
     log_error(
         "database does not container a whole number of pages: corrupt file");
+    wal_close(wal);
+    close(fd);
+    free(pager);
     return NULL;
   }
+  pager->num_pages = (pager->file_length / pager->page_size);
+  wal_start(wal, pager->page_size);
+
+  // A bulk load interrupted by a crash left pages that nothing points to. The
+  // truncation is durable before the header forgets about them.
+  uint32_t bulk_start_page = pager->header.bulk_start_page;
+  if (bulk_start_page != 0 && bulk_start_page < pager->num_pages) {
+    log_info("dropping %d pages of an interrupted bulk load",
+             pager->num_pages - bulk_start_page);
+    pager->num_pages = bulk_start_page;
+    pager->file_length = (uint64_t)bulk_start_page * pager->page_size;
+    if (ftruncate(fd, (off_t)pager->file_length) == -1 || fsync(fd) == -1) {
+      log_error("error truncating database file: %m");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  log_debug("allocating buffer pool of %d frames...", config->cache_pages);
+  pager->max_frames = config->cache_pages > 0 ? config->cache_pages : 1;
+  pager->frames_capacity = pager->max_frames;
+  pager->frames = malloc(pager->frames_capacity * sizeof(PagerFrame *));
+  pager->num_frames = 0;
+  pager->num_allocated_frames = 0;
+  atomic_init(&pager->table, NULL);
+  pager_hash_resize(pager);
+  pager->clock_hand = 0;
+  pager->epoch = 1;
+  memset(&pager->stats, 0, sizeof(PagerStats));
+  for (uint32_t i = 0; i < PAGER_THREAD_SLOTS; i++) {
+    atomic_init(&pager->lookup_hits.slots[i].value, 0);
+    atomic_init(&pager->readers.slots[i].count, 0);
+  }
+
+  pager->readahead.next_page_num = 0;
+  pager->readahead.end_page_num = 0;
+  pager->readahead.window = PAGER_READAHEAD_MIN_PAGES;
+
+  pthread_mutexattr_t mutex_attributes;
+  pthread_mutexattr_init(&mutex_attributes);
+  pthread_mutexattr_settype(&mutex_attributes, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&pager->mutex, &mutex_attributes);
+  pthread_mutexattr_destroy(&mutex_attributes);
+
+  pager->ring = NULL;
+  if (config->async_io && !config->mmap) {
+    log_debug("setting up asynchronous I/O...");
+    pager->ring = io_ring_open(PAGER_IO_RING_ENTRIES);
+  }
+
+  pager->map = NULL;
+  if (config->mmap) {
+    log_debug("using memory-mapped mode...");
+    pager_map_open(pager);
+  }
 
-  // Initialize pages to NULL
-  for (uint32_t i = 0; i < PAGER_MAX_PAGES; i++) {
-    log_debug("initializing page %d...", i);
-    pager->pages[i] = NULL;
+  if (bulk_start_page != 0) {
+    pager->header.bulk_start_page = 0;
+    pager_write_header(pager);
+    pager_commit(pager);
   }
 
   return pager;
 }
 
-// pager_get_page() can handle a cache miss. It assumes pages are saved one
+// Free the buffer pool and the pager itself, once the files are closed
+static void pager_free(Pager *pager) {
+  if (pager->map != NULL) {
+    log_debug("unmapping database file...");
+    pager_map_close(pager);
+  }
+
+  io_ring_close(pager->ring);
+
+  log_debug("freeing buffer pool...");
+  for (uint32_t i = 0; i < pager->num_allocated_frames; i++) {
+    pager_free_frame(pager->frames[i]);
+  }
+  free(pager->frames);
+  PagerPageTable *table =
+      atomic_load_explicit(&pager->table, memory_order_relaxed);
+  while (table != NULL) {
+    PagerPageTable *previous = table->previous;
+    free(table);
+    table = previous;
+  }
+  pthread_mutex_destroy(&pager->mutex);
+
+  log_debug("freeing pager...");
+  free(pager);
+}
+
+// pager_close() commits and checkpoints pending changes, closes the database
+// file and removes the log, then frees the buffer pool and the pager itself
+int pager_close(Pager *pager) {
+  pager_commit(pager);
+  pager_checkpoint(pager);
+  wal_close(pager->wal);
+
+  log_debug("closing file descriptor...");
+  int result = close(pager->file_descriptor);
+  if (result == -1) {
+    log_error("failed to close db file: %m");
+  }
+
+  pager_free(pager);
+  return result;
+}
+
+// Uncommitted and unflushed pages are lost, committed ones are recovered from
+// the log when the file is opened again
+void pager_abandon(Pager *pager) {
+  log_debug("abandoning pager...");
+  wal_abandon(pager->wal);
+  close(pager->file_descriptor);
+  pager_free(pager);
+}
+
+static void *pager_map_get_page(Pager *pager, uint32_t page_num) {
+  if (page_num >= pager->map->mapped_pages) {
+    pager_map_grow(pager, page_num);
+  }
+  if (page_num >= pager->num_pages) {
+    pager->num_pages = page_num + 1;
+  }
+  void *page = pager->map->base + (size_t)page_num * pager->page_size;
+  // A page of the file is verified the first time it is used
+  if (page_num < pager->map->file_pages &&
+      !(pager->map->page_flags[page_num] & PAGER_PAGE_VERIFIED)) {
+    pager->stats.pages_verified += pager_verify_page(pager, page_num, page);
+    pager->map->page_flags[page_num] |= PAGER_PAGE_VERIFIED;
+  }
+  return page;
+}
+
+// pager_load_frame() can handle a cache miss. It assumes pages are saved one
 // after the other in the database file: page 0 at offset 0, page 1 at offset
 // 4096, page 2 at offset 8192, etc. If the requested page lies outside the
-// bounds of the file, we know it should be blank, so we just allocate some
-// memory and return it. The page will be added to the file when we flush the
-// cache to disk later.
+// bounds of the file, we know it should be blank, so we just zero a frame and
+// return it. The page will be added to the file when it is flushed or evicted.
+//
+// The frame is in the page table while the page is read, with the mutex
+// released. The frame returned may still be under I/O by another thread.
+static uint32_t pager_load_frame(Pager *pager, uint32_t page_num) {
+  uint32_t frame_index = pager_lookup_frame(pager, page_num);
+  if (frame_index != PAGER_INVALID_FRAME) {
+    log_debug("page %d found...", page_num);
+    pager->stats.hits++;
+    pager_reference(pager->frames[frame_index]);
+    return frame_index;
+  }
+
+  // Cache miss. Get a frame and load from file.
+  log_debug("page %d not found...", page_num);
+  pager->stats.misses++;
+  while ((frame_index = pager_allocate_frame(pager)) == PAGER_INVALID_FRAME) {
+    // Another thread may have loaded the page while a victim was written back
+    frame_index = pager_lookup_frame(pager, page_num);
+    if (frame_index != PAGER_INVALID_FRAME) {
+      pager_reference(pager->frames[frame_index]);
+      return frame_index;
+    }
+  }
+
+  PagerFrame *frame = pager->frames[frame_index];
+  frame->page_num = page_num;
+  frame->dirty = false;
+  frame->uncommitted = false;
+  pager_reference(frame);
+  frame->io_in_progress = true;
+  pager_pin(frame);
+  pager_hash_insert(pager, frame_index);
+  void *page = frame->page;
+  uint32_t num_pages_on_disk = pager->file_length / pager->page_size;
+  if (page_num >= pager->num_pages) {
+    log_debug("setting num_pages to %d...", page_num + 1);
+    pager->num_pages = page_num + 1;
+  }
+  pthread_mutex_unlock(&pager->mutex);
+  pager_wait_readers(pager);
+
+  bool verified = false;
+  if (page_num < num_pages_on_disk) {
+    log_debug("reading page %d from file...", page_num);
+
+    ssize_t bytes_read = io_read_at(pager->file_descriptor, page,
+                                    pager->page_size,
+                                    (off_t)page_num * pager->page_size);
+
+    if (bytes_read != (ssize_t)pager->page_size) {
+      log_error("error reading file: %m");
+      exit(EXIT_FAILURE);
+    }
+    verified = pager_verify_page(pager, page_num, page);
+  } else {
+    log_debug("page %d is past the end of the file...", page_num);
+    memset(page, 0, pager->page_size);
+  }
+
+  pthread_mutex_lock(&pager->mutex);
+  log_debug("page %d loaded...", page_num);
+  pager->stats.pages_verified += verified;
+  pager_end_io(pager, page_num);
+  return pager_lookup_frame(pager, page_num);
+}
+
+// A page under I/O by another thread is ready once its latch is released
 void *pager_get_page(Pager *pager, uint32_t page_num) {
   log_debug("getting page %d...", page_num);
+  pthread_mutex_lock(&pager->mutex);
+  if (pager->map != NULL) {
+    void *page = pager_map_get_page(pager, page_num);
+    pthread_mutex_unlock(&pager->mutex);
+    return page;
+  }
 
-  if (page_num > PAGER_MAX_PAGES) {
-    log_error("page number %d out of bounds, max: %d", page_num,
-              PAGER_MAX_PAGES);
+  // Loading the page may move the frames
+  uint32_t frame_index = pager_load_frame(pager, page_num);
+  PagerFrame *frame = pager->frames[frame_index];
+  frame->epoch = pager->epoch;
+  void *page = frame->page;
+  bool io_in_progress = frame->io_in_progress;
+  pthread_mutex_unlock(&pager->mutex);
+  if (io_in_progress) {
+    pager_read_wait(&frame->latch);
+  }
+  return page;
+}
+
+// Find a page in the buffer pool without the mutex and pin it, unless its
+// frame is latched exclusively. Returns NULL when the page is not found or the
+// frame is latched, for the caller to take the mutex.
+static PagerFrame *pager_pin_found(Pager *pager, uint32_t page_num) {
+  PagerFrame *frame = pager_find_frame(pager, page_num);
+  if (frame == NULL) {
+    return NULL;
+  }
+  uint32_t version =
+      atomic_load_explicit(&frame->latch.version, memory_order_acquire);
+  if (atomic_load_explicit(&frame->page_num, memory_order_relaxed) !=
+          page_num ||
+      !pager_pin_unchanged(frame, version)) {
+    return NULL;
+  }
+  pager_reference(frame);
+  pager_counter_add(&pager->lookup_hits);
+  return frame;
+}
+
+// Pin the frame of a page and return its latch, NULL in memory-mapped mode
+static PagerLatch *pager_pin_frame(Pager *pager, uint32_t page_num,
+                                   void **page) {
+  if (pager->map == NULL) {
+    PagerFrame *frame = pager_pin_found(pager, page_num);
+    if (frame != NULL) {
+      *page = frame->page;
+      return &frame->latch;
+    }
+  }
+
+  pthread_mutex_lock(&pager->mutex);
+  if (pager->map != NULL) {
+    *page = pager_map_get_page(pager, page_num);
+    pthread_mutex_unlock(&pager->mutex);
+    return NULL;
+  }
+  uint32_t frame_index = pager_load_frame(pager, page_num);
+  PagerFrame *frame = pager->frames[frame_index];
+  pager_pin(frame);
+  *page = frame->page;
+  bool io_in_progress = frame->io_in_progress;
+  pthread_mutex_unlock(&pager->mutex);
+  if (io_in_progress) {
+    pager_read_wait(&frame->latch);
+  }
+  return &frame->latch;
+}
+
+// The frame is pinned while the mutex is held, and the latch taken once it is
+// released so that a thread waiting for a page does not stop the others
+void *pager_try_latch_page(Pager *pager, uint32_t page_num,
+                           PagerLatchMode mode) {
+  log_debug("latching page %d...", page_num);
+  void *page;
+  PagerLatch *latch = pager_pin_frame(pager, page_num, &page);
+  if (latch == NULL) {
+    return page;
+  }
+  int result = pager_take_latch(latch, mode, false);
+  if (result == EBUSY) {
+    pager_unpin_page(pager, page_num);
+    return NULL;
+  }
+  if (result != 0) {
+    log_error("error latching page %d: %s", page_num, strerror(result));
+    exit(EXIT_FAILURE);
+  }
+  return page;
+}
+
+// Wait for the latch of a pinned frame. A thread latching a page it already
+// holds exclusively gets an error instead of waiting for itself forever.
+static void pager_wait_latch(PagerLatch *latch, PagerLatchMode mode) {
+  int result = pager_take_latch(latch, mode, true);
+  if (result != 0) {
+    log_error("error latching page: %s", strerror(result));
     exit(EXIT_FAILURE);
   }
+}
+
+void *pager_latch_page(Pager *pager, uint32_t page_num, PagerLatchMode mode) {
+  log_debug("latching page %d...", page_num);
+  void *page;
+  PagerLatch *latch = pager_pin_frame(pager, page_num, &page);
+  if (latch != NULL) {
+    pager_wait_latch(latch, mode);
+  }
+  return page;
+}
+
+// Pin and latch a page read without either, if it has not changed since its
+// version was read
+bool pager_latch_unchanged(PagerLatch *latch, uint32_t version,
+                           PagerLatchMode mode) {
+  if (latch == NULL) {
+    return true;
+  }
+  PagerFrame *frame = pager_latch_frame(latch);
+  if (!pager_pin_unchanged(frame, version)) {
+    return false;
+  }
+  pager_wait_latch(latch, mode);
+  uint32_t expected = version + (mode == PAGER_LATCH_EXCLUSIVE ? 1 : 0);
+  if (atomic_load_explicit(&latch->version, memory_order_relaxed) !=
+      expected) {
+    pager_release_latch(latch);
+    pager_unpin(frame);
+    return false;
+  }
+  return true;
+}
+
+// The page is not pinned: its frame can be evicted and given to another page
+// at any time, which changes its version. A version read before the frame was
+// given to the page is caught by checking the page number after it.
+void *pager_read_page(Pager *pager, uint32_t page_num, PagerLatch **latch,
+                      uint32_t *version) {
+  if (pager->map == NULL) {
+    PagerFrame *frame = pager_find_frame(pager, page_num);
+    if (frame != NULL) {
+      *version =
+          atomic_load_explicit(&frame->latch.version, memory_order_acquire);
+      if (atomic_load_explicit(&frame->page_num, memory_order_relaxed) ==
+          page_num) {
+        pager_reference(frame);
+        pager_counter_add(&pager->lookup_hits);
+        *latch = &frame->latch;
+        return frame->page;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&pager->mutex);
+  if (pager->map != NULL) {
+    void *page = pager_map_get_page(pager, page_num);
+    pthread_mutex_unlock(&pager->mutex);
+    *latch = NULL;
+    *version = 0;
+    return page;
+  }
+  pthread_mutex_unlock(&pager->mutex);
+
+  // Loading the page may wait for other threads to stop reading
+  pager_read_exit(pager);
+  for (;;) {
+    pthread_mutex_lock(&pager->mutex);
+    PagerFrame *frame = pager->frames[pager_load_frame(pager, page_num)];
+    bool io_in_progress = frame->io_in_progress;
+    pthread_mutex_unlock(&pager->mutex);
+    if (io_in_progress) {
+      pager_read_wait(&frame->latch);
+    }
+    pager_read_enter(pager);
+    *version =
+        atomic_load_explicit(&frame->latch.version, memory_order_acquire);
+    if (atomic_load_explicit(&frame->page_num, memory_order_relaxed) ==
+        page_num) {
+      *latch = &frame->latch;
+      return frame->page;
+    }
+    pager_read_exit(pager);
+  }
+}
+
+uint32_t pager_read_begin(PagerLatch *latch) {
+  if (latch == NULL) {
+    return 0;
+  }
+  return atomic_load_explicit(&latch->version, memory_order_acquire);
+}
+
+// The fence keeps the reads of the page from moving after the version is read
+// again, the same as in a sequence lock
+bool pager_read_validate(PagerLatch *latch, uint32_t version) {
+  if (latch == NULL) {
+    return true;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  return (version & 1) == 0 &&
+         atomic_load_explicit(&latch->version, memory_order_relaxed) ==
+             version;
+}
 
-  if (pager->pages[page_num] == NULL) {
-    // Cache miss. Allocate memory and load from file.
-    log_debug("page %d not found...", page_num);
-    log_debug("allocating memory for page %d...", page_num);
+void pager_read_wait(PagerLatch *latch) {
+  if (latch == NULL) {
+    return;
+  }
+  pthread_rwlock_rdlock(&latch->lock);
+  pthread_rwlock_unlock(&latch->lock);
+}
 
-    void *page = malloc(PAGER_PAGE_SIZE);
-    uint32_t num_pages = pager->file_length / PAGER_PAGE_SIZE;
+void *pager_pin_page(Pager *pager, uint32_t page_num) {
+  void *page;
+  pager_pin_frame(pager, page_num, &page);
+  return page;
+}
 
-    // We might save a partial page at the end of the file
-    if (pager->file_length % PAGER_PAGE_SIZE) {
-      log_debug("partial page found...");
-      num_pages += 1;
+// Get the frame of a page pinned by the caller, which cannot be evicted or
+// reused until it is unpinned
+static PagerFrame *pager_pinned_frame(Pager *pager, uint32_t page_num) {
+  PagerFrame *frame = pager_find_frame(pager, page_num);
+  if (frame == NULL) {
+    pthread_mutex_lock(&pager->mutex);
+    uint32_t frame_index = pager_lookup_frame(pager, page_num);
+    if (frame_index != PAGER_INVALID_FRAME) {
+      frame = pager->frames[frame_index];
     }
+    pthread_mutex_unlock(&pager->mutex);
+  }
+  if (frame == NULL ||
+      atomic_load_explicit(&frame->pin_count, memory_order_relaxed) == 0) {
+    log_error("tried to unpin page %d which is not pinned", page_num);
+    exit(EXIT_FAILURE);
+  }
+  return frame;
+}
 
-    if (page_num <= num_pages) {
-      log_debug("reading page %d from file...", page_num);
+void pager_unpin_page(Pager *pager, uint32_t page_num) {
+  if (pager->map == NULL) {
+    pager_unpin(pager_pinned_frame(pager, page_num));
+  }
+}
 
-      lseek(pager->file_descriptor, page_num * PAGER_PAGE_SIZE, SEEK_SET);
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGER_PAGE_SIZE);
+void pager_unlatch_page(Pager *pager, uint32_t page_num) {
+  log_debug("unlatching page %d...", page_num);
+  if (pager->map == NULL) {
+    PagerFrame *frame = pager_pinned_frame(pager, page_num);
+    pager_release_latch(&frame->latch);
+    pager_unpin(frame);
+  }
+}
 
-      if (bytes_read == -1) {
-        log_error("error reading file: %m");
-        exit(EXIT_FAILURE);
+// Missing pages are read into unpinned frames with one batch, so that with
+// io_uring all the reads are in flight at the same time. The batch runs
+// without the mutex, its frames under I/O like a single page being read.
+// Prefetched frames start with their reference bit set, which keeps them in
+// the pool until the CLOCK hand has passed them once. Without io_uring reads
+// would block, so the kernel is asked to read the pages into its cache in the
+// background instead.
+void pager_prefetch(Pager *pager, const uint32_t *page_nums, uint32_t count) {
+  pthread_mutex_lock(&pager->mutex);
+  uint32_t num_pages_on_disk = pager->file_length / pager->page_size;
+  if (pager->map != NULL || pager->ring == NULL) {
+    for (uint32_t i = 0; i < count; i++) {
+      if (page_nums[i] >= num_pages_on_disk) {
+        continue;
+      }
+      if (pager->map != NULL) {
+        madvise(pager->map->base + (size_t)page_nums[i] * pager->page_size,
+                pager->page_size, MADV_WILLNEED);
+      } else if (pager_lookup_frame(pager, page_nums[i]) ==
+                 PAGER_INVALID_FRAME) {
+        posix_fadvise(pager->file_descriptor,
+                      (off_t)page_nums[i] * pager->page_size, pager->page_size,
+                      POSIX_FADV_WILLNEED);
+      } else {
+        continue;
       }
+      pager->stats.prefetches++;
     }
+    pthread_mutex_unlock(&pager->mutex);
+    return;
+  }
 
-    log_debug("page %d loaded...", page_num);
-    pager->pages[page_num] = page;
+  // Reading more pages than half the pool would evict pages read ahead by
+  // the same batch
+  if (count > pager->max_frames / 2) {
+    count = pager->max_frames / 2;
+  }
 
-    log_debug("setting num_pages to %d...", page_num + 1);
-    if (page_num >= pager->num_pages) {
-      pager->num_pages = page_num + 1;
+  struct iovec *iov = malloc(count * sizeof(struct iovec));
+  IoRequest *requests = malloc(count * sizeof(IoRequest));
+  uint32_t *read_page_nums = malloc(count * sizeof(uint32_t));
+  uint32_t num_requests = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t page_num = page_nums[i];
+    uint32_t frame_index = PAGER_INVALID_FRAME;
+    // Writing back a victim releases the mutex, in the meantime another
+    // thread may have read the page
+    while (frame_index == PAGER_INVALID_FRAME &&
+           page_num < num_pages_on_disk &&
+           pager_lookup_frame(pager, page_num) == PAGER_INVALID_FRAME) {
+      frame_index = pager_allocate_frame(pager);
+    }
+    if (frame_index == PAGER_INVALID_FRAME) {
+      continue;
+    }
+
+    PagerFrame *frame = pager->frames[frame_index];
+    frame->page_num = page_num;
+    frame->dirty = false;
+    frame->uncommitted = false;
+    pager_reference(frame);
+    frame->io_in_progress = true;
+    pager_pin(frame);
+    pager_hash_insert(pager, frame_index);
+
+    iov[num_requests].iov_base = frame->page;
+    iov[num_requests].iov_len = pager->page_size;
+    requests[num_requests].iov = &iov[num_requests];
+    requests[num_requests].iovcnt = 1;
+    requests[num_requests].offset = (off_t)page_num * pager->page_size;
+    read_page_nums[num_requests] = page_num;
+    num_requests++;
+  }
+  pthread_mutex_unlock(&pager->mutex);
+
+  uint32_t num_verified = 0;
+  if (num_requests > 0) {
+    log_debug("reading ahead %d pages...", num_requests);
+    pager_wait_readers(pager);
+    ssize_t bytes_read = io_readv_batch(pager->ring, pager->file_descriptor,
+                                        requests, num_requests);
+    if (bytes_read != (ssize_t)num_requests * pager->page_size) {
+      log_error("error reading ahead: %m");
+      exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < num_requests; i++) {
+      num_verified += pager_verify_page(pager, read_page_nums[i],
+                                        iov[i].iov_base);
     }
   }
 
-  log_debug("page %d found...", page_num);
+  pthread_mutex_lock(&pager->mutex);
+  for (uint32_t i = 0; i < num_requests; i++) {
+    pager_end_io(pager, read_page_nums[i]);
+  }
+  pager->stats.prefetches += num_requests;
+  pager->stats.pages_verified += num_verified;
+  pthread_mutex_unlock(&pager->mutex);
 
-  return pager->pages[page_num];
+  free(read_page_nums);
+  free(requests);
+  free(iov);
 }
 
-void pager_flush(Pager *pager, uint32_t page_num) {
-  log_debug("flushing page %d...", page_num);
-  if (pager->pages[page_num] == NULL) {
-    log_error("tried to flush null page");
-    exit(EXIT_FAILURE);
+// A scan is sequential when it moves to the page right after the previous
+// one, which is how leaves are laid out when rows are appended. The window
+// starts small, in case the scan stops after a few pages, and doubles every
+// time the scan reaches the second half of the pages read ahead.
+bool pager_readahead(Pager *pager, uint32_t page_num) {
+  pthread_mutex_lock(&pager->mutex);
+  PagerReadahead *readahead = &pager->readahead;
+  bool sequential = page_num == readahead->next_page_num;
+  readahead->next_page_num = page_num + 1;
+  if (!sequential) {
+    log_debug("scan moved to page %d, restarting readahead...", page_num);
+    readahead->window = PAGER_READAHEAD_MIN_PAGES;
+    readahead->end_page_num = page_num + 1;
+  } else if (page_num + readahead->window / 2 < readahead->end_page_num) {
+    pthread_mutex_unlock(&pager->mutex);
+    return true;
+  } else if (readahead->window < PAGER_READAHEAD_PAGES) {
+    readahead->window *= 2;
   }
 
-  log_debug("flushed page %d", page_num);
+  uint32_t num_pages_on_disk = pager->file_length / pager->page_size;
+  uint32_t from = readahead->end_page_num > page_num + 1
+                      ? readahead->end_page_num
+                      : page_num + 1;
+  uint32_t to = page_num + 1 + readahead->window;
+  if (to > num_pages_on_disk) {
+    to = num_pages_on_disk;
+  }
+  if (from >= to) {
+    pthread_mutex_unlock(&pager->mutex);
+    return sequential;
+  }
+  readahead->end_page_num = to;
 
-  log_debug("seeking to page %d...", page_num);
-  off_t offset =
-      lseek(pager->file_descriptor, page_num * PAGER_PAGE_SIZE, SEEK_SET);
-  if (offset == -1) {
-    log_error("error seeking: %m");
+  log_debug("reading ahead pages %d to %d...", from, to - 1);
+  if (pager->ring != NULL) {
+    // The batch is read without the mutex, which must not be held twice then
+    pthread_mutex_unlock(&pager->mutex);
+    uint32_t page_nums[PAGER_READAHEAD_PAGES];
+    for (uint32_t i = 0; i < to - from; i++) {
+      page_nums[i] = from + i;
+    }
+    pager_prefetch(pager, page_nums, to - from);
+    return sequential;
+  }
+  if (pager->map != NULL) {
+    madvise(pager->map->base + (size_t)from * pager->page_size,
+            (size_t)(to - from) * pager->page_size, MADV_WILLNEED);
+    pager->stats.prefetches += to - from;
+  } else {
+    // A single hint for the whole range lets the kernel issue large reads
+    posix_fadvise(pager->file_descriptor, (off_t)from * pager->page_size,
+                  (off_t)(to - from) * pager->page_size, POSIX_FADV_WILLNEED);
+    pager->stats.prefetches += to - from;
+  }
+  pthread_mutex_unlock(&pager->mutex);
+  return sequential;
+}
+
+// Starting a new epoch unpins every frame used in the previous one. Frames
+// allocated beyond the budget while everything was pinned are evicted now,
+// unless they hold uncommitted pages.
+void pager_unpin_all(Pager *pager) {
+  log_debug("unpinning all pages...");
+  pthread_mutex_lock(&pager->mutex);
+  pager->epoch++;
+
+  while (pager->num_frames > pager->max_frames) {
+    uint32_t victim = pager_find_victim(pager);
+    if (victim == PAGER_INVALID_FRAME) {
+      log_debug("remaining frames hold uncommitted pages...");
+      break;
+    }
+    if (pager->frames[victim]->dirty) {
+      pager_write_back(pager, victim);
+      continue;
+    }
+    // The frame is kept for later growth rather than freed, since threads
+    // reading without the mutex may still be looking at it
+    uint32_t last = pager->num_frames - 1;
+    PagerFrame *frame = pager->frames[victim];
+    pager_evict_frame(pager, victim);
+    frame->page_num = PAGER_NO_PAGE;
+    pager_release_latch(&frame->latch);
+
+    if (victim != last) {
+      log_debug("moving frame %d into frame %d...", last, victim);
+      pager->frames[victim] = pager->frames[last];
+      pager->frames[victim]->index = victim;
+      pager->frames[last] = frame;
+      frame->index = last;
+    }
+    pager->num_frames--;
+    pager->clock_hand = 0;
+  }
+  pthread_mutex_unlock(&pager->mutex);
+}
+
+void pager_mark_dirty(Pager *pager, uint32_t page_num) {
+  pthread_mutex_lock(&pager->mutex);
+  if (pager->map != NULL) {
+    PagerMap *map = pager->map;
+    if (!(map->page_flags[page_num] & PAGER_PAGE_DIRTY)) {
+      map->dirty_pages[map->num_dirty_pages++] = page_num;
+    }
+    if (!(map->page_flags[page_num] & PAGER_PAGE_UNCOMMITTED)) {
+      map->uncommitted_pages[map->num_uncommitted_pages++] = page_num;
+    }
+    map->page_flags[page_num] |= PAGER_PAGE_DIRTY | PAGER_PAGE_UNCOMMITTED;
+    pthread_mutex_unlock(&pager->mutex);
+    return;
+  }
+
+  uint32_t frame_index = pager_lookup_frame(pager, page_num);
+  if (frame_index == PAGER_INVALID_FRAME) {
+    log_error("tried to mark page %d which is not cached as dirty", page_num);
     exit(EXIT_FAILURE);
   }
+  pager->frames[frame_index]->dirty = true;
+  pager->frames[frame_index]->uncommitted = true;
+  pthread_mutex_unlock(&pager->mutex);
+}
 
-  log_debug("writing page %d...", page_num);
-  ssize_t bytes_written =
-      write(pager->file_descriptor, pager->pages[page_num], PAGER_PAGE_SIZE);
+void pager_flush(Pager *pager, uint32_t page_num) {
+  log_debug("flushing page %d...", page_num);
+  pthread_mutex_lock(&pager->mutex);
+  if (pager->map != NULL) {
+    // Single pages are only flushed by the buffer pool, a mapped page is
+    // written by the next pager_flush_all()
+    pthread_mutex_unlock(&pager->mutex);
+    return;
+  }
 
-  if (bytes_written == -1) {
-    log_error("error writing page: %m");
+  uint32_t frame_index = pager_lookup_frame(pager, page_num);
+  if (frame_index == PAGER_INVALID_FRAME) {
+    log_error("tried to flush page %d which is not cached", page_num);
     exit(EXIT_FAILURE);
   }
 
+  if (!pager->frames[frame_index]->dirty) {
+    log_debug("page %d is clean, skipping...", page_num);
+    pthread_mutex_unlock(&pager->mutex);
+    return;
+  }
+
+  pager_write_frame(pager, pager->frames[frame_index]);
+
   log_debug("written page %d", page_num);
+  pthread_mutex_unlock(&pager->mutex);
+}
+
+// Dirty pages are sorted by page number so that runs of adjacent pages can be
+// written with one pwritev() call each instead of one write per page
+void pager_flush_all(Pager *pager) {
+  log_debug("collecting dirty pages...");
+  pthread_mutex_lock(&pager->mutex);
+  PagerMap *map = pager->map;
+  uint32_t num_dirty = 0;
+  PagerDirtyPage *dirty_pages;
+
+  if (map != NULL) {
+    dirty_pages = malloc(map->num_dirty_pages * sizeof(PagerDirtyPage));
+    for (uint32_t i = 0; i < map->num_dirty_pages; i++) {
+      uint32_t page_num = map->dirty_pages[i];
+      dirty_pages[num_dirty].page_num = page_num;
+      dirty_pages[num_dirty].page =
+          map->base + (size_t)page_num * pager->page_size;
+      num_dirty++;
+      map->page_flags[page_num] &= ~PAGER_PAGE_DIRTY;
+    }
+    map->num_dirty_pages = 0;
+  } else {
+    dirty_pages = malloc(pager->num_frames * sizeof(PagerDirtyPage));
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+      PagerFrame *frame = pager->frames[i];
+      if (frame->dirty) {
+        dirty_pages[num_dirty].page_num = frame->page_num;
+        dirty_pages[num_dirty].page = frame->page;
+        num_dirty++;
+        frame->dirty = false;
+      }
+    }
+  }
+
+  pager_write_dirty_pages(pager, dirty_pages, num_dirty);
+  free(dirty_pages);
+  pthread_mutex_unlock(&pager->mutex);
 }
 
-// News pages are always appended to the end of the database file until we start
-// recycling free pages.
+bool pager_page_size_valid(uint32_t page_size) {
+  return page_size >= PAGER_MIN_PAGE_SIZE && page_size <= PAGER_MAX_PAGE_SIZE &&
+         (page_size & (page_size - 1)) == 0;
+}
+
+void pager_init_header(Pager *pager, PagerChecksumType checksum_type) {
+  log_debug("initializing file header...");
+  PagerHeader *header = &pager->header;
+  memset(header, 0, sizeof(PagerHeader));
+  memcpy(header->magic, PAGER_HEADER_MAGIC, sizeof(header->magic));
+  header->version = PAGER_FORMAT_VERSION;
+  header->page_size = pager->page_size;
+  pager_set_checksum_type(pager, checksum_type);
+  pager_write_header(pager);
+}
+
+void pager_write_header(Pager *pager) {
+  void *page = pager_get_page(pager, PAGER_HEADER_PAGE_NUM);
+  memcpy(page, &pager->header, sizeof(PagerHeader));
+  pager_mark_dirty(pager, PAGER_HEADER_PAGE_NUM);
+}
+
+// The freelist is a chain of free pages starting at the header. The most
+// recently freed page is reused first, it is the most likely to still be
+// cached, and it is read anyway to be reused. A reused page is cleared so that
+// it no longer looks free, new pages are appended to the end of the file. A
+// bulk load only appends, so that a crash can drop every page it wrote.
+//
+// The header only changes in the thread that modifies the database. The mutex
+// is not held while a page is got, which may wait for another thread's I/O.
 uint32_t pager_get_unused_page_num(Pager *pager) {
   log_debug("getting unused page number...");
-  return pager->num_pages;
+  PagerHeader *header = &pager->header;
+  if (header->freelist_head == 0 || header->bulk_start_page != 0) {
+    pthread_mutex_lock(&pager->mutex);
+    uint32_t page_num = pager->num_pages;
+    pthread_mutex_unlock(&pager->mutex);
+    return page_num;
+  }
+
+  uint32_t page_num = header->freelist_head;
+  log_debug("reusing free page %d...", page_num);
+  uint32_t *page = pager_get_page(pager, page_num);
+  if (page[0] != PAGER_FREE_PAGE_MARKER) {
+    log_error("page %d on the freelist is not free: corrupt file", page_num);
+    exit(EXIT_FAILURE);
+  }
+  header->freelist_head = page[1];
+  header->freelist_count--;
+  pager_write_header(pager);
+
+  memset(page, 0, pager->page_size);
+  pager_mark_dirty(pager, page_num);
+  pthread_mutex_lock(&pager->mutex);
+  pager->stats.pages_reused++;
+  pthread_mutex_unlock(&pager->mutex);
+  return page_num;
+}
+
+// A free page holds the marker and the number of the next free page, so the
+// freelist is made durable by the commit that frees the page
+void pager_free_page(Pager *pager, uint32_t page_num) {
+  log_debug("freeing page %d...", page_num);
+  PagerHeader *header = &pager->header;
+  uint32_t *page = pager_get_page(pager, page_num);
+  memset(page, 0, pager->page_size);
+  page[0] = PAGER_FREE_PAGE_MARKER;
+  page[1] = header->freelist_head;
+  pager_mark_dirty(pager, page_num);
+
+  header->freelist_head = page_num;
+  header->freelist_count++;
+  pager_write_header(pager);
+}
+
+// Pages modified since the last commit are appended to the log, which is much
+// cheaper than writing them at their place in the database file. They stay
+// dirty in the buffer pool until they are evicted or checkpointed. Pages are
+// checksummed before they are logged since recovery copies them to the file
+// as they are.
+void pager_commit(Pager *pager) {
+  log_debug("committing...");
+  pthread_mutex_lock(&pager->mutex);
+  PagerMap *map = pager->map;
+  uint32_t count = 0;
+  if (map != NULL) {
+    count = map->num_uncommitted_pages;
+  } else {
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+      if (pager->frames[i]->uncommitted) {
+        count++;
+      }
+    }
+  }
+  if (count == 0) {
+    log_debug("nothing to commit");
+    pthread_mutex_unlock(&pager->mutex);
+    return;
+  }
+
+  void **pages = malloc(count * sizeof(void *));
+  uint32_t *page_nums = malloc(count * sizeof(uint32_t));
+  if (map != NULL) {
+    for (uint32_t i = 0; i < count; i++) {
+      page_nums[i] = map->uncommitted_pages[i];
+      pages[i] = map->base + (size_t)page_nums[i] * pager->page_size;
+      pager_stamp_page(pager, page_nums[i], pages[i]);
+      map->page_flags[page_nums[i]] &= ~PAGER_PAGE_UNCOMMITTED;
+    }
+    map->num_uncommitted_pages = 0;
+  } else {
+    uint32_t index = 0;
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+      PagerFrame *frame = pager->frames[i];
+      if (frame->uncommitted) {
+        pages[index] = frame->page;
+        page_nums[index] = frame->page_num;
+        pager_stamp_page(pager, frame->page_num, frame->page);
+        frame->uncommitted = false;
+        index++;
+      }
+    }
+  }
+
+  wal_commit(pager->wal, pages, page_nums, count, pager->num_pages);
+  free(pages);
+  free(page_nums);
+
+  if (pager->wal->num_frames >= WAL_CHECKPOINT_FRAMES) {
+    pager_checkpoint(pager);
+  }
+  pthread_mutex_unlock(&pager->mutex);
+}
+
+void pager_sync(Pager *pager) {
+  pthread_mutex_lock(&pager->mutex);
+  wal_sync(pager->wal);
+  pthread_mutex_unlock(&pager->mutex);
+}
+
+// A checkpoint writes the dirty pages to the database file and syncs it, after
+// which the log is no longer needed for recovery and can be restarted
+void pager_checkpoint(Pager *pager) {
+  log_debug("checkpointing...");
+  pthread_mutex_lock(&pager->mutex);
+  wal_sync(pager->wal);
+  pager_flush_all(pager);
+  if (fsync(pager->file_descriptor) == -1) {
+    log_error("error syncing database file: %m");
+    exit(EXIT_FAILURE);
+  }
+  wal_reset(pager->wal);
+
+  if (pager->map != NULL) {
+    pager_map_refresh(pager);
+  }
+  pthread_mutex_unlock(&pager->mutex);
+}
+
+// The header is checkpointed before any page of the load reaches the file, so
+// that recovery knows which pages to drop, and the pages written before the
+// load are all clean
+void pager_bulk_begin(Pager *pager) {
+  pthread_mutex_lock(&pager->mutex);
+  log_debug("starting bulk load at page %d...", pager->num_pages);
+  pager->header.bulk_start_page = pager->num_pages;
+  pager_write_header(pager);
+  pager_commit(pager);
+  pager_checkpoint(pager);
+  pthread_mutex_unlock(&pager->mutex);
+}
+
+// Pages of the load are unreachable until the load commits, so writing them
+// at their place in the file is as safe as logging them, and done once
+void pager_bulk_write(Pager *pager) {
+  log_debug("collecting pages of the bulk load...");
+  pthread_mutex_lock(&pager->mutex);
+  uint32_t bulk_start_page = pager->header.bulk_start_page;
+  PagerMap *map = pager->map;
+  uint32_t num_dirty = 0;
+  PagerDirtyPage *dirty_pages;
+
+  if (map != NULL) {
+    dirty_pages = malloc(map->num_dirty_pages * sizeof(PagerDirtyPage));
+    uint32_t num_kept = 0;
+    for (uint32_t i = 0; i < map->num_dirty_pages; i++) {
+      uint32_t page_num = map->dirty_pages[i];
+      if (page_num < bulk_start_page) {
+        map->dirty_pages[num_kept++] = page_num;
+        continue;
+      }
+      dirty_pages[num_dirty].page_num = page_num;
+      dirty_pages[num_dirty].page =
+          map->base + (size_t)page_num * pager->page_size;
+      num_dirty++;
+      map->page_flags[page_num] &= ~PAGER_PAGE_DIRTY;
+    }
+    map->num_dirty_pages = num_kept;
+    num_kept = 0;
+    for (uint32_t i = 0; i < map->num_uncommitted_pages; i++) {
+      uint32_t page_num = map->uncommitted_pages[i];
+      if (page_num < bulk_start_page) {
+        map->uncommitted_pages[num_kept++] = page_num;
+        continue;
+      }
+      map->page_flags[page_num] &= ~PAGER_PAGE_UNCOMMITTED;
+    }
+    map->num_uncommitted_pages = num_kept;
+  } else {
+    dirty_pages = malloc(pager->num_frames * sizeof(PagerDirtyPage));
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+      PagerFrame *frame = pager->frames[i];
+      if (frame->dirty && frame->page_num >= bulk_start_page) {
+        dirty_pages[num_dirty].page_num = frame->page_num;
+        dirty_pages[num_dirty].page = frame->page;
+        num_dirty++;
+        frame->dirty = false;
+        frame->uncommitted = false;
+      }
+    }
+  }
+
+  pager_write_dirty_pages(pager, dirty_pages, num_dirty);
+  free(dirty_pages);
+  // The pages written go back to the OS page cache once every page is clean
+  if (map != NULL && map->num_dirty_pages == 0) {
+    pager_map_refresh(pager);
+  }
+  pthread_mutex_unlock(&pager->mutex);
+}
+
+void pager_bulk_end(Pager *pager) {
+  pthread_mutex_lock(&pager->mutex);
+  pager_bulk_write(pager);
+  log_debug("syncing pages of the bulk load...");
+  if (fsync(pager->file_descriptor) == -1) {
+    log_error("error syncing database file: %m");
+    exit(EXIT_FAILURE);
+  }
+  pager->header.bulk_start_page = 0;
+  pager_write_header(pager);
+  pthread_mutex_unlock(&pager->mutex);
+}
+
+static void pager_print_checksum_stats(Pager *pager) {
+  if (pager->header.checksum_type == PAGER_CHECKSUM_NONE) {
+    printf("- page checksums: off\n");
+    return;
+  }
+  printf("- page checksums: crc32c (%s)%s\n", checksum_crc32c_implementation(),
+         pager->verify_checksums ? "" : ", not verified");
+  printf("- pages verified: %" PRIu64 "\n", pager->stats.pages_verified);
+}
+
+void pager_print_stats(Pager *pager) {
+  if (pager->map != NULL) {
+    printf("Memory map:\n");
+    printf("- mapped pages: %d\n", pager->map->mapped_pages);
+    printf("- file pages: %d\n", pager->map->file_pages);
+    printf("- dirty pages: %d\n", pager->map->num_dirty_pages);
+    printf("- pages written: %" PRIu64 "\n", pager->stats.pages_written);
+    printf("- write calls: %" PRIu64 "\n", pager->stats.write_calls);
+    printf("- pages read ahead: %" PRIu64 "\n", pager->stats.prefetches);
+    printf("- free pages: %d\n", pager->header.freelist_count);
+    printf("- pages reused: %" PRIu64 "\n", pager->stats.pages_reused);
+    pager_print_checksum_stats(pager);
+    wal_print_stats(pager->wal);
+    return;
+  }
+
+  uint64_t hits = pager->stats.hits + pager_counter_sum(&pager->lookup_hits);
+  uint64_t accesses = hits + pager->stats.misses;
+  printf("Buffer pool:\n");
+  printf("- frames: %d/%d\n", pager->num_frames, pager->max_frames);
+  printf("- hits: %" PRIu64 "\n", hits);
+  printf("- misses: %" PRIu64 "\n", pager->stats.misses);
+  printf("- hit ratio: %.2f%%\n",
+         accesses > 0 ? 100.0 * (double)hits / (double)accesses : 0.0);
+  printf("- evictions: %" PRIu64 "\n", pager->stats.evictions);
+  printf("- writebacks: %" PRIu64 "\n", pager->stats.writebacks);
+  printf("- pages written: %" PRIu64 "\n", pager->stats.pages_written);
+  printf("- write calls: %" PRIu64 "\n", pager->stats.write_calls);
+  printf("- pages read ahead: %" PRIu64 "\n", pager->stats.prefetches);
+  printf("- free pages: %d\n", pager->header.freelist_count);
+  printf("- pages reused: %" PRIu64 "\n", pager->stats.pages_reused);
+  printf("- asynchronous I/O: %s\n", pager->ring != NULL ? "io_uring" : "off");
+  pager_print_checksum_stats(pager);
+  wal_print_stats(pager->wal);
 }
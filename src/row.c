@@ -1,23 +1,69 @@
 #include "../include/row.h"
 #include "../lib/log/log.h"
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-// strncpy initializes all bytes even if the string is shorter than the size
-void row_serialize(Row *source, void *destination) {
+static uint32_t row_write_varint(uint8_t *destination, uint32_t value) {
+  uint32_t size = 0;
+  while (value >= 0x80) {
+    destination[size++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  destination[size++] = (uint8_t)value;
+  return size;
+}
+
+static uint32_t row_read_varint(const uint8_t *source, uint32_t *value) {
+  uint32_t size = 0;
+  uint32_t shift = 0;
+  *value = 0;
+  do {
+    *value |= (uint32_t)(source[size] & 0x7f) << shift;
+    shift += 7;
+  } while (source[size++] & 0x80 && size < ROW_ID_MAX_SIZE);
+  return size;
+}
+
+static uint32_t row_write_string(uint8_t *destination, const char *source) {
+  uint32_t length = strlen(source);
+  uint32_t size = row_write_varint(destination, length);
+  memcpy(destination + size, source, length);
+  return size + length;
+}
+
+// The length comes from the page, a corrupted one must not overflow the column
+static uint32_t row_read_string(const uint8_t *source, char *destination,
+                                uint32_t max_length) {
+  uint32_t length;
+  uint32_t size = row_read_varint(source, &length);
+  if (length > max_length) {
+    log_error("row column of %d bytes is longer than %d bytes", length,
+              max_length);
+    exit(EXIT_FAILURE);
+  }
+  memcpy(destination, source + size, length);
+  destination[length] = '\0';
+  return size + length;
+}
+
+uint32_t row_serialize(Row *source, void *destination) {
   log_debug("serializing row...");
-  memcpy(destination + ROW_ID_OFFSET, &(source->id), ROW_ID_SIZE);
-  strncpy(destination + ROW_USERNAME_OFFSET, source->username,
-          ROW_USERNAME_SIZE);
-  strncpy(destination + ROW_EMAIL_OFFSET, source->email, ROW_EMAIL_SIZE);
+  uint8_t *bytes = destination;
+  uint32_t size = row_write_varint(bytes, source->id);
+  size += row_write_string(bytes + size, source->username);
+  size += row_write_string(bytes + size, source->email);
+  return size;
 }
 
 void row_deserialize(void *source, Row *destination) {
   log_debug("deserializing row...");
-  memcpy(&(destination->id), source + ROW_ID_OFFSET, ROW_ID_SIZE);
-  memcpy(&(destination->username), source + ROW_USERNAME_OFFSET,
-         ROW_USERNAME_SIZE);
-  memcpy(&(destination->email), source + ROW_EMAIL_OFFSET, ROW_EMAIL_SIZE);
+  const uint8_t *bytes = source;
+  uint32_t size = row_read_varint(bytes, &destination->id);
+  size += row_read_string(bytes + size, destination->username,
+                          ROW_COLUMN_USERNAME_SIZE);
+  row_read_string(bytes + size, destination->email, ROW_COLUMN_EMAIL_SIZE);
 }
 
 void row_print(Row *row) {
@@ -0,0 +1,145 @@
+#include "../include/search.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SEARCH_HAVE_X86 1
+#else
+#define SEARCH_HAVE_X86 0
+#endif
+
+// Keys are not always aligned, e.g. in leaf cells
+static inline uint32_t search_key_at(const void *keys, size_t stride,
+                                     uint32_t index) {
+  uint32_t key;
+  memcpy(&key, (const uint8_t *)keys + stride * index, sizeof(key));
+  return key;
+}
+
+uint32_t search_lower_bound_scalar(const void *keys, uint32_t count,
+                                   size_t stride, uint32_t key) {
+  uint32_t min_index = 0;
+  uint32_t max_index = count;
+  while (min_index != max_index) {
+    uint32_t index = (min_index + max_index) / 2;
+    if (search_key_at(keys, stride, index) >= key) {
+      max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+  return min_index;
+}
+
+// Halve the range until it is short enough to be scanned, the comparison
+// selects the next half without a branch the CPU could mispredict. Returns
+// the start of the range and leaves its length in count.
+static inline uint32_t search_narrow(const void *keys, uint32_t *count,
+                                     size_t stride, uint32_t key) {
+  uint32_t base = 0;
+  uint32_t length = *count;
+  while (length > SEARCH_LINEAR_KEYS) {
+    uint32_t half = length / 2;
+    base = search_key_at(keys, stride, base + half - 1) < key ? base + half
+                                                              : base;
+    length -= half;
+  }
+  *count = length;
+  return base;
+}
+
+static inline uint32_t search_count_less(const void *keys, uint32_t from,
+                                         uint32_t to, size_t stride,
+                                         uint32_t key) {
+  uint32_t less = 0;
+  for (uint32_t i = from; i < to; i++) {
+    less += search_key_at(keys, stride, i) < key;
+  }
+  return less;
+}
+
+#if SEARCH_HAVE_X86
+// There are only signed comparisons of 32-bit integers, flipping the sign bit
+// of both sides orders unsigned keys the same way
+static const uint32_t SEARCH_SIGN_BIT = 0x80000000U;
+
+__attribute__((target("avx2"))) static uint32_t
+search_count_less_avx2(const void *keys, uint32_t from, uint32_t to,
+                       size_t stride, uint32_t key) {
+  const __m256i sign = _mm256_set1_epi32((int)SEARCH_SIGN_BIT);
+  const __m256i needle = _mm256_set1_epi32((int)(key ^ SEARCH_SIGN_BIT));
+  // Keys in pairs are in every other lane
+  const uint32_t keys_per_vector = stride == sizeof(uint32_t) ? 8 : 4;
+  const int lane_mask = stride == sizeof(uint32_t) ? 0xff : 0x55;
+  // The last word loaded follows the last key of the vector, it must belong
+  // to the range when the keys are in pairs
+  const uint32_t keys_needed = keys_per_vector + (keys_per_vector == 4);
+  uint32_t less = 0;
+  uint32_t i = from;
+  for (; i + keys_needed <= to; i += keys_per_vector) {
+    __m256i vector = _mm256_loadu_si256(
+        (const __m256i *)((const uint8_t *)keys + stride * i));
+    __m256i greater =
+        _mm256_cmpgt_epi32(needle, _mm256_xor_si256(vector, sign));
+    less += __builtin_popcount(
+        _mm256_movemask_ps(_mm256_castsi256_ps(greater)) & lane_mask);
+  }
+  return less + search_count_less(keys, i, to, stride, key);
+}
+
+static uint32_t search_count_less_sse2(const void *keys, uint32_t from,
+                                       uint32_t to, size_t stride,
+                                       uint32_t key) {
+  const __m128i sign = _mm_set1_epi32((int)SEARCH_SIGN_BIT);
+  const __m128i needle = _mm_set1_epi32((int)(key ^ SEARCH_SIGN_BIT));
+  const uint32_t keys_per_vector = stride == sizeof(uint32_t) ? 4 : 2;
+  const int lane_mask = stride == sizeof(uint32_t) ? 0xf : 0x5;
+  const uint32_t keys_needed = keys_per_vector + (keys_per_vector == 2);
+  uint32_t less = 0;
+  uint32_t i = from;
+  for (; i + keys_needed <= to; i += keys_per_vector) {
+    __m128i vector =
+        _mm_loadu_si128((const __m128i *)((const uint8_t *)keys + stride * i));
+    __m128i greater = _mm_cmpgt_epi32(needle, _mm_xor_si128(vector, sign));
+    less += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(greater)) &
+                               lane_mask);
+  }
+  return less + search_count_less(keys, i, to, stride, key);
+}
+#endif
+
+// The CPU is queried on every call, which costs a load and a test once the
+// compiler runtime has identified it at startup
+static bool search_have_avx2(void) {
+#if SEARCH_HAVE_X86
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+uint32_t search_lower_bound(const void *keys, uint32_t count, size_t stride,
+                            uint32_t key) {
+  uint32_t base = search_narrow(keys, &count, stride, key);
+#if SEARCH_HAVE_X86
+  // Vectors load the words of pairs too, the key is the first one
+  if (stride == sizeof(uint32_t) || stride == 2 * sizeof(uint32_t)) {
+    if (search_have_avx2()) {
+      return base +
+             search_count_less_avx2(keys, base, base + count, stride, key);
+    }
+    return base + search_count_less_sse2(keys, base, base + count, stride, key);
+  }
+#endif
+  return base + search_count_less(keys, base, base + count, stride, key);
+}
+
+const char *search_implementation(void) {
+  if (!SEARCH_HAVE_X86) {
+    return "scalar";
+  }
+  return search_have_avx2() ? "avx2" : "sse2";
+}
@@ -5,6 +5,7 @@
 #include "../include/pager.h"
 #include "../include/row.h"
 #include "../lib/log/log.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,10 +21,13 @@ StatementPrepareResult statement_prepare(char *query, Statement *statement) {
     log_debug("preparing insert statement...");
     return statement_prepare_insert(query, statement);
   }
-  if (strcmp(query, "select") == 0) {
+  if (strncmp(query, "delete", STATEMENT_DELETE_COMMAND_SIZE) == 0) {
+    log_debug("preparing delete statement...");
+    return statement_prepare_delete(query, statement);
+  }
+  if (strncmp(query, "select", STATEMENT_SELECT_COMMAND_SIZE) == 0) {
     log_debug("preparing select statement...");
-    statement->type = STATEMENT_SELECT;
-    return STATEMENT_PREPARE_SUCCESS;
+    return statement_prepare_select(query, statement);
   }
 
   log_warn("could not recognize statement...");
@@ -66,39 +70,185 @@ StatementPrepareResult statement_prepare_insert(char *query,
   return STATEMENT_PREPARE_SUCCESS;
 }
 
+// Parse an id of a where clause
+static StatementPrepareResult statement_prepare_id(const char *string,
+                                                   uint32_t *id) {
+  if (string == NULL) {
+    return STATEMENT_PREPARE_SYNTAX_ERROR;
+  }
+  char *end;
+  long long value = strtoll(string, &end, 10);
+  if (*end != '\0' || end == string || value > UINT32_MAX) {
+    return STATEMENT_PREPARE_SYNTAX_ERROR;
+  }
+  if (value < 0) {
+    return STATEMENT_PREPARE_NEGATIVE_ID;
+  }
+  *id = (uint32_t)value;
+  return STATEMENT_PREPARE_SUCCESS;
+}
+
+// Parse a where clause, either "where id = <id>" or "where id between <id> and
+// <id>", into a range of ids. The where keyword has already been read.
+static StatementPrepareResult statement_prepare_where(Statement *statement,
+                                                      const char *where) {
+  log_debug("parsing where clause...");
+  char *column = strtok(NULL, " ");
+  char *comparison = strtok(NULL, " ");
+  if (where == NULL || column == NULL || comparison == NULL ||
+      strcmp(where, "where") != 0 || strcmp(column, "id") != 0) {
+    return STATEMENT_PREPARE_SYNTAX_ERROR;
+  }
+
+  StatementPrepareResult result;
+  if (strcmp(comparison, "=") == 0) {
+    result = statement_prepare_id(strtok(NULL, " "), &statement->min_id);
+    statement->max_id = statement->min_id;
+  } else if (strcmp(comparison, "between") == 0) {
+    result = statement_prepare_id(strtok(NULL, " "), &statement->min_id);
+    char *and = strtok(NULL, " ");
+    if (result == STATEMENT_PREPARE_SUCCESS &&
+        (and == NULL || strcmp(and, "and") != 0)) {
+      return STATEMENT_PREPARE_SYNTAX_ERROR;
+    }
+    if (result == STATEMENT_PREPARE_SUCCESS) {
+      result = statement_prepare_id(strtok(NULL, " "), &statement->max_id);
+    }
+  } else {
+    return STATEMENT_PREPARE_SYNTAX_ERROR;
+  }
+  return result;
+}
+
+// Every clause of a select is optional, a select without any returns every row
+// in increasing order of id. The clauses are "where" as for a delete, then
+// "order by id [asc|desc]" and "limit <count>".
+StatementPrepareResult statement_prepare_select(char *query,
+                                                Statement *statement) {
+  statement->type = STATEMENT_SELECT;
+  statement->min_id = 0;
+  statement->max_id = UINT32_MAX;
+  statement->descending = false;
+  statement->limit = UINT32_MAX;
+
+  log_debug("parsing select statement...");
+  char *keyword = strtok(query, " ");
+  if (strcmp(keyword, "select") != 0) {
+    return STATEMENT_PREPARE_UNRECOGNIZED;
+  }
+
+  char *token = strtok(NULL, " ");
+  if (token != NULL && strcmp(token, "where") == 0) {
+    StatementPrepareResult result = statement_prepare_where(statement, token);
+    if (result != STATEMENT_PREPARE_SUCCESS) {
+      return result;
+    }
+    token = strtok(NULL, " ");
+  }
+
+  if (token != NULL && strcmp(token, "order") == 0) {
+    log_debug("parsing order by clause...");
+    char *by = strtok(NULL, " ");
+    char *column = strtok(NULL, " ");
+    if (by == NULL || column == NULL || strcmp(by, "by") != 0 ||
+        strcmp(column, "id") != 0) {
+      return STATEMENT_PREPARE_SYNTAX_ERROR;
+    }
+    token = strtok(NULL, " ");
+    if (token != NULL && strcmp(token, "desc") == 0) {
+      statement->descending = true;
+      token = strtok(NULL, " ");
+    } else if (token != NULL && strcmp(token, "asc") == 0) {
+      token = strtok(NULL, " ");
+    }
+  }
+
+  if (token != NULL && strcmp(token, "limit") == 0) {
+    log_debug("parsing limit clause...");
+    if (statement_prepare_id(strtok(NULL, " "), &statement->limit) !=
+        STATEMENT_PREPARE_SUCCESS) {
+      return STATEMENT_PREPARE_SYNTAX_ERROR;
+    }
+    token = strtok(NULL, " ");
+  }
+
+  if (token != NULL) {
+    return STATEMENT_PREPARE_SYNTAX_ERROR;
+  }
+  return STATEMENT_PREPARE_SUCCESS;
+}
+
+StatementPrepareResult statement_prepare_delete(char *query,
+                                                Statement *statement) {
+  statement->type = STATEMENT_DELETE;
+
+  log_debug("parsing delete statement...");
+  char *keyword = strtok(query, " ");
+  if (strcmp(keyword, "delete") != 0) {
+    return STATEMENT_PREPARE_UNRECOGNIZED;
+  }
+  StatementPrepareResult result =
+      statement_prepare_where(statement, strtok(NULL, " "));
+  if (result == STATEMENT_PREPARE_SUCCESS && strtok(NULL, " ") != NULL) {
+    return STATEMENT_PREPARE_SYNTAX_ERROR;
+  }
+  return result;
+}
+
 // Execute the statement
 // statement_execute roughly corresponds to the Virtual Machine in SQLite
 StatementExecuteResult statement_execute(Statement *statement,
                                          Database *database) {
+  DatabaseLatchMode mode = DATABASE_LATCH_READ;
+  if (statement->type == STATEMENT_INSERT) {
+    mode = DATABASE_LATCH_WRITE;
+  } else if (statement->type == STATEMENT_DELETE) {
+    mode = DATABASE_LATCH_EXCLUSIVE;
+  }
+  database_latch(database, mode);
+  if (mode != DATABASE_LATCH_READ) {
+    // Pages pinned by the previous write can be evicted from now on, readers
+    // keep the pages they use through their latches instead
+    pager_unpin_all(database->pager);
+  }
+
+  StatementExecuteResult result = STATEMENT_EXECUTE_SUCCESS;
   switch (statement->type) {
   case (STATEMENT_INSERT):
     log_debug("requested insert statement...");
-    return statement_execute_insert(statement, database);
+    result = statement_execute_insert(statement, database);
     break;
   case (STATEMENT_SELECT):
     log_debug("requested select statement...");
-    return statement_execute_select(database);
+    result = statement_execute_select(statement, database);
+    break;
+  case (STATEMENT_DELETE):
+    log_debug("requested delete statement...");
+    result = statement_execute_delete(statement, database);
     break;
   default:
     log_error("unknown statement type");
     break;
   }
+
+  database_unlatch(database, mode);
+  return result;
 }
 
 StatementExecuteResult statement_execute_insert(Statement *statement,
                                                 Database *database) {
   log_debug("executing insert statement...");
-  void *node = pager_get_page(database->pager, database->root_page_num);
-  uint32_t num_cells = (*btree_node_leaf_num_cells(node));
-
-  log_debug("serializing row for insert...");
   Row *row_to_insert = &(statement->row_to_insert);
   uint32_t key_to_insert = row_to_insert->id;
   Cursor *cursor = cursor_find_key(database, key_to_insert);
 
+  // The cursor points into the leaf that would hold the key
+  void *node = cursor->node;
+  uint32_t num_cells = (*btree_node_leaf_num_cells(node));
   if (cursor->cell_num < num_cells) {
     uint32_t key_at_index = *btree_node_leaf_key(node, cursor->cell_num);
     if (key_at_index == key_to_insert) {
+      cursor_close(cursor);
       return STATEMENT_EXECUTE_DUPLICATE_KEY;
     }
   }
@@ -107,22 +257,45 @@ StatementExecuteResult statement_execute_insert(Statement *statement,
   btree_node_leaf_insert(cursor, row_to_insert->id, row_to_insert);
   cursor_close(cursor);
 
+  log_debug("committing insert...");
+  pager_commit(database->pager);
+
   log_debug("inserted row %d", row_to_insert->id);
   return STATEMENT_EXECUTE_SUCCESS;
 }
 
-StatementExecuteResult statement_execute_select(Database *database) {
+// The cursor starts at the first row in range, or the last one in descending
+// order, found through the tree, and the scan stops at the first row past the
+// range or once the limit is reached
+StatementExecuteResult statement_execute_select(Statement *statement,
+                                                Database *database) {
   log_debug("executing select statement...");
-  log_debug("getting cursor at end of database...");
-  Cursor *cursor = cursor_start(database);
+  Cursor *cursor;
+  if (statement->descending) {
+    log_debug("getting cursor at id %d...", statement->max_id);
+    cursor = cursor_seek_last(database, statement->max_id);
+  } else if (statement->min_id == 0) {
+    log_debug("getting cursor at start of database...");
+    cursor = cursor_start(database);
+  } else {
+    log_debug("getting cursor at id %d...", statement->min_id);
+    cursor = cursor_seek(database, statement->min_id);
+  }
+  cursor_set_bounds(cursor, statement->min_id, statement->max_id);
 
   Row row;
-  while (!(cursor->end_of_table)) {
+  uint32_t num_rows = 0;
+  while (!(cursor->end_of_table) && num_rows < statement->limit) {
     log_debug("deserializing row...");
-    row_deserialize(cursor_value(cursor), &row);
+    cursor_row(cursor, &row);
     row_print(&row);
-    log_debug("advancing cursor...");
-    cursor_advance(cursor);
+    num_rows++;
+    log_debug("moving cursor...");
+    if (statement->descending) {
+      cursor_retreat(cursor);
+    } else {
+      cursor_advance(cursor);
+    }
   }
 
   log_debug("closing cursor...");
@@ -131,3 +304,16 @@ StatementExecuteResult statement_execute_select(Database *database) {
   log_debug("select statement executed");
   return STATEMENT_EXECUTE_SUCCESS;
 }
+
+StatementExecuteResult statement_execute_delete(Statement *statement,
+                                                Database *database) {
+  log_debug("executing delete statement...");
+  uint32_t num_deleted =
+      btree_delete(database, statement->min_id, statement->max_id);
+
+  log_debug("committing delete...");
+  pager_commit(database->pager);
+
+  log_info("deleted %d rows", num_deleted);
+  return STATEMENT_EXECUTE_SUCCESS;
+}
@@ -0,0 +1,381 @@
+#include "../include/wal.h"
+#include "../include/io.h"
+#include "../include/pager.h"
+#include "../lib/log/log.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const uint32_t WAL_HEADER_SIZE = sizeof(WalHeader);
+static const uint32_t WAL_FRAME_HEADER_SIZE = sizeof(WalFrameHeader);
+
+// Extend a running checksum over a buffer whose size is a multiple of 8
+static void wal_checksum(uint32_t checksum[2], const void *data, size_t size) {
+  const uint32_t *words = data;
+  uint32_t s0 = checksum[0];
+  uint32_t s1 = checksum[1];
+  for (size_t i = 0; i < size / sizeof(uint32_t); i += 2) {
+    s0 += words[i] + s1;
+    s1 += words[i + 1] + s0;
+  }
+  checksum[0] = s0;
+  checksum[1] = s1;
+}
+
+// Compute the checksum of a frame chained to the checksum of the previous one
+static void wal_frame_checksum(uint32_t checksum[2],
+                               const WalFrameHeader *frame_header,
+                               const void *page, uint32_t page_size) {
+  uint32_t fields[4] = {frame_header->page_num, frame_header->database_size,
+                        frame_header->salt, 0};
+  wal_checksum(checksum, fields, sizeof(fields));
+  wal_checksum(checksum, page, page_size);
+}
+
+static void wal_sync_file(Wal *wal) {
+  if (fdatasync(wal->file_descriptor) == -1) {
+    log_error("error syncing log: %m");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static uint64_t wal_now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+// Write a fresh header with a new salt and drop every frame
+static void wal_write_header(Wal *wal) {
+  WalHeader header = {
+      .magic = WAL_MAGIC,
+      .version = WAL_VERSION,
+      .page_size = wal->page_size,
+      .salt = wal->salt,
+  };
+  header.checksum[0] = 0;
+  header.checksum[1] = 0;
+  wal_checksum(header.checksum, &header, offsetof(WalHeader, checksum));
+
+  if (ftruncate(wal->file_descriptor, 0) == -1) {
+    log_error("error truncating log: %m");
+    exit(EXIT_FAILURE);
+  }
+  if (io_write_at(wal->file_descriptor, &header, WAL_HEADER_SIZE, 0) !=
+      (ssize_t)WAL_HEADER_SIZE) {
+    log_error("error writing log header: %m");
+    exit(EXIT_FAILURE);
+  }
+  wal_sync_file(wal);
+
+  wal->checksum[0] = header.checksum[0];
+  wal->checksum[1] = header.checksum[1];
+  wal->num_frames = 0;
+}
+
+// Replay the log into the database file. Frames are validated first, and only
+// the frames up to the last valid commit frame are copied, so a transaction
+// that was being written when the process crashed is discarded.
+static void wal_recover(Wal *wal, int database_fd) {
+  WalHeader header;
+  if (io_read_at(wal->file_descriptor, &header, WAL_HEADER_SIZE, 0) !=
+      (ssize_t)WAL_HEADER_SIZE) {
+    log_debug("log is empty, nothing to recover...");
+    return;
+  }
+
+  uint32_t checksum[2] = {0, 0};
+  wal_checksum(checksum, &header, offsetof(WalHeader, checksum));
+  if (header.magic != WAL_MAGIC || header.version != WAL_VERSION ||
+      !pager_page_size_valid(header.page_size) ||
+      checksum[0] != header.checksum[0] || checksum[1] != header.checksum[1]) {
+    log_warn("log header is invalid, ignoring log...");
+    return;
+  }
+
+  // Frames are replayed with the page size they were logged with, the page
+  // size of a database never changes
+  uint32_t frame_size = WAL_FRAME_HEADER_SIZE + header.page_size;
+  log_debug("validating log frames...");
+  void *frame = malloc(frame_size);
+  WalFrameHeader *frame_header = frame;
+  void *page = frame + WAL_FRAME_HEADER_SIZE;
+  off_t offset = WAL_HEADER_SIZE;
+  off_t end_of_last_commit = WAL_HEADER_SIZE;
+  uint32_t num_commits = 0;
+
+  while (io_read_at(wal->file_descriptor, frame, frame_size, offset) ==
+         (ssize_t)frame_size) {
+    wal_frame_checksum(checksum, frame_header, page, header.page_size);
+    if (frame_header->salt != header.salt ||
+        checksum[0] != frame_header->checksum[0] ||
+        checksum[1] != frame_header->checksum[1]) {
+      log_debug("frame at offset %ld is invalid, stopping...", (long)offset);
+      break;
+    }
+
+    offset += frame_size;
+    if (frame_header->database_size != 0) {
+      end_of_last_commit = offset;
+      num_commits++;
+    }
+  }
+
+  log_debug("replaying %d committed transactions...", num_commits);
+  uint32_t num_frames = 0;
+  for (offset = WAL_HEADER_SIZE; offset < end_of_last_commit;
+       offset += frame_size) {
+    if (io_read_at(wal->file_descriptor, frame, frame_size, offset) !=
+        (ssize_t)frame_size) {
+      log_error("error reading log: %m");
+      exit(EXIT_FAILURE);
+    }
+    if (io_write_at(database_fd, page, header.page_size,
+                    (off_t)frame_header->page_num * header.page_size) !=
+        (ssize_t)header.page_size) {
+      log_error("error writing recovered page: %m");
+      exit(EXIT_FAILURE);
+    }
+    num_frames++;
+  }
+  free(frame);
+
+  if (num_frames > 0) {
+    if (fsync(database_fd) == -1) {
+      log_error("error syncing database file: %m");
+      exit(EXIT_FAILURE);
+    }
+    log_info("recovered %d pages from %d transactions in %s", num_frames,
+             num_commits, wal->filename);
+  }
+  wal->salt = header.salt + 1;
+}
+
+// One write and one sync make the whole group of pending commits durable. The
+// caller holds the mutex of the log.
+static void wal_flush(Wal *wal) {
+  if (wal->pending_commits == 0) {
+    return;
+  }
+
+  log_debug("syncing %d pending commits...", wal->pending_commits);
+  off_t frame_size = WAL_FRAME_HEADER_SIZE + wal->page_size;
+  off_t offset = WAL_HEADER_SIZE +
+                 (off_t)(wal->num_frames - wal->pending_frames) * frame_size;
+  ssize_t size = (ssize_t)wal->pending_frames * frame_size;
+  if (io_write_at(wal->file_descriptor, wal->buffer, size, offset) != size) {
+    log_error("error writing log: %m");
+    exit(EXIT_FAILURE);
+  }
+  wal_sync_file(wal);
+
+  wal->pending_frames = 0;
+  wal->pending_commits = 0;
+  wal->stats.syncs++;
+}
+
+void wal_sync(Wal *wal) {
+  pthread_mutex_lock(&wal->mutex);
+  wal_flush(wal);
+  pthread_mutex_unlock(&wal->mutex);
+}
+
+// Sync the group of pending commits once its oldest commit has waited
+// max_delay_ms, even when no other commit comes to complete the group
+static void *wal_flusher(void *argument) {
+  Wal *wal = argument;
+  pthread_mutex_lock(&wal->mutex);
+  while (!wal->stopping) {
+    if (wal->pending_commits == 0) {
+      pthread_cond_wait(&wal->pending, &wal->mutex);
+      continue;
+    }
+    uint64_t due_ms = wal->pending_since_ms + wal->config.max_delay_ms;
+    if (wal_now_ms() >= due_ms) {
+      log_debug("syncing commits that waited %d ms...",
+                wal->config.max_delay_ms);
+      wal_flush(wal);
+      continue;
+    }
+    struct timespec due = {.tv_sec = (time_t)(due_ms / 1000),
+                           .tv_nsec = (long)(due_ms % 1000) * 1000000};
+    pthread_cond_timedwait(&wal->pending, &wal->mutex, &due);
+  }
+  pthread_mutex_unlock(&wal->mutex);
+  return NULL;
+}
+
+Wal *wal_open(const char *database_filename, int database_fd,
+              const WalConfig *config) {
+  log_debug("allocating log...");
+  Wal *wal = malloc(sizeof(Wal));
+  wal->config = *config;
+  if (wal->config.max_batch == 0) {
+    wal->config.max_batch = 1;
+  }
+  wal->buffer = NULL;
+  wal->buffer_capacity = 0;
+  wal->pending_frames = 0;
+  wal->pending_commits = 0;
+  wal->pending_since_ms = 0;
+  size_t filename_length = strlen(database_filename) + sizeof("-wal");
+  wal->filename = malloc(filename_length);
+  snprintf(wal->filename, filename_length, "%s-wal", database_filename);
+  memset(&wal->stats, 0, sizeof(WalStats));
+  wal->salt = (uint32_t)time(NULL) ^ (uint32_t)getpid();
+  wal->page_size = 0;
+
+  log_debug("opening log %s...", wal->filename);
+  wal->file_descriptor = open(wal->filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  if (wal->file_descriptor == -1) {
+    log_error("failed to open log %s: %m", wal->filename);
+    free(wal->filename);
+    free(wal);
+    return NULL;
+  }
+
+  wal_recover(wal, database_fd);
+
+  // The condition waits on the same clock as the commit times
+  pthread_mutex_init(&wal->mutex, NULL);
+  pthread_condattr_t attributes;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&wal->pending, &attributes);
+  pthread_condattr_destroy(&attributes);
+  wal->stopping = false;
+  wal->flusher_running = false;
+  if (wal->config.max_batch > 1) {
+    int result = pthread_create(&wal->flusher, NULL, wal_flusher, wal);
+    if (result != 0) {
+      log_error("error starting log flusher: %s", strerror(result));
+      exit(EXIT_FAILURE);
+    }
+    wal->flusher_running = true;
+  }
+
+  return wal;
+}
+
+void wal_start(Wal *wal, uint32_t page_size) {
+  log_debug("starting log for pages of %d bytes...", page_size);
+  wal->page_size = page_size;
+  wal_write_header(wal);
+}
+
+// The frames of a commit are appended to the buffer of pending commits. The
+// last frame carries the size of the database, which marks the commit as
+// complete. The group is written and synced when it is full or when its
+// oldest commit has waited long enough.
+void wal_commit(Wal *wal, void **pages, const uint32_t *page_nums,
+                uint32_t count, uint32_t database_size) {
+  if (count == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&wal->mutex);
+  uint32_t frame_size = WAL_FRAME_HEADER_SIZE + wal->page_size;
+  uint32_t needed = wal->pending_frames + count;
+  if (needed > wal->buffer_capacity) {
+    log_debug("growing log buffer to %d frames...", needed);
+    wal->buffer = realloc(wal->buffer, (size_t)needed * frame_size);
+    wal->buffer_capacity = needed;
+  }
+
+  log_debug("logging %d pages...", count);
+  for (uint32_t i = 0; i < count; i++) {
+    void *frame =
+        wal->buffer + (size_t)(wal->pending_frames + i) * frame_size;
+    WalFrameHeader *frame_header = frame;
+    frame_header->page_num = page_nums[i];
+    frame_header->database_size = (i == count - 1) ? database_size : 0;
+    frame_header->salt = wal->salt;
+    wal_frame_checksum(wal->checksum, frame_header, pages[i], wal->page_size);
+    frame_header->checksum[0] = wal->checksum[0];
+    frame_header->checksum[1] = wal->checksum[1];
+    memcpy(frame + WAL_FRAME_HEADER_SIZE, pages[i], wal->page_size);
+  }
+
+  if (wal->pending_commits == 0) {
+    wal->pending_since_ms = wal_now_ms();
+    pthread_cond_signal(&wal->pending);
+  }
+  wal->pending_frames += count;
+  wal->pending_commits++;
+  wal->num_frames += count;
+  wal->stats.frames += count;
+  wal->stats.commits++;
+
+  if (wal->pending_commits >= wal->config.max_batch ||
+      wal_now_ms() - wal->pending_since_ms >= wal->config.max_delay_ms) {
+    wal_flush(wal);
+  }
+  pthread_mutex_unlock(&wal->mutex);
+}
+
+void wal_reset(Wal *wal) {
+  log_debug("restarting log...");
+  pthread_mutex_lock(&wal->mutex);
+  wal_flush(wal);
+  wal->salt++;
+  wal_write_header(wal);
+  wal->stats.checkpoints++;
+  pthread_mutex_unlock(&wal->mutex);
+}
+
+// Stop the flusher thread and close the file of the log
+static void wal_stop(Wal *wal) {
+  if (wal->flusher_running) {
+    pthread_mutex_lock(&wal->mutex);
+    wal->stopping = true;
+    pthread_cond_signal(&wal->pending);
+    pthread_mutex_unlock(&wal->mutex);
+    pthread_join(wal->flusher, NULL);
+  }
+  pthread_cond_destroy(&wal->pending);
+  pthread_mutex_destroy(&wal->mutex);
+  close(wal->file_descriptor);
+  free(wal->buffer);
+}
+
+void wal_close(Wal *wal) {
+  log_debug("closing log...");
+  wal_stop(wal);
+  if (unlink(wal->filename) == -1) {
+    log_warn("failed to remove log %s: %m", wal->filename);
+  }
+  free(wal->filename);
+  free(wal);
+}
+
+void wal_abandon(Wal *wal) {
+  log_debug("abandoning log...");
+  wal_stop(wal);
+  free(wal->filename);
+  free(wal);
+}
+
+void wal_print_stats(Wal *wal) {
+  pthread_mutex_lock(&wal->mutex);
+  printf("Write-ahead log:\n");
+  printf("- frames in log: %d\n", wal->num_frames);
+  printf("- commits: %" PRIu64 "\n", wal->stats.commits);
+  printf("- frames written: %" PRIu64 "\n", wal->stats.frames);
+  printf("- syncs: %" PRIu64 "\n", wal->stats.syncs);
+  printf("- commits per sync: %.2f\n",
+         wal->stats.syncs > 0
+             ? (double)wal->stats.commits / (double)wal->stats.syncs
+             : 0.0);
+  printf("- pending commits: %d\n", wal->pending_commits);
+  printf("- checkpoints: %" PRIu64 "\n", wal->stats.checkpoints);
+  pthread_mutex_unlock(&wal->mutex);
+}
@@ -1,13 +1,1682 @@
+#include "../include/btree.h"
+#include "../include/checksum.h"
+#include "../include/cursor.h"
+#include "../include/database.h"
+#include "../include/io.h"
+#include "../include/load.h"
+#include "../include/pager.h"
+#include "../include/search.h"
+#include "../include/statement.h"
+#include "../lib/log/log.h"
 #include <CUnit/Basic.h>
 #include <CUnit/CUError.h>
 #include <CUnit/CUnit.h>
 #include <CUnit/TestDB.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-int gnaro_suite_init(void) { return 0; }
+// Path of the temporary database file used by a test
+static char test_filename[] = "/tmp/gnaro_test_XXXXXX";
+
+// Create an empty temporary database file and return its path
+static const char *test_database_file(void) {
+  strcpy(test_filename, "/tmp/gnaro_test_XXXXXX");
+  int fd = mkstemp(test_filename);
+  close(fd);
+  return test_filename;
+}
+
+// Check the structure of the subtree at page_num: sorted keys within the
+// bounds set by the ancestors and leaves at the same depth. Returns the number
+// of rows in the subtree.
+static uint32_t test_btree_check(Pager *pager, uint32_t page_num,
+                                 uint32_t min_key, uint32_t max_key,
+                                 uint32_t depth, uint32_t *leaf_depth) {
+  void *node = pager_get_page(pager, page_num);
+  if (btree_node_get_type(node) == BTREE_NODE_TYPE_LEAF) {
+    uint32_t num_cells = *btree_node_leaf_num_cells(node);
+    CU_ASSERT_TRUE(*btree_node_leaf_values_start(node) <= pager->usable_size);
+    CU_ASSERT_TRUE(btree_node_leaf_free_space(node) <= pager->usable_size);
+    for (uint32_t i = 0; i < num_cells; i++) {
+      uint32_t key = *btree_node_leaf_key(node, i);
+      CU_ASSERT_TRUE(key >= min_key && key <= max_key);
+      min_key = key + 1;
+    }
+    if (*leaf_depth == 0) {
+      *leaf_depth = depth;
+    }
+    CU_ASSERT_EQUAL(depth, *leaf_depth);
+    return num_cells;
+  }
+
+  uint32_t rows = 0;
+  uint32_t num_keys = *btree_node_internal_num_keys(node);
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint32_t key = i < num_keys ? *btree_node_internal_key(node, i) : max_key;
+    CU_ASSERT_TRUE(key >= min_key && key <= max_key);
+    rows += test_btree_check(pager, *btree_node_internal_child(node, i),
+                             min_key, key, depth + 1, leaf_depth);
+    min_key = key + 1;
+  }
+  return rows;
+}
+
+int gnaro_suite_init(void) {
+  log_set_quiet(true);
+  return 0;
+}
 int gnaro_suite_clean(void) { return 0; }
 void gnaro_test(void) { CU_ASSERT(1 == 1); }
 
+// The buffer pool never holds more frames than its budget once pages are
+// unpinned, and evicted pages are written back and read again on a miss
+void pager_eviction_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 4};
+  Pager *pager = pager_open(filename, &config);
+  CU_ASSERT_PTR_NOT_NULL(pager);
+
+  for (uint32_t i = 0; i < 32; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    *page = i * 7;
+    pager_mark_dirty(pager, i);
+    pager_commit(pager);
+    pager_unpin_all(pager);
+  }
+  CU_ASSERT_EQUAL(pager->num_frames, 4);
+  CU_ASSERT_EQUAL(pager->stats.misses, 32);
+  CU_ASSERT_EQUAL(pager->stats.evictions, 28);
+
+  for (uint32_t i = 0; i < 32; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    CU_ASSERT_EQUAL(*page, i * 7);
+    pager_unpin_all(pager);
+  }
+
+  pager_close(pager);
+  unlink(filename);
+}
+
+// Pinned pages are never evicted: the pool grows past its budget and
+// shrinks back once the pages are unpinned
+void pager_pinning_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 2};
+  Pager *pager = pager_open(filename, &config);
+
+  uint32_t *pages[8];
+  for (uint32_t i = 0; i < 8; i++) {
+    pages[i] = pager_get_page(pager, i);
+    *pages[i] = i + 1;
+    pager_mark_dirty(pager, i);
+  }
+  pager_commit(pager);
+  CU_ASSERT_EQUAL(pager->num_frames, 8);
+  for (uint32_t i = 0; i < 8; i++) {
+    CU_ASSERT_EQUAL(*pages[i], i + 1);
+    CU_ASSERT_PTR_EQUAL(pager_get_page(pager, i), pages[i]);
+  }
+
+  pager_unpin_all(pager);
+  CU_ASSERT_EQUAL(pager->num_frames, 2);
+  for (uint32_t i = 0; i < 8; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    CU_ASSERT_EQUAL(*page, i + 1);
+    pager_unpin_all(pager);
+  }
+
+  pager_close(pager);
+  unlink(filename);
+}
+
+// Only dirty pages are written and adjacent ones share a single write
+void pager_dirty_flush_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 16};
+  Pager *pager = pager_open(filename, &config);
+
+  for (uint32_t i = 0; i < 8; i++) {
+    pager_get_page(pager, i);
+    pager_mark_dirty(pager, i);
+  }
+  pager_flush_all(pager);
+  CU_ASSERT_EQUAL(pager->stats.pages_written, 8);
+  CU_ASSERT_EQUAL(pager->stats.write_calls, 1);
+
+  pager_flush_all(pager);
+  CU_ASSERT_EQUAL(pager->stats.pages_written, 8);
+
+  uint32_t dirty_pages[] = {6, 1, 2, 3};
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t *page = pager_get_page(pager, dirty_pages[i]);
+    *page = dirty_pages[i];
+    pager_mark_dirty(pager, dirty_pages[i]);
+  }
+  pager_flush_all(pager);
+  CU_ASSERT_EQUAL(pager->stats.pages_written, 12);
+  CU_ASSERT_EQUAL(pager->stats.write_calls, 3);
+
+  pager_close(pager);
+  unlink(filename);
+}
+
+// Committed pages survive a crash through the write-ahead log, while a
+// transaction whose frames were only partially written is discarded
+void wal_recovery_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 16};
+  Pager *pager = pager_open(filename, &config);
+
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    *page = 100 + i;
+    pager_mark_dirty(pager, i);
+  }
+  pager_commit(pager);
+
+  for (uint32_t i = 2; i < 6; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    *page = 200 + i;
+    pager_mark_dirty(pager, i);
+  }
+  pager_commit(pager);
+
+  // Tear the last frame of the second transaction
+  char wal_filename[64];
+  snprintf(wal_filename, sizeof(wal_filename), "%s-wal", filename);
+  off_t wal_size = lseek(pager->wal->file_descriptor, 0, SEEK_END);
+  CU_ASSERT_EQUAL(truncate(wal_filename, wal_size - 100), 0);
+  pager_abandon(pager);
+
+  pager = pager_open(filename, &config);
+  CU_ASSERT_EQUAL(pager->num_pages, 4);
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    CU_ASSERT_EQUAL(*page, 100 + i);
+  }
+  pager_close(pager);
+  CU_ASSERT_EQUAL(access(wal_filename, F_OK), -1);
+  unlink(filename);
+}
+
+// Commits are synced in groups of at most max_batch commits
+void wal_group_commit_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 16,
+                        .wal = {.max_batch = 4, .max_delay_ms = 60000}};
+  Pager *pager = pager_open(filename, &config);
+
+  for (uint32_t i = 0; i < 10; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    *page = i;
+    pager_mark_dirty(pager, i);
+    pager_commit(pager);
+  }
+  CU_ASSERT_EQUAL(pager->wal->stats.commits, 10);
+  CU_ASSERT_EQUAL(pager->wal->stats.syncs, 2);
+  CU_ASSERT_EQUAL(pager->wal->pending_commits, 2);
+
+  pager_sync(pager);
+  CU_ASSERT_EQUAL(pager->wal->stats.syncs, 3);
+  CU_ASSERT_EQUAL(pager->wal->pending_commits, 0);
+  pager_close(pager);
+
+  // A lone commit is synced once it has waited max_delay_ms
+  config.wal.max_delay_ms = 20;
+  pager = pager_open(filename, &config);
+  uint32_t *page = pager_get_page(pager, 1);
+  *page = 1;
+  pager_mark_dirty(pager, 1);
+  pager_commit(pager);
+  uint32_t pending_commits = 1;
+  for (uint32_t i = 0; i < 100 && pending_commits > 0; i++) {
+    usleep(10000);
+    pthread_mutex_lock(&pager->wal->mutex);
+    pending_commits = pager->wal->pending_commits;
+    pthread_mutex_unlock(&pager->wal->mutex);
+  }
+  CU_ASSERT_EQUAL(pending_commits, 0);
+  CU_ASSERT_EQUAL(pager->wal->stats.syncs, 1);
+
+  pager_close(pager);
+  unlink(filename);
+}
+
+// Pages written through the memory map are read back by both backends
+void pager_mmap_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 4, .mmap = true};
+  Pager *pager = pager_open(filename, &config);
+  CU_ASSERT_PTR_NOT_NULL(pager->map);
+
+  for (uint32_t i = 0; i < 300; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    *page = i + 1;
+    pager_mark_dirty(pager, i);
+    pager_commit(pager);
+  }
+  CU_ASSERT_EQUAL(pager->num_pages, 300);
+  pager_checkpoint(pager);
+  CU_ASSERT_EQUAL(pager->map->file_pages, 300);
+  for (uint32_t i = 0; i < 300; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    CU_ASSERT_EQUAL(*page, i + 1);
+  }
+  pager_close(pager);
+
+  config.mmap = false;
+  pager = pager_open(filename, &config);
+  for (uint32_t i = 0; i < 300; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    CU_ASSERT_EQUAL(*page, i + 1);
+    pager_unpin_all(pager);
+  }
+  pager_close(pager);
+
+  config.mmap = true;
+  pager = pager_open(filename, &config);
+  for (uint32_t i = 0; i < 300; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    CU_ASSERT_EQUAL(*page, i + 1);
+  }
+  pager_close(pager);
+  unlink(filename);
+}
+
+// Positional reads and vectored writes transfer whole buffers and never move
+// the file offset, reads stop short only at the end of the file
+void io_positional_test(void) {
+  const char *filename = test_database_file();
+  int fd = open(filename, O_RDWR);
+
+  char first[100], second[200], buffer[300];
+  memset(first, 'a', sizeof(first));
+  memset(second, 'b', sizeof(second));
+  struct iovec iov[] = {{first, sizeof(first)}, {second, sizeof(second)}};
+  CU_ASSERT_EQUAL(io_writev_at(fd, iov, 2, 50), 300);
+  CU_ASSERT_EQUAL(lseek(fd, 0, SEEK_CUR), 0);
+
+  CU_ASSERT_EQUAL(io_read_at(fd, buffer, sizeof(buffer), 50), 300);
+  CU_ASSERT_EQUAL(memcmp(buffer, first, sizeof(first)), 0);
+  CU_ASSERT_EQUAL(memcmp(buffer + sizeof(first), second, sizeof(second)), 0);
+  CU_ASSERT_EQUAL(io_read_at(fd, buffer, sizeof(buffer), 300), 50);
+  CU_ASSERT_EQUAL(io_read_at(fd, buffer, sizeof(buffer), 400), 0);
+
+  CU_ASSERT_EQUAL(io_write_at(fd, first, sizeof(first), 0), 100);
+  CU_ASSERT_EQUAL(io_read_at(fd, buffer, 1, 99), 1);
+  CU_ASSERT_EQUAL(buffer[0], 'a');
+
+  close(fd);
+  unlink(filename);
+}
+
+// Batches are written and read back the same way with and without io_uring.
+// With io_uring, read ahead pages are served from the buffer pool.
+void pager_async_io_test(void) {
+  for (int async_io = 0; async_io <= 1; async_io++) {
+    const char *filename = test_database_file();
+    PagerConfig config = {.cache_pages = 64, .async_io = async_io};
+    Pager *pager = pager_open(filename, &config);
+
+    for (uint32_t i = 0; i < 40; i++) {
+      // Leave holes so that the checkpoint writes several runs
+      uint32_t page_num = i + i / 8;
+      uint32_t *page = pager_get_page(pager, page_num);
+      *page = page_num * 3;
+      pager_mark_dirty(pager, page_num);
+    }
+    pager_commit(pager);
+    pager_checkpoint(pager);
+    CU_ASSERT_EQUAL(pager->stats.write_calls, 5);
+    pager_close(pager);
+
+    config.cache_pages = 32;
+    pager = pager_open(filename, &config);
+    uint32_t page_nums[16];
+    for (uint32_t i = 0; i < 16; i++) {
+      page_nums[i] = i * 2 + i / 4;
+    }
+    pager_prefetch(pager, page_nums, 16);
+    CU_ASSERT_EQUAL(pager->stats.prefetches, 16);
+    for (uint32_t i = 0; i < 16; i++) {
+      uint32_t *page = pager_get_page(pager, page_nums[i]);
+      CU_ASSERT_EQUAL(*page, page_nums[i] * 3);
+    }
+    CU_ASSERT_EQUAL(pager->stats.misses, pager->ring != NULL ? 0 : 16);
+    pager_close(pager);
+    unlink(filename);
+  }
+}
+
+// The readahead window grows while a scan visits pages in file order and
+// starts over when the scan jumps elsewhere
+void pager_readahead_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 256};
+  Pager *pager = pager_open(filename, &config);
+  for (uint32_t i = 0; i < 200; i++) {
+    pager_get_page(pager, i);
+    pager_mark_dirty(pager, i);
+  }
+  pager_close(pager);
+
+  pager = pager_open(filename, &config);
+  CU_ASSERT_FALSE(pager_readahead(pager, 10));
+  CU_ASSERT_EQUAL(pager->readahead.window, PAGER_READAHEAD_MIN_PAGES);
+  CU_ASSERT_EQUAL(pager->readahead.end_page_num, 15);
+  for (uint32_t page_num = 11; page_num < 120; page_num++) {
+    CU_ASSERT_TRUE(pager_readahead(pager, page_num));
+    CU_ASSERT(pager->readahead.end_page_num > page_num);
+  }
+  CU_ASSERT_EQUAL(pager->readahead.window, PAGER_READAHEAD_PAGES);
+  // Every page up to the end of the window was read ahead exactly once
+  CU_ASSERT_EQUAL(pager->stats.prefetches,
+                  pager->readahead.end_page_num - 11);
+
+  CU_ASSERT_FALSE(pager_readahead(pager, 3));
+  CU_ASSERT_EQUAL(pager->readahead.window, PAGER_READAHEAD_MIN_PAGES);
+  CU_ASSERT_FALSE(pager_readahead(pager, 199));
+  CU_ASSERT_EQUAL(pager->readahead.end_page_num, 200);
+
+  pager_close(pager);
+  unlink(filename);
+}
+
+// Freed pages survive a restart through the freelist in the file header and
+// are reused before the file grows
+void pager_freelist_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 16};
+  Pager *pager = pager_open(filename, &config);
+  pager_init_header(pager, PAGER_CHECKSUM_CRC32C);
+  for (uint32_t i = 1; i < 10; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    *page = 1000 + i;
+    pager_mark_dirty(pager, i);
+  }
+  pager_free_page(pager, 3);
+  pager_free_page(pager, 7);
+  CU_ASSERT_EQUAL(pager->header.freelist_count, 2);
+  pager_close(pager);
+
+  pager = pager_open(filename, &config);
+  CU_ASSERT_EQUAL(pager->header.version, PAGER_FORMAT_VERSION);
+  CU_ASSERT_EQUAL(pager->header.freelist_count, 2);
+  CU_ASSERT_EQUAL(pager_get_unused_page_num(pager), 7);
+  CU_ASSERT_EQUAL(pager_get_unused_page_num(pager), 3);
+  uint32_t *page = pager_get_page(pager, 3);
+  CU_ASSERT_EQUAL(*page, 0);
+  CU_ASSERT_EQUAL(pager_get_unused_page_num(pager), 10);
+  CU_ASSERT_EQUAL(pager->stats.pages_reused, 2);
+  page = pager_get_page(pager, 4);
+  CU_ASSERT_EQUAL(*page, 1004);
+  pager_close(pager);
+
+  pager = pager_open(filename, &config);
+  CU_ASSERT_EQUAL(pager->header.freelist_head, 0);
+  CU_ASSERT_EQUAL(pager->header.freelist_count, 0);
+  CU_ASSERT_EQUAL(pager->num_pages, 10);
+  pager_close(pager);
+  unlink(filename);
+}
+
+// Rows of format 2 and older: the id followed by the username and the email in
+// columns of fixed size
+enum { TEST_LEGACY_ROW_SIZE = 4 + 33 + 256 };
+
+static void test_legacy_row(void *destination, uint32_t id) {
+  memset(destination, 0, TEST_LEGACY_ROW_SIZE);
+  memcpy(destination, &id, sizeof(id));
+  snprintf(destination + 4, 33, "user%d", id);
+  strcpy(destination + 4 + 33, "user@example.com");
+}
+
+// Write a root leaf in the layout of format 1: a 14-byte header followed by
+// cells of a key and a row, with keys from 1 to num_cells
+static void test_legacy_leaf(void *node, uint32_t num_cells) {
+  memset(node, 0, 14);
+  btree_node_set_type(node, BTREE_NODE_TYPE_LEAF);
+  btree_node_set_root(node, true);
+  *(uint32_t *)(node + 6) = num_cells;
+  for (uint32_t i = 0; i < num_cells; i++) {
+    void *cell = node + 14 + (size_t)i * (sizeof(uint32_t) + TEST_LEGACY_ROW_SIZE);
+    *(uint32_t *)cell = i + 1;
+    test_legacy_row(cell + sizeof(uint32_t), i + 1);
+  }
+}
+
+// Check that the rows written by test_legacy_leaf() are all found in order
+static void test_legacy_rows(Database *database, uint32_t num_cells) {
+  Cursor *cursor = cursor_start(database);
+  uint32_t expected_key = 1;
+  while (!cursor->end_of_table) {
+    Row row;
+    char username[ROW_COLUMN_USERNAME_SIZE + 1];
+    row_deserialize(cursor_value(cursor), &row);
+    snprintf(username, sizeof(username), "user%d", expected_key);
+    CU_ASSERT_EQUAL(row.id, expected_key);
+    CU_ASSERT_STRING_EQUAL(row.username, username);
+    CU_ASSERT_STRING_EQUAL(row.email, "user@example.com");
+    expected_key++;
+    cursor_advance(cursor);
+  }
+  cursor_close(cursor);
+  CU_ASSERT_EQUAL(expected_key, num_cells + 1);
+}
+
+// A file written before the header existed is upgraded: its root moves to a
+// new page and the rows are still found
+void database_upgrade_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 16};
+  Pager *pager = pager_open(filename, &config);
+  void *root = pager_get_page(pager, 0);
+  test_legacy_leaf(root, 1);
+  *(uint32_t *)(root + 14) = 42;
+  pager_mark_dirty(pager, 0);
+  pager_close(pager);
+
+  Database *database = database_open(filename, &config);
+  CU_ASSERT_EQUAL(database->root_page_num, 1);
+  CU_ASSERT_EQUAL(database->pager->header.root_page_num, 1);
+  CU_ASSERT_EQUAL(database->pager->header.version, PAGER_FORMAT_VERSION);
+  Cursor *cursor = cursor_find_key(database, 42);
+  CU_ASSERT_EQUAL(cursor->page_num, 1);
+  CU_ASSERT_EQUAL(cursor->cell_num, 0);
+  Row row;
+  row_deserialize(cursor_value(cursor), &row);
+  CU_ASSERT_STRING_EQUAL(row.username, "user1");
+  cursor_close(cursor);
+  database_close(database);
+
+  database = database_open(filename, &config);
+  CU_ASSERT_EQUAL(database->root_page_num, 1);
+  database_close(database);
+  unlink(filename);
+}
+
+void pager_page_size_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 16, .page_size = 16384};
+  Pager *pager = pager_open(filename, &config);
+  CU_ASSERT_EQUAL(pager->page_size, 16384);
+  pager_init_header(pager, PAGER_CHECKSUM_CRC32C);
+  uint32_t last_word = pager->usable_size / sizeof(uint32_t) - 1;
+  for (uint32_t i = 1; i < 6; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    page[0] = 1000 + i;
+    page[last_word] = 2000 + i;
+    pager_mark_dirty(pager, i);
+  }
+  pager_commit(pager);
+  pager_abandon(pager);
+
+  // The page size of an existing database comes from its header, and the log
+  // is replayed with the page size it was written with
+  config.page_size = 0;
+  pager = pager_open(filename, &config);
+  CU_ASSERT_EQUAL(pager->page_size, 16384);
+  CU_ASSERT_EQUAL(pager->header.page_size, 16384);
+  CU_ASSERT_EQUAL(pager->num_pages, 6);
+  for (uint32_t i = 1; i < 6; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    CU_ASSERT_EQUAL(page[0], 1000 + i);
+    CU_ASSERT_EQUAL(page[last_word], 2000 + i);
+  }
+  pager_close(pager);
+  unlink(filename);
+
+  CU_ASSERT_TRUE(pager_page_size_valid(4096));
+  CU_ASSERT_TRUE(pager_page_size_valid(65536));
+  CU_ASSERT_FALSE(pager_page_size_valid(2048));
+  CU_ASSERT_FALSE(pager_page_size_valid(12288));
+  CU_ASSERT_FALSE(pager_page_size_valid(131072));
+  CU_ASSERT_TRUE(btree_layout(65536).leaf_space_for_cells >
+                 btree_layout(4096).leaf_space_for_cells * 15);
+}
+
+void pager_checksum_test(void) {
+  CU_ASSERT_EQUAL(checksum_crc32c(0, "123456789", 9), 0xe3069283);
+  CU_ASSERT_EQUAL(checksum_crc32c_portable(0, "123456789", 9), 0xe3069283);
+  CU_ASSERT_EQUAL(checksum_crc32c(checksum_crc32c(0, "1234", 4), "56789", 5),
+                  0xe3069283);
+  uint8_t buffer[1024];
+  for (uint32_t i = 0; i < sizeof(buffer); i++) {
+    buffer[i] = (uint8_t)(i * 131 + 7);
+  }
+  for (uint32_t offset = 0; offset < 8; offset++) {
+    CU_ASSERT_EQUAL(
+        checksum_crc32c(0, buffer + offset, sizeof(buffer) - offset * 3),
+        checksum_crc32c_portable(0, buffer + offset,
+                                 sizeof(buffer) - offset * 3));
+  }
+
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 16};
+  Pager *pager = pager_open(filename, &config);
+  pager_init_header(pager, PAGER_CHECKSUM_CRC32C);
+  CU_ASSERT_EQUAL(pager->usable_size, pager->page_size - 4);
+  for (uint32_t i = 1; i < 4; i++) {
+    uint32_t *page = pager_get_page(pager, i);
+    *page = 1000 + i;
+    pager_mark_dirty(pager, i);
+  }
+  pager_close(pager);
+
+  pager = pager_open(filename, &config);
+  uint32_t *page = pager_get_page(pager, 2);
+  CU_ASSERT_EQUAL(*page, 1002);
+  CU_ASSERT_EQUAL(pager->stats.pages_verified, 1);
+  pager_close(pager);
+
+  config.mmap = true;
+  pager = pager_open(filename, &config);
+  page = pager_get_page(pager, 3);
+  page = pager_get_page(pager, 3);
+  CU_ASSERT_EQUAL(*page, 1003);
+  CU_ASSERT_EQUAL(pager->stats.pages_verified, 1);
+  pager_close(pager);
+  config.mmap = false;
+
+  // Flip a bit in the middle of page 2
+  int fd = open(filename, O_RDWR);
+  uint8_t byte;
+  off_t offset = 2 * PAGER_DEFAULT_PAGE_SIZE + 100;
+  CU_ASSERT_EQUAL(io_read_at(fd, &byte, 1, offset), 1);
+  byte ^= 0x10;
+  CU_ASSERT_EQUAL(io_write_at(fd, &byte, 1, offset), 1);
+  close(fd);
+
+  config.skip_verify = true;
+  pager = pager_open(filename, &config);
+  void *corrupt_page = pager_get_page(pager, 2);
+  void *intact_page = pager_get_page(pager, 1);
+  CU_ASSERT_EQUAL(pager->stats.pages_verified, 0);
+  CU_ASSERT_FALSE(pager_page_checksum_valid(pager, 2, corrupt_page));
+  CU_ASSERT_TRUE(pager_page_checksum_valid(pager, 1, intact_page));
+  // A page read from the wrong place does not match its checksum either
+  CU_ASSERT_FALSE(pager_page_checksum_valid(pager, 3, intact_page));
+  pager_close(pager);
+  unlink(filename);
+}
+
+// Fill an email with the given number of characters
+static void test_email(char *email, uint32_t length) {
+  memset(email, 'e', length);
+  email[length] = '\0';
+}
+
+// Insert the keys one statement at a time and check the resulting tree. Rows
+// have long emails so that leaves hold few of them.
+static void test_btree_insert(const uint32_t *keys, uint32_t count) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 256,
+                        .wal = {.max_batch = 1024, .max_delay_ms = 1000}};
+  Database *database = database_open(filename, &config);
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.username, "user");
+  test_email(statement.row_to_insert.email, 255);
+  for (uint32_t i = 0; i < count; i++) {
+    statement.row_to_insert.id = keys[i];
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  statement.row_to_insert.id = keys[count / 2];
+  CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                  STATEMENT_EXECUTE_DUPLICATE_KEY);
+  database_close(database);
+
+  database = database_open(filename, &config);
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  count);
+  // More leaves than an internal node can hold need a third level
+  CU_ASSERT_EQUAL(leaf_depth, 3);
+  for (uint32_t key = 1; key <= count; key += 97) {
+    Cursor *cursor = cursor_find_key(database, key);
+    Row row;
+    row_deserialize(cursor_value(cursor), &row);
+    CU_ASSERT_EQUAL(row.id, key);
+    cursor_close(cursor);
+    pager_unpin_all(database->pager);
+  }
+  Cursor *cursor = cursor_start(database);
+  uint32_t expected_key = 1;
+  while (!cursor->end_of_table) {
+    Row row;
+    row_deserialize(cursor_value(cursor), &row);
+    CU_ASSERT_EQUAL(row.id, expected_key);
+    expected_key++;
+    cursor_advance(cursor);
+    pager_unpin_all(database->pager);
+  }
+  cursor_close(cursor);
+  CU_ASSERT_EQUAL(expected_key, count + 1);
+  database_close(database);
+  unlink(filename);
+}
+
+void btree_internal_split_test(void) {
+  const uint32_t count = 20000;
+  uint32_t *keys = malloc(count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < count; i++) {
+    keys[i] = i + 1;
+  }
+  test_btree_insert(keys, count);
+
+  for (uint32_t i = count - 1; i > 0; i--) {
+    uint32_t j = (i * 2654435761U) % (i + 1);
+    uint32_t key = keys[i];
+    keys[i] = keys[j];
+    keys[j] = key;
+  }
+  test_btree_insert(keys, count);
+  free(keys);
+}
+
+// Increasing keys are appended to the cached rightmost leaf, and splits at the
+// right edge leave full nodes behind
+void btree_append_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 256,
+                        .wal = {.max_batch = 1024, .max_delay_ms = 1000}};
+  Database *database = database_open(filename, &config);
+  BtreeLayout layout = btree_layout(database->pager->usable_size);
+  const uint32_t count = 10000;
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.username, "user");
+  test_email(statement.row_to_insert.email, 255);
+  for (uint32_t key = 2; key <= count * 2; key += 2) {
+    statement.row_to_insert.id = key;
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  count);
+  CU_ASSERT_EQUAL(leaf_depth, 3);
+
+  // Every node left of the right edge is full
+  uint8_t row[ROW_MAX_SIZE];
+  uint32_t cell_size =
+      BTREE_NODE_LEAF_SLOT_SIZE + row_serialize(&statement.row_to_insert, row);
+  void *root = pager_get_page(database->pager, database->root_page_num);
+  for (uint32_t i = 0; i < *btree_node_internal_num_keys(root); i++) {
+    void *node =
+        pager_get_page(database->pager, *btree_node_internal_child(root, i));
+    CU_ASSERT_EQUAL(*btree_node_internal_num_keys(node),
+                    layout.internal_max_keys - 1);
+  }
+  Cursor *cursor = cursor_start(database);
+  uint32_t leaf_page_num = cursor->page_num;
+  void *leaf = pager_get_page(database->pager, leaf_page_num);
+  while (*btree_node_leaf_next(leaf) != 0) {
+    CU_ASSERT_TRUE(btree_node_leaf_free_space(leaf) < cell_size);
+    leaf_page_num = *btree_node_leaf_next(leaf);
+    leaf = pager_get_page(database->pager, leaf_page_num);
+  }
+  cursor_close(cursor);
+  CU_ASSERT_EQUAL(database->rightmost_leaf_page_num, leaf_page_num);
+
+  // Keys between existing ones still split nodes evenly
+  for (uint32_t key = 1; key < count * 2; key += 20) {
+    statement.row_to_insert.id = key;
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  statement.row_to_insert.id = count * 2;
+  CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                  STATEMENT_EXECUTE_DUPLICATE_KEY);
+  database_close(database);
+
+  database = database_open(filename, &config);
+  leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  count + count / 10);
+  database_close(database);
+  unlink(filename);
+}
+
+// Deleted rows release their overflow pages, and emptied nodes are merged
+// into their siblings and released too
+void btree_delete_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 256,
+                        .wal = {.max_batch = 1024, .max_delay_ms = 1000}};
+  Database *database = database_open(filename, &config);
+  BtreeLayout layout = btree_layout(database->pager->usable_size);
+  const uint32_t count = 6000;
+  const uint32_t large_every = 50;
+  // Leaves hold four rows, so that the tree has two levels of internal nodes
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.username, "user");
+  for (uint32_t key = 1; key <= count; key++) {
+    statement.row_to_insert.id = key;
+    test_email(statement.row_to_insert.email,
+               key % large_every == 0 ? 5000 : 900);
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+
+  bool *present = malloc((count + 1) * sizeof(bool));
+  for (uint32_t key = 1; key <= count; key++) {
+    present[key] = true;
+  }
+  uint32_t remaining = count;
+
+  char query[64];
+  strcpy(query, "delete where id between 1000 and 2999");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement.min_id, 1000);
+  CU_ASSERT_EQUAL(statement.max_id, 2999);
+  CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                  STATEMENT_EXECUTE_SUCCESS);
+  for (uint32_t key = 1000; key <= 2999; key++) {
+    present[key] = false;
+  }
+  remaining -= 2000;
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  remaining);
+  CU_ASSERT_EQUAL(leaf_depth, 3);
+
+  // A leaf left with a single row takes rows from its full sibling
+  Cursor *cursor = cursor_find_key(database, 4121);
+  void *node = pager_get_page(database->pager, cursor->page_num);
+  uint32_t num_cells = *btree_node_leaf_num_cells(node);
+  uint32_t first_key = *btree_node_leaf_key(node, 0);
+  uint32_t last_key = *btree_node_leaf_key(node, num_cells - 1);
+  cursor_close(cursor);
+  CU_ASSERT_EQUAL(btree_delete(database, first_key, last_key - 1),
+                  num_cells - 1);
+  for (uint32_t key = first_key; key < last_key; key++) {
+    present[key] = false;
+  }
+  remaining -= num_cells - 1;
+  cursor = cursor_find_key(database, last_key);
+  node = pager_get_page(database->pager, cursor->page_num);
+  CU_ASSERT_TRUE(*btree_node_leaf_num_cells(node) > 1);
+  CU_ASSERT_TRUE(btree_node_leaf_used_space(database->pager, node) >=
+                 layout.leaf_min_used);
+  cursor_close(cursor);
+
+  // Single rows in a scrambled order, deleting the same row twice does nothing
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t key = (i * 7919) % count + 1;
+    if (key % 3 == 0) {
+      CU_ASSERT_EQUAL(btree_delete(database, key, key), present[key] ? 1 : 0);
+      CU_ASSERT_EQUAL(btree_delete(database, key, key), 0);
+      remaining -= present[key];
+      present[key] = false;
+    }
+    if (i % 500 == 0) {
+      pager_commit(database->pager);
+      leaf_depth = 0;
+      CU_ASSERT_EQUAL(test_btree_check(database->pager,
+                                       database->root_page_num, 0,
+                                       UINT32_MAX, 1, &leaf_depth),
+                      remaining);
+    }
+  }
+  pager_commit(database->pager);
+  database_close(database);
+
+  // The remaining rows are intact and packed into few leaves
+  database = database_open(filename, &config);
+  leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  remaining);
+  Row *row = malloc(sizeof(Row));
+  char *email = malloc(ROW_COLUMN_EMAIL_SIZE + 1);
+  cursor = cursor_start(database);
+  uint32_t num_leaves = 0;
+  uint32_t used = 0;
+  for (uint32_t key = 1; key <= count; key++) {
+    if (!present[key]) {
+      continue;
+    }
+    node = pager_get_page(database->pager, cursor->page_num);
+    if (cursor->cell_num == 0) {
+      num_leaves++;
+      used += btree_node_leaf_used_space(database->pager, node);
+    }
+    cursor_row(cursor, row);
+    test_email(email, key % large_every == 0 ? 5000 : 900);
+    CU_ASSERT_EQUAL(row->id, key);
+    CU_ASSERT_STRING_EQUAL(row->email, email);
+    cursor_advance(cursor);
+  }
+  CU_ASSERT_TRUE(cursor->end_of_table);
+  cursor_close(cursor);
+  CU_ASSERT_TRUE(num_leaves <= 3 * (used / layout.leaf_space_for_cells + 1));
+
+  // Deleting every row releases every page but the header and the root
+  CU_ASSERT_EQUAL(btree_delete(database, 0, UINT32_MAX), remaining);
+  pager_commit(database->pager);
+  void *root = pager_get_page(database->pager, database->root_page_num);
+  CU_ASSERT_EQUAL(btree_node_get_type(root), BTREE_NODE_TYPE_LEAF);
+  CU_ASSERT_EQUAL(*btree_node_leaf_num_cells(root), 0);
+  CU_ASSERT_EQUAL(database->pager->header.freelist_count + 2,
+                  database->pager->num_pages);
+  for (uint32_t key = 1; key <= 100; key++) {
+    statement.type = STATEMENT_INSERT;
+    statement.row_to_insert.id = key;
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  100);
+
+  strcpy(query, "delete where id = x");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+  strcpy(query, "delete where id = -1");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_NEGATIVE_ID);
+  strcpy(query, "delete where id between 1 2");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+  strcpy(query, "delete where username = 1");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+
+  free(email);
+  free(row);
+  free(present);
+  database_close(database);
+  unlink(filename);
+}
+
+// A select with a where clause reads the pages on the path to the first row,
+// not the whole table
+void select_where_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 256,
+                        .wal = {.max_batch = 1024, .max_delay_ms = 1000}};
+  Database *database = database_open(filename, &config);
+  const uint32_t count = 3000;
+  // Only even ids, so that odd ids are missing rows between two others
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.username, "user");
+  for (uint32_t key = 2; key <= 2 * count; key += 2) {
+    statement.row_to_insert.id = key;
+    test_email(statement.row_to_insert.email, 900);
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  count);
+  database_close(database);
+
+  // Starting from a cold cache, a seek misses once per level
+  database = database_open(filename, &config);
+  uint64_t misses = database->pager->stats.misses;
+  Cursor *cursor = cursor_seek(database, 4000);
+  CU_ASSERT_FALSE(cursor->end_of_table);
+  CU_ASSERT_EQUAL(cursor_key(cursor), 4000);
+  CU_ASSERT_TRUE(database->pager->stats.misses - misses <= leaf_depth + 1);
+  cursor_close(cursor);
+
+  // A missing key positions the cursor on the next row, crossing into the next
+  // leaf when the key is past the last row of its leaf
+  for (uint32_t key = 1; key < 2 * count; key += 2) {
+    cursor = cursor_seek(database, key);
+    CU_ASSERT_FALSE(cursor->end_of_table);
+    CU_ASSERT_EQUAL(cursor_key(cursor), key + 1);
+    cursor_close(cursor);
+    pager_unpin_all(database->pager);
+  }
+  cursor = cursor_seek(database, 2 * count + 1);
+  CU_ASSERT_TRUE(cursor->end_of_table);
+  cursor_close(cursor);
+
+  char query[64];
+  strcpy(query, "select");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement.type, STATEMENT_SELECT);
+  CU_ASSERT_EQUAL(statement.min_id, 0);
+  CU_ASSERT_EQUAL(statement.max_id, UINT32_MAX);
+  strcpy(query, "select where id = 4000");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement.min_id, 4000);
+  CU_ASSERT_EQUAL(statement.max_id, 4000);
+  strcpy(query, "select where id between 10 and 20");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement.min_id, 10);
+  CU_ASSERT_EQUAL(statement.max_id, 20);
+  strcpy(query, "select where id = -1");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_NEGATIVE_ID);
+  strcpy(query, "select where email = 1");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+  strcpy(query, "select *");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+
+  // Missing ids and empty ranges print nothing
+  strcpy(query, "select where id = 4001");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                  STATEMENT_EXECUTE_SUCCESS);
+  strcpy(query, "select where id between 30 and 10");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                  STATEMENT_EXECUTE_SUCCESS);
+  strcpy(query, "select where id between 6001 and 7000");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                  STATEMENT_EXECUTE_SUCCESS);
+
+  database_close(database);
+  unlink(filename);
+}
+
+// Scanning backwards visits every row once in decreasing order, also after
+// deletes have left the keys of internal nodes larger than their subtrees
+void cursor_reverse_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 256,
+                        .wal = {.max_batch = 1024, .max_delay_ms = 1000}};
+  Database *database = database_open(filename, &config);
+  const uint32_t count = 3000;
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.username, "user");
+  for (uint32_t i = 0; i < count; i++) {
+    statement.row_to_insert.id = 2 * ((i * 7919) % count + 1);
+    test_email(statement.row_to_insert.email, 900);
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  CU_ASSERT_EQUAL(btree_delete(database, 1000, 1999), 500);
+  CU_ASSERT_EQUAL(btree_delete(database, 5001, 5600), 300);
+  pager_commit(database->pager);
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  count - 800);
+  CU_ASSERT_EQUAL(leaf_depth, 3);
+  database_close(database);
+
+  database = database_open(filename, &config);
+  Cursor *cursor = cursor_seek_last(database, UINT32_MAX);
+  uint32_t key = 2 * count;
+  while (!cursor->end_of_table) {
+    CU_ASSERT_EQUAL(cursor_key(cursor), key);
+    cursor_retreat(cursor);
+    pager_unpin_all(database->pager);
+    key -= 2;
+    if (key == 5600) {
+      key = 5000;
+    } else if (key == 1998) {
+      key = 998;
+    }
+  }
+  CU_ASSERT_EQUAL(key, 0);
+  cursor_close(cursor);
+
+  // Every key finds the row with the largest id not greater than it
+  for (key = 0; key <= 2 * count + 1; key++) {
+    uint32_t expected = key & ~1U;
+    if (expected >= 1000 && expected <= 1999) {
+      expected = 998;
+    } else if (expected >= 5001 && expected <= 5600) {
+      expected = 5000;
+    }
+    cursor = cursor_seek_last(database, key);
+    CU_ASSERT_EQUAL(cursor->end_of_table, expected == 0);
+    if (!cursor->end_of_table) {
+      CU_ASSERT_EQUAL(cursor_key(cursor), expected);
+    }
+    cursor_close(cursor);
+    pager_unpin_all(database->pager);
+  }
+
+  // Bounds end the scan in both directions
+  cursor = cursor_seek(database, 101);
+  cursor_set_bounds(cursor, 101, 110);
+  uint32_t num_rows = 0;
+  for (; !cursor->end_of_table; cursor_advance(cursor)) {
+    num_rows++;
+  }
+  CU_ASSERT_EQUAL(num_rows, 5);
+  cursor_close(cursor);
+  cursor = cursor_seek_last(database, 2500);
+  cursor_set_bounds(cursor, 900, 2500);
+  num_rows = 0;
+  for (; !cursor->end_of_table; cursor_retreat(cursor)) {
+    num_rows++;
+  }
+  CU_ASSERT_EQUAL(num_rows, 251 + 50);
+  cursor_close(cursor);
+  cursor = cursor_seek_last(database, 1500);
+  cursor_set_bounds(cursor, 1000, 1999);
+  CU_ASSERT_TRUE(cursor->end_of_table);
+  cursor_close(cursor);
+  database_close(database);
+
+  // The latest rows are read from a cold cache without reading every leaf
+  database = database_open(filename, &config);
+  char query[64];
+  strcpy(query, "select order by id desc limit 0");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_TRUE(statement.descending);
+  CU_ASSERT_EQUAL(statement.limit, 0);
+  CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                  STATEMENT_EXECUTE_SUCCESS);
+  CU_ASSERT_TRUE(database->pager->stats.misses <= leaf_depth + 2);
+  uint64_t misses = database->pager->stats.misses;
+  cursor = cursor_seek_last(database, UINT32_MAX);
+  for (uint32_t i = 0; i < 10; i++) {
+    cursor_retreat(cursor);
+  }
+  CU_ASSERT_FALSE(cursor->end_of_table);
+  CU_ASSERT_EQUAL(cursor_key(cursor), 2 * count - 20);
+  CU_ASSERT_TRUE(database->pager->stats.misses - misses <= 4 * leaf_depth);
+  cursor_close(cursor);
+
+  strcpy(query, "select where id between 10 and 20 order by id asc limit 3");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement.min_id, 10);
+  CU_ASSERT_EQUAL(statement.max_id, 20);
+  CU_ASSERT_FALSE(statement.descending);
+  CU_ASSERT_EQUAL(statement.limit, 3);
+  strcpy(query, "select limit 5");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SUCCESS);
+  CU_ASSERT_EQUAL(statement.limit, 5);
+  strcpy(query, "select order by email");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+  strcpy(query, "select limit -1");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+  strcpy(query, "select limit 5 order by id");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+  strcpy(query, "delete where id = 5 limit 1");
+  CU_ASSERT_EQUAL(statement_prepare(query, &statement),
+                  STATEMENT_PREPARE_SYNTAX_ERROR);
+
+  database_close(database);
+  unlink(filename);
+}
+
+typedef struct {
+  Database *database;
+  uint32_t count;
+  uint32_t seed;
+  uint32_t failures;
+} TestReader;
+
+// Scan forwards and backwards from random keys: the even keys are always
+// there, and the odd ones may appear as the writer inserts them
+static void *test_read(void *argument) {
+  TestReader *reader = argument;
+  Database *database = reader->database;
+  for (uint32_t i = 0; i < 300; i++) {
+    reader->seed = reader->seed * 1103515245 + 12345;
+    uint32_t key = (reader->seed >> 8) % (2 * reader->count) + 1;
+    database_latch(database, DATABASE_LATCH_READ);
+    Cursor *cursor = cursor_seek(database, key);
+    uint32_t previous = key - 1;
+    for (uint32_t j = 0; j < 50 && !cursor->end_of_table; j++) {
+      uint32_t found = cursor_key(cursor);
+      reader->failures += found <= previous || found > previous + 2;
+      previous = found;
+      cursor_advance(cursor);
+    }
+    cursor_close(cursor);
+    cursor = cursor_seek_last(database, key);
+    previous = key + 1;
+    for (uint32_t j = 0; j < 50 && !cursor->end_of_table; j++) {
+      uint32_t found = cursor_key(cursor);
+      reader->failures += found >= previous || found + 2 < previous;
+      previous = found;
+      cursor_retreat(cursor);
+    }
+    cursor_close(cursor);
+    database_unlatch(database, DATABASE_LATCH_READ);
+  }
+  return NULL;
+}
+
+static void test_concurrent_readers(bool mmap) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 128,
+                        .mmap = mmap,
+                        .wal = {.max_batch = 1024, .max_delay_ms = 1000}};
+  Database *database = database_open(filename, &config);
+  const uint32_t count = 20000;
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.username, "user");
+  strcpy(statement.row_to_insert.email, "user@example.com");
+  for (uint32_t key = 2; key <= 2 * count; key += 2) {
+    statement.row_to_insert.id = key;
+    statement_execute(&statement, database);
+  }
+
+  pthread_t threads[3];
+  TestReader readers[3];
+  for (uint32_t i = 0; i < 3; i++) {
+    readers[i] = (TestReader){.database = database, .count = count, .seed = i};
+    pthread_create(&threads[i], NULL, test_read, &readers[i]);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    statement.row_to_insert.id = 2 * ((i * 7919) % count) + 1;
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  for (uint32_t i = 0; i < 3; i++) {
+    pthread_join(threads[i], NULL);
+    CU_ASSERT_EQUAL(readers[i].failures, 0);
+  }
+
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  2 * count);
+  database_close(database);
+  unlink(filename);
+}
+
+// Readers latch their way through the tree while a writer splits its nodes,
+// memory-mapped pages have no latches and the statements take turns instead
+void cursor_concurrent_test(void) {
+  test_concurrent_readers(false);
+  test_concurrent_readers(true);
+}
+
+// Slots are inserted in key order while the values are stacked from the end of
+// the page, and a split packs the values of both halves again
+void btree_slotted_leaf_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 64};
+  Database *database = database_open(filename, &config);
+  void *root = pager_get_page(database->pager, database->root_page_num);
+  uint32_t usable_size = database->pager->usable_size;
+  CU_ASSERT_EQUAL(*btree_node_leaf_values_start(root), usable_size);
+  CU_ASSERT_EQUAL(btree_node_leaf_free_space(root),
+                  btree_layout(usable_size).leaf_space_for_cells);
+
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.email, "user@example.com");
+  const uint32_t keys[] = {30, 10, 20, 40, 5};
+  for (uint32_t i = 0; i < 5; i++) {
+    statement.row_to_insert.id = keys[i];
+    snprintf(statement.row_to_insert.username, ROW_COLUMN_USERNAME_SIZE,
+             "user%d", keys[i]);
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  // Rows of one-byte ids, a 6-byte username and a 16-byte email
+  const uint32_t row_size = 1 + 1 + 6 + 1 + 16;
+  const uint32_t sorted_keys[] = {5, 10, 20, 30, 40};
+  for (uint32_t i = 0; i < 5; i++) {
+    CU_ASSERT_EQUAL(*btree_node_leaf_key(root, i), sorted_keys[i]);
+    CU_ASSERT_EQUAL(btree_node_leaf_value_size(root, i),
+                    sorted_keys[i] == 5 ? row_size - 1 : row_size);
+  }
+  // The first row inserted is the last one in the page
+  CU_ASSERT_EQUAL(btree_node_leaf_value(root, 3), root + usable_size - row_size);
+  CU_ASSERT_EQUAL(*btree_node_leaf_values_start(root),
+                  usable_size - 5 * row_size + 1);
+  CU_ASSERT_EQUAL(btree_node_leaf_free_space(root),
+                  btree_layout(usable_size).leaf_space_for_cells -
+                      5 * (BTREE_NODE_LEAF_SLOT_SIZE + row_size) + 1);
+
+  // Long emails so that the leaf splits
+  test_email(statement.row_to_insert.email, 255);
+  for (uint32_t key = 100; key < 200; key++) {
+    statement.row_to_insert.id = key;
+    snprintf(statement.row_to_insert.username, ROW_COLUMN_USERNAME_SIZE,
+             "user%d", key);
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  105);
+  CU_ASSERT_EQUAL(leaf_depth, 2);
+  for (uint32_t key = 100; key < 200; key += 9) {
+    Cursor *cursor = cursor_find_key(database, key);
+    Row row;
+    char username[ROW_COLUMN_USERNAME_SIZE + 1];
+    row_deserialize(cursor_value(cursor), &row);
+    snprintf(username, sizeof(username), "user%d", key);
+    CU_ASSERT_EQUAL(row.id, key);
+    CU_ASSERT_STRING_EQUAL(row.username, username);
+    cursor_close(cursor);
+  }
+  database_close(database);
+  unlink(filename);
+}
+
+// Files of format 1, with full leaves of fixed-size cells, and of format 2,
+// with slotted leaves of fixed-size rows, are upgraded to compact rows
+void database_upgrade_leaves_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 16, .page_size = 16384};
+  Pager *pager = pager_open(filename, &config);
+  pager_init_header(pager, PAGER_CHECKSUM_CRC32C);
+  uint32_t num_cells =
+      (pager->usable_size - 14) / (sizeof(uint32_t) + TEST_LEGACY_ROW_SIZE);
+  void *root = pager_get_page(pager, 1);
+  test_legacy_leaf(root, num_cells);
+  pager_mark_dirty(pager, 1);
+  pager->header.version = 1;
+  pager->header.root_page_num = 1;
+  pager_write_header(pager);
+  pager_commit(pager);
+  pager_close(pager);
+
+  config.page_size = 0;
+  Database *database = database_open(filename, &config);
+  CU_ASSERT_EQUAL(database->pager->header.version, PAGER_FORMAT_VERSION);
+  CU_ASSERT_EQUAL(database->root_page_num, 1);
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  num_cells);
+  test_legacy_rows(database, num_cells);
+  database_close(database);
+
+  database = database_open(filename, &config);
+  test_legacy_rows(database, num_cells);
+  database_close(database);
+  unlink(filename);
+
+  // Two leaves of format 2 under an internal root
+  config.page_size = 0;
+  pager = pager_open(filename, &config);
+  pager_init_header(pager, PAGER_CHECKSUM_CRC32C);
+  num_cells = 20;
+  root = pager_get_page(pager, 1);
+  btree_node_internal_init(root);
+  btree_node_set_root(root, true);
+  *btree_node_internal_num_keys(root) = 1;
+  *btree_node_internal_child(root, 0) = 2;
+  *btree_node_internal_key(root, 0) = num_cells / 2;
+  *btree_node_internal_right_child(root) = 3;
+  for (uint32_t page_num = 2; page_num <= 3; page_num++) {
+    void *leaf = pager_get_page(pager, page_num);
+    btree_node_leaf_init(leaf, pager->usable_size);
+    *btree_node_leaf_next(leaf) = page_num == 2 ? 3 : 0;
+    for (uint32_t i = 0; i < num_cells / 2; i++) {
+      uint32_t key = (page_num - 2) * (num_cells / 2) + i + 1;
+      uint8_t row[TEST_LEGACY_ROW_SIZE];
+      test_legacy_row(row, key);
+      btree_node_leaf_insert_cell(leaf, i, key, row, TEST_LEGACY_ROW_SIZE);
+    }
+    pager_mark_dirty(pager, page_num);
+  }
+  pager_mark_dirty(pager, 1);
+  pager->header.version = 2;
+  pager->header.root_page_num = 1;
+  pager_write_header(pager);
+  pager_commit(pager);
+  pager_close(pager);
+
+  database = database_open(filename, &config);
+  CU_ASSERT_EQUAL(database->pager->header.version, PAGER_FORMAT_VERSION);
+  void *leaf = pager_get_page(database->pager, 3);
+  CU_ASSERT_EQUAL(btree_node_leaf_value_size(leaf, 0), 1 + 1 + 6 + 1 + 16);
+  leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  num_cells);
+  CU_ASSERT_EQUAL(leaf_depth, 2);
+  test_legacy_rows(database, num_cells);
+  database_close(database);
+  unlink(filename);
+
+  // A root leaf of format 3 with an email longer than 127 bytes, whose length
+  // took a single byte
+  pager = pager_open(filename, &config);
+  pager_init_header(pager, PAGER_CHECKSUM_CRC32C);
+  root = pager_get_page(pager, 1);
+  btree_node_leaf_init(root, pager->usable_size);
+  btree_node_set_root(root, true);
+  uint8_t compact_row[3 + 4 + 1 + 200] = {7, 4, 'u', 's', 'e', 'r', 200};
+  memset(compact_row + 7, 'e', 200);
+  btree_node_leaf_insert_cell(root, 0, 7, compact_row, sizeof(compact_row) - 1);
+  pager_mark_dirty(pager, 1);
+  pager->header.version = 3;
+  pager->header.root_page_num = 1;
+  pager_write_header(pager);
+  pager_commit(pager);
+  pager_close(pager);
+
+  database = database_open(filename, &config);
+  Cursor *cursor = cursor_find_key(database, 7);
+  Row row;
+  char email[201];
+  test_email(email, 200);
+  cursor_row(cursor, &row);
+  CU_ASSERT_EQUAL(row.id, 7);
+  CU_ASSERT_STRING_EQUAL(row.username, "user");
+  CU_ASSERT_STRING_EQUAL(row.email, email);
+  cursor_close(cursor);
+  database_close(database);
+  unlink(filename);
+}
+
+// Rows larger than a quarter of a leaf keep a prefix in the leaf and the rest
+// in a chain of overflow pages, so leaves still hold many rows
+void btree_overflow_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 64};
+  Database *database = database_open(filename, &config);
+  BtreeLayout layout = btree_layout(database->pager->usable_size);
+  const uint32_t lengths[] = {10, 900, 1100, 5000, ROW_COLUMN_EMAIL_SIZE};
+  const uint32_t num_lengths = 5;
+  const uint32_t count = 200;
+  Statement statement = {.type = STATEMENT_INSERT};
+  strcpy(statement.row_to_insert.username, "user");
+  for (uint32_t key = 1; key <= count; key++) {
+    statement.row_to_insert.id = key;
+    test_email(statement.row_to_insert.email, lengths[key % num_lengths]);
+    CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                    STATEMENT_EXECUTE_SUCCESS);
+  }
+  database_close(database);
+
+  database = database_open(filename, &config);
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  count);
+  // Without overflow pages the largest rows would need a leaf each
+  CU_ASSERT_EQUAL(leaf_depth, 2);
+  void *root = pager_get_page(database->pager, database->root_page_num);
+  CU_ASSERT_TRUE(*btree_node_internal_num_keys(root) < count / 8);
+
+  Row *row = malloc(sizeof(Row));
+  char *email = malloc(ROW_COLUMN_EMAIL_SIZE + 1);
+  Cursor *cursor = cursor_start(database);
+  for (uint32_t key = 1; key <= count; key++) {
+    uint32_t length = lengths[key % num_lengths];
+    void *node = pager_get_page(database->pager, cursor->page_num);
+    bool overflows = btree_node_leaf_value_overflows(node, cursor->cell_num);
+    CU_ASSERT_EQUAL(overflows, length > layout.leaf_max_value);
+    if (overflows) {
+      CU_ASSERT_EQUAL(btree_node_leaf_value_size(node, cursor->cell_num),
+                      BTREE_NODE_LEAF_OVERFLOW_VALUE_SIZE);
+    }
+    cursor_row(cursor, row);
+    test_email(email, length);
+    CU_ASSERT_EQUAL(row->id, key);
+    CU_ASSERT_STRING_EQUAL(row->username, "user");
+    CU_ASSERT_STRING_EQUAL(row->email, email);
+    cursor_advance(cursor);
+  }
+  CU_ASSERT_TRUE(cursor->end_of_table);
+  cursor_close(cursor);
+  free(email);
+  free(row);
+  database_close(database);
+  unlink(filename);
+}
+
+// Write the given text to a temporary file for a bulk load
+static const char *test_load_file(const char *text) {
+  static char filename[] = "/tmp/gnaro_load_XXXXXX";
+  strcpy(filename, "/tmp/gnaro_load_XXXXXX");
+  int fd = mkstemp(filename);
+  CU_ASSERT_EQUAL(write(fd, text, strlen(text)), (ssize_t)strlen(text));
+  close(fd);
+  return filename;
+}
+
+void load_test(void) {
+  const char *filename = test_database_file();
+  PagerConfig config = {.cache_pages = 64};
+  Database *database = database_open(filename, &config);
+  BtreeLayout layout = btree_layout(database->pager->usable_size);
+
+  // Rows in a scrambled order, with a blank line and some overflowing rows
+  const uint32_t count = 20000;
+  const uint32_t large_every = 1000;
+  char *text = malloc((size_t)count * 64 + (count / large_every) * 5000 + 2);
+  char *email = malloc(ROW_COLUMN_EMAIL_SIZE + 1);
+  size_t length = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t key = (i * 7919) % count + 1;
+    test_email(email, key % large_every == 0 ? 5000 : 20);
+    length += sprintf(text + length, "%d user%d %s\n", key, key, email);
+    if (i == count / 2) {
+      length += sprintf(text + length, "\n");
+    }
+  }
+  const char *rows_filename = test_load_file(text);
+
+  // A small run size makes the sort merge several runs
+  LoadConfig load_config = {.fill_factor = 70, .run_size = 256 * 1024};
+  LoadStats stats;
+  CU_ASSERT_EQUAL(load_file(database, rows_filename, &load_config, &stats),
+                  LOAD_SUCCESS);
+  CU_ASSERT_EQUAL(stats.rows, count);
+  CU_ASSERT_TRUE(stats.runs > 1);
+  CU_ASSERT_EQUAL(stats.height, 1);
+  uint32_t leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  count);
+
+  // Leaves are filled to the fill factor and written in key order
+  Row *row = malloc(sizeof(Row));
+  Cursor *cursor = cursor_start(database);
+  uint32_t num_leaves = 0;
+  for (uint32_t key = 1; key <= count; key++) {
+    void *node = pager_get_page(database->pager, cursor->page_num);
+    if (cursor->cell_num == 0) {
+      uint32_t used = layout.leaf_space_for_cells -
+                      btree_node_leaf_free_space(node);
+      CU_ASSERT_TRUE(used <= layout.leaf_space_for_cells * 70 / 100);
+      uint32_t next = *btree_node_leaf_next(node);
+      CU_ASSERT_TRUE(next == 0 || next > cursor->page_num);
+      num_leaves++;
+    }
+    cursor_row(cursor, row);
+    test_email(email, key % large_every == 0 ? 5000 : 20);
+    CU_ASSERT_EQUAL(row->id, key);
+    CU_ASSERT_STRING_EQUAL(row->email, email);
+    cursor_advance(cursor);
+  }
+  CU_ASSERT_TRUE(cursor->end_of_table);
+  CU_ASSERT_EQUAL(num_leaves, stats.leaves);
+  cursor_close(cursor);
+
+  // Only an empty database can be loaded
+  CU_ASSERT_EQUAL(load_file(database, rows_filename, &load_config, &stats),
+                  LOAD_NOT_EMPTY);
+  database_close(database);
+  unlink(rows_filename);
+
+  // The loaded tree takes inserts like any other
+  database = database_open(filename, &config);
+  Statement statement = {.type = STATEMENT_INSERT};
+  statement.row_to_insert.id = count + 1;
+  strcpy(statement.row_to_insert.username, "user");
+  strcpy(statement.row_to_insert.email, "user@example.com");
+  CU_ASSERT_EQUAL(statement_execute(&statement, database),
+                  STATEMENT_EXECUTE_SUCCESS);
+  leaf_depth = 0;
+  CU_ASSERT_EQUAL(test_btree_check(database->pager, database->root_page_num,
+                                   0, UINT32_MAX, 1, &leaf_depth),
+                  count + 1);
+  database_close(database);
+  unlink(filename);
+
+  // A duplicate key or a bad line loads nothing
+  filename = test_database_file();
+  database = database_open(filename, &config);
+  uint32_t root_page_num = database->root_page_num;
+  length = 0;
+  for (uint32_t key = 1; key <= 2000; key++) {
+    length += sprintf(text + length, "%d user %s\n", key == 1500 ? 10 : key,
+                      key % 100 == 0 ? email : "user@example.com");
+  }
+  rows_filename = test_load_file(text);
+  CU_ASSERT_EQUAL(load_file(database, rows_filename, &load_config, &stats),
+                  LOAD_DUPLICATE_KEY);
+  CU_ASSERT_EQUAL(stats.duplicate_key, 10);
+  CU_ASSERT_EQUAL(database->root_page_num, root_page_num);
+  CU_ASSERT_TRUE(database->pager->header.freelist_count > 0);
+  unlink(rows_filename);
+
+  rows_filename = test_load_file("1 user user@example.com\n"
+                                 "2 user\n");
+  CU_ASSERT_EQUAL(load_file(database, rows_filename, &load_config, &stats),
+                  LOAD_SYNTAX_ERROR);
+  CU_ASSERT_EQUAL(stats.line, 2);
+  unlink(rows_filename);
+
+  cursor = cursor_start(database);
+  CU_ASSERT_TRUE(cursor->end_of_table);
+  cursor_close(cursor);
+  free(row);
+  free(email);
+  free(text);
+  database_close(database);
+  unlink(filename);
+
+  // Pages of a load interrupted by a crash are dropped when the file is opened
+  filename = test_database_file();
+  database_close(database_open(filename, &config));
+  Pager *pager = pager_open(filename, &config);
+  uint32_t num_pages = pager->num_pages;
+  pager_bulk_begin(pager);
+  for (uint32_t i = 0; i < LOAD_WRITE_PAGES; i++) {
+    uint32_t page_num = pager_get_unused_page_num(pager);
+    CU_ASSERT_EQUAL(page_num, num_pages + i);
+    pager_get_page(pager, page_num);
+    pager_mark_dirty(pager, page_num);
+  }
+  pager_bulk_write(pager);
+  CU_ASSERT_EQUAL(lseek(pager->file_descriptor, 0, SEEK_END),
+                  (off_t)(num_pages + LOAD_WRITE_PAGES) * pager->page_size);
+  CU_ASSERT_EQUAL(pager->wal->num_frames, 0);
+  pager_abandon(pager);
+
+  pager = pager_open(filename, &config);
+  CU_ASSERT_EQUAL(pager->num_pages, num_pages);
+  CU_ASSERT_EQUAL(pager->header.bulk_start_page, 0);
+  pager_close(pager);
+  database = database_open(filename, &config);
+  cursor = cursor_start(database);
+  CU_ASSERT_TRUE(cursor->end_of_table);
+  cursor_close(cursor);
+  database_close(database);
+  unlink(filename);
+}
+
+void row_serialize_test(void) {
+  const uint32_t ids[] = {0, 127, 128, 16383, 16384, UINT32_MAX};
+  const uint32_t id_sizes[] = {1, 1, 2, 2, 3, 5};
+  uint8_t buffer[ROW_MAX_SIZE];
+  for (uint32_t i = 0; i < 6; i++) {
+    Row row = {.id = ids[i]};
+    strcpy(row.username, "u");
+    strcpy(row.email, "");
+    CU_ASSERT_EQUAL(row_serialize(&row, buffer), id_sizes[i] + 1 + 1 + 1);
+    Row copy;
+    memset(&copy, 'x', sizeof(copy));
+    row_deserialize(buffer, &copy);
+    CU_ASSERT_EQUAL(copy.id, ids[i]);
+    CU_ASSERT_STRING_EQUAL(copy.username, "u");
+    CU_ASSERT_STRING_EQUAL(copy.email, "");
+  }
+
+  // Columns filled to their size take ROW_MAX_SIZE bytes
+  Row row = {.id = UINT32_MAX};
+  memset(row.username, 'u', ROW_COLUMN_USERNAME_SIZE);
+  row.username[ROW_COLUMN_USERNAME_SIZE] = '\0';
+  memset(row.email, 'e', ROW_COLUMN_EMAIL_SIZE);
+  row.email[ROW_COLUMN_EMAIL_SIZE] = '\0';
+  CU_ASSERT_EQUAL(row_serialize(&row, buffer), ROW_MAX_SIZE);
+  Row copy;
+  row_deserialize(buffer, &copy);
+  CU_ASSERT_STRING_EQUAL(copy.username, row.username);
+  CU_ASSERT_STRING_EQUAL(copy.email, row.email);
+}
+
+void search_test(void) {
+  // Pairs of a value and a key, like the cells of internal nodes, with keys
+  // on both sides of the sign bit
+  uint32_t pairs[2 * 600];
+  uint32_t keys[600];
+  uint8_t cells[64 * 37];
+  for (uint32_t count = 0; count < 600; count += 7) {
+    for (uint32_t i = 0; i < count; i++) {
+      pairs[2 * i] = UINT32_MAX;
+      pairs[2 * i + 1] = 0x7ffffff0U + i * 3;
+      keys[i] = pairs[2 * i + 1];
+    }
+    for (uint32_t key = 0x7fffffe0U; key < 0x7ffffff0U + count * 3 + 8;
+         key++) {
+      uint32_t expected = search_lower_bound_scalar(&pairs[1], count, 8, key);
+      CU_ASSERT_EQUAL(search_lower_bound(&pairs[1], count, 8, key), expected);
+      CU_ASSERT_EQUAL(search_lower_bound(keys, count, 4, key), expected);
+    }
+    CU_ASSERT_EQUAL(search_lower_bound(&pairs[1], count, 8, 0), 0);
+    CU_ASSERT_EQUAL(search_lower_bound(&pairs[1], count, 8, UINT32_MAX),
+                    count);
+  }
+
+  // Internal nodes read without their latch are searched one key at a time
+  uint32_t node[1024];
+  BtreeLayout layout = btree_layout(sizeof(node));
+  btree_node_internal_init(node);
+  *btree_node_internal_num_keys(node) = 300;
+  for (uint32_t i = 0; i < 300; i++) {
+    *btree_node_internal_key(node, i) = i * 3 + 1;
+  }
+  uint32_t num_keys = btree_node_internal_peek_num_keys(node, &layout);
+  CU_ASSERT_EQUAL(num_keys, 300);
+  for (uint32_t key = 0; key < 905; key++) {
+    CU_ASSERT_EQUAL(btree_node_internal_peek_find_child(node, num_keys, key),
+                    btree_node_internal_find_child(node, key));
+  }
+
+  // Unaligned keys spaced by an odd number of bytes, like leaf cells
+  for (uint32_t i = 0; i < 64; i++) {
+    uint32_t key = i * 10 + 5;
+    memcpy(&cells[i * 37], &key, sizeof(key));
+  }
+  for (uint32_t key = 0; key < 650; key++) {
+    CU_ASSERT_EQUAL(search_lower_bound(cells, 64, 37, key),
+                    search_lower_bound_scalar(cells, 64, 37, key));
+  }
+  CU_ASSERT_EQUAL(search_lower_bound(cells, 64, 37, 15), 1);
+  CU_ASSERT_EQUAL(search_lower_bound(cells, 64, 37, 16), 2);
+}
+
 // The main() function for setting up and running the tests.
 // Returns a CUE_SUCCESS on successful running, another
 // CUnit error code on failure.
@@ -27,7 +1696,54 @@ int main(void) {
   }
 
   // Add the tests to the suite
-  if ((NULL == CU_add_test(pSuite, "test of gnaro", gnaro_test))) {
+  if ((NULL == CU_add_test(pSuite, "test of gnaro", gnaro_test)) ||
+      (NULL == CU_add_test(pSuite, "test of buffer pool eviction",
+                           pager_eviction_test)) ||
+      (NULL == CU_add_test(pSuite, "test of buffer pool pinning",
+                           pager_pinning_test)) ||
+      (NULL == CU_add_test(pSuite, "test of dirty page flushing",
+                           pager_dirty_flush_test)) ||
+      (NULL == CU_add_test(pSuite, "test of write-ahead log recovery",
+                           wal_recovery_test)) ||
+      (NULL == CU_add_test(pSuite, "test of group commit",
+                           wal_group_commit_test)) ||
+      (NULL == CU_add_test(pSuite, "test of memory-mapped pager",
+                           pager_mmap_test)) ||
+      (NULL == CU_add_test(pSuite, "test of positional I/O",
+                           io_positional_test)) ||
+      (NULL == CU_add_test(pSuite, "test of asynchronous I/O",
+                           pager_async_io_test)) ||
+      (NULL == CU_add_test(pSuite, "test of sequential readahead",
+                           pager_readahead_test)) ||
+      (NULL == CU_add_test(pSuite, "test of the freelist",
+                           pager_freelist_test)) ||
+      (NULL == CU_add_test(pSuite, "test of the file header upgrade",
+                           database_upgrade_test)) ||
+      (NULL == CU_add_test(pSuite, "test of configurable page sizes",
+                           pager_page_size_test)) ||
+      (NULL == CU_add_test(pSuite, "test of page checksums",
+                           pager_checksum_test)) ||
+      (NULL == CU_add_test(pSuite, "test of internal node splits",
+                           btree_internal_split_test)) ||
+      (NULL == CU_add_test(pSuite, "test of key search", search_test)) ||
+      (NULL == CU_add_test(pSuite, "test of slotted leaves",
+                           btree_slotted_leaf_test)) ||
+      (NULL == CU_add_test(pSuite, "test of the leaf upgrade",
+                           database_upgrade_leaves_test)) ||
+      (NULL == CU_add_test(pSuite, "test of row serialization",
+                           row_serialize_test)) ||
+      (NULL == CU_add_test(pSuite, "test of overflow pages",
+                           btree_overflow_test)) ||
+      (NULL == CU_add_test(pSuite, "test of bulk loading", load_test)) ||
+      (NULL == CU_add_test(pSuite, "test of right edge appends",
+                           btree_append_test)) ||
+      (NULL == CU_add_test(pSuite, "test of deletes", btree_delete_test)) ||
+      (NULL == CU_add_test(pSuite, "test of select with a where clause",
+                           select_where_test)) ||
+      (NULL == CU_add_test(pSuite, "test of reverse scans",
+                           cursor_reverse_test)) ||
+      (NULL == CU_add_test(pSuite, "test of concurrent readers",
+                           cursor_concurrent_test))) {
     CU_cleanup_registry();
     return CU_get_error();
   }